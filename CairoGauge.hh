@@ -18,34 +18,24 @@
 
 #include <string>
 #include <functional>
-#include <cmath>
-#include <gtkmm.h>
-#include <cairomm/context.h>
+#include "CairoRenderWorker.hh"
+#include "CairoGaugeRenderer.hh"
 
-#define CAIROGAUGE_FONT_SIZE 14
-
-class CairoGauge : public Gtk::DrawingArea {
+class CairoGauge : public CairoAsyncWidget {
 protected:
 	typedef std::function<double(void *)> sample_fn_t;
 
-	std::string  __text;
 	sample_fn_t  __sample_fn;
-	double       __value, __value_max,
-		__tick_step;
-	size_t       __label_step;
-	Cairo::Matrix __transform_matrix;
-	Cairo::RefPtr<Cairo::Surface> __background;
+	double       __value, __snapshot_value;
+	CairoGaugeRenderer __renderer;
+	CairoRGBA    __text_rgba;
 
-	void draw_background(void);
-	
-	// Override Gtk::DrawingArea::on_draw() signal handler
-	bool on_draw(const Cairo::RefPtr<Cairo::Context> &cc) override;
-	// Override Gtk::Widget::on_size_allocate() signal handler
-	void on_size_allocate(Gtk::Allocation& allocation) override {
-		Gtk::Widget::on_size_allocate(allocation);
-		if (__background)
-			draw_background();
-	}
+	void take_snapshot() override;
+	void render(const Cairo::RefPtr<Cairo::Context> &cc, int width,
+		    int height, const Cairo::Matrix &m) override;
+
+	// Override Gtk::Widget::on_style_updated() signal handler
+	void on_style_updated() override;
 public:
 	/** Construct a CairoGauge object
 	 * @param text Text rendered below the gauge
@@ -56,38 +46,28 @@ public:
 	 */
 	CairoGauge(std::string text, sample_fn_t fn, double _M, double step = 0,
 		   size_t l_step = 1)
-		: __text(text), __sample_fn(fn), __value(0), __value_max(_M),
-		  __tick_step(step), __label_step(l_step),
-		  __transform_matrix(Cairo::identity_matrix()) { }
-	CairoGauge(const CairoGauge &_o) : CairoGauge(_o.__text, _o.__sample_fn,
-						_o.__value_max, _o.__tick_step,
-						_o.__label_step)
+		: __sample_fn(fn), __value(0), __snapshot_value(0),
+		  __renderer(text, _M, step, l_step), __text_rgba{ 0, 0, 0, 1 }
+	{ }
+	CairoGauge(const CairoGauge &_o)
+		: CairoGauge(_o.__renderer.get_text(), _o.__sample_fn,
+			     _o.__renderer.get_value_max(),
+			     _o.__renderer.get_tick_step(),
+			     _o.__renderer.get_label_step())
 	{ }
 	virtual ~CairoGauge() { }
 
-	void set_transform_matrix(Cairo::Matrix &_m)
-	{ __transform_matrix = _m;
-	  queue_draw(); }
-	
 	/** Call the @a fn function (constructor argument) and update gauge with
 	 * the returned value.
 	 */
 	void update(void *arg) {
 		auto v = __sample_fn(arg);
-		if (v != __value) {  // avoid invalidate_rect() if the value
+		if (v != __value) {  // avoid request_render() if the value
 			             // didn't change
 			__value = v;
-			get_window()->invalidate_rect
-				(Gdk::Rectangle(0, 0,
-						get_allocation().get_width(),
-						get_allocation().get_height()),
-				 FALSE);
+			request_render();
 		}
 	}
-
-protected:
-	inline double angle_of(double value)
-	{ return 5*M_PI_4 - (value / __value_max * 3*M_PI_2); }
 };
 
 #endif /* CAIROGAUGE_HH */
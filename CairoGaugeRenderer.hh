@@ -0,0 +1,79 @@
+/* CairoGaugeRenderer.hh - Draw a gauge on a Cairo context
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef CAIROGAUGERENDERER_HH
+#define CAIROGAUGERENDERER_HH
+
+#include <string>
+#include <cmath>
+#include "CairoRenderer.hh"
+
+#define CAIROGAUGE_FONT_SIZE 14
+
+/** Drawing code of CairoGauge; see CairoRenderer.hh.
+ */
+class CairoGaugeRenderer {
+protected:
+	std::string  __text;
+	double       __value_max, __tick_step;
+	size_t       __label_step;
+	CairoRGBA    __text_rgba;
+	Cairo::RefPtr<Cairo::Surface> __background;
+	int          __bg_width, __bg_height;
+
+	void draw_background(const Cairo::RefPtr<Cairo::Context> &cc,
+			     int width, int height);
+public:
+	/** Construct a CairoGaugeRenderer object
+	 * @param text Text rendered below the gauge
+	 * @param _M Maximum value of any sample
+	 * @param step Draw ticks using @a step increments
+	 * @param l_step Draw labels each @a l_step ticks
+	 */
+	CairoGaugeRenderer(std::string text, double _M, double step = 0,
+			   size_t l_step = 1)
+		: __text(text), __value_max(_M), __tick_step(step),
+		  __label_step(l_step), __text_rgba{ 0, 0, 0, 1 },
+		  __bg_width(0), __bg_height(0) { }
+
+	const std::string &get_text() const { return __text; }
+	double get_value_max() const { return __value_max; }
+	double get_tick_step() const { return __tick_step; }
+	size_t get_label_step() const { return __label_step; }
+
+	/** Set the color of the scale and text; the cached background is
+	 * redrawn if it changes.
+	 */
+	void set_text_rgba(const CairoRGBA &c) {
+		if (c != __text_rgba)
+			__text_rgba = c, __background.clear();
+	}
+
+	/** Draw the gauge in the (0, 0, @a width, @a height) rectangle of
+	 * @a cc; the background (scale and text) is drawn once into a cached
+	 * surface similar to the target of @a cc.
+	 * @param value Value pointed by the hand
+	 * @param m Transformation applied around the center (e.g. HUD mode)
+	 */
+	void draw(const Cairo::RefPtr<Cairo::Context> &cc, int width,
+		  int height, double value,
+		  const Cairo::Matrix &m = Cairo::identity_matrix());
+
+protected:
+	inline double angle_of(double value)
+	{ return 5*M_PI_4 - (value / __value_max * 3*M_PI_2); }
+};
+
+#endif /* CAIROGAUGERENDERER_HH */
@@ -0,0 +1,166 @@
+/* CairoHeatmap.cc - Operating-point heatmap widget (gtkmm)
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "CairoHeatmap.hh"
+#include "XR25alloc.hh"
+#include <algorithm>
+#include <cstdio>
+
+/* Cell geometry; i is the cell index, y grows upwards
+ */
+#define __cell_w(_w) (static_cast<double>((_w) - CAIROHEATMAP_MARGIN_LEFT \
+	- CAIROHEATMAP_MARGIN_RIGHT) / __nx)
+#define __cell_h(_h) (static_cast<double>((_h) - CAIROHEATMAP_MARGIN_TOP \
+	- CAIROHEATMAP_MARGIN_BOTTOM) / __ny)
+#define __cell_x(_w, _i) (CAIROHEATMAP_MARGIN_LEFT + ((_i) % __nx)	\
+			  * __cell_w(_w))
+#define __cell_y(_h, _i) (CAIROHEATMAP_MARGIN_TOP + (__ny - 1 - (_i) / __nx) \
+			  * __cell_h(_h))
+
+/** Map @a t in [0, 1] to a blue (0) to red (1) hue.
+ */
+static void heat_rgb(double t, double &r, double &g, double &b) {
+	double h = (1 - std::min(1.0, std::max(0.0, t))) * 4, // 0 red, 4 blue
+		f = h - std::floor(h);
+	switch (static_cast<int>(h)) {
+	case 0:  r = 1,     g = f,     b = 0;     break;
+	case 1:  r = 1 - f, g = 1,     b = 0;     break;
+	case 2:  r = 0,     g = 1,     b = f;     break;
+	case 3:  r = 0,     g = 1 - f, b = 1;     break;
+	default: r = 0,     g = 0,     b = 1;     break;
+	}
+}
+
+void CairoHeatmap::draw_surface(void) {
+	const int width = get_allocation().get_width(),
+		height = get_allocation().get_height();
+	Cairo::TextExtents _te;
+	char label[32];
+
+	__surface = get_window()
+		->create_similar_surface(Cairo::CONTENT_COLOR_ALPHA,
+					 width, height);
+	__surface_cc = Cairo::Context::create(__surface);
+	auto &cc = __surface_cc;
+	cc->set_font_size(CAIROHEATMAP_FONT_SIZE);
+	Gdk::Cairo::set_source_rgba(cc, __text_rgba);
+
+	// axis labels, every other bin
+	for (int i = 0; i <= __nx; i += 2) {
+		snprintf(label, sizeof(label), "%d",
+			 static_cast<int>(i * __x_step));
+		cc->get_text_extents(label, _te);
+		cc->move_to(CAIROHEATMAP_MARGIN_LEFT + i * __cell_w(width)
+			    - _te.width / 2, height - 8);
+		cc->show_text(label);
+	}
+	for (int j = 0; j <= __ny; j += 2) {
+		snprintf(label, sizeof(label), "%d",
+			 static_cast<int>(j * __y_step));
+		cc->get_text_extents(label, _te);
+		cc->move_to(CAIROHEATMAP_MARGIN_LEFT - _te.width - 4,
+			    height - CAIROHEATMAP_MARGIN_BOTTOM
+			    - j * __cell_h(height) + _te.height / 2);
+		cc->show_text(label);
+	}
+
+	// draw the __text string and the color scale range
+	snprintf(label, sizeof(label), " [%g - %g]", __value_min,
+		 __value_max);
+	cc->get_text_extents(__text + label, _te);
+	cc->move_to((width - _te.width) / 2, CAIROHEATMAP_MARGIN_TOP / 2);
+	cc->show_text(__text + label);
+
+	__drawn_cur = __cur.load();
+	for (int i = 0; i < __nx * __ny; ++i)
+		__cell[i]._dirty = FALSE, draw_cell(i);
+}
+
+void CairoHeatmap::draw_cell(int i) {
+	const int width = get_allocation().get_width(),
+		height = get_allocation().get_height();
+	const double x = __cell_x(width, i), y = __cell_y(height, i),
+		w = __cell_w(width), h = __cell_h(height);
+	auto &cc = __surface_cc;
+	double r, g, b;
+
+	cc->set_operator(Cairo::OPERATOR_SOURCE);
+	if (__cell[i]._n.load(std::memory_order_acquire) == 0)
+		r = g = b = 0.95;
+	else
+		heat_rgb((__cell[i]._mean.load(std::memory_order_relaxed)
+			  - __value_min) / (__value_max - __value_min),
+			 r, g, b);
+	cc->set_source_rgba(r, g, b, 1);
+	cc->rectangle(x + 0.5, y + 0.5, w - 1, h - 1);
+	cc->fill();
+	cc->set_operator(Cairo::OPERATOR_OVER);
+
+	if (i == __drawn_cur) {   // current operating point
+		cc->set_line_width(2);
+		Gdk::Cairo::set_source_rgba(cc, __text_rgba);
+		cc->rectangle(x + 1.5, y + 1.5, w - 3, h - 3);
+		cc->stroke();
+	}
+}
+
+/** Invalidate the area of cell @a i, as seen through __transform_matrix.
+ */
+void CairoHeatmap::queue_draw_cell(int i) {
+	const int width = get_allocation().get_width(),
+		height = get_allocation().get_height();
+	double x0 = __cell_x(width, i) - width / 2,
+		y0 = __cell_y(height, i) - height / 2,
+		x1 = x0 + __cell_w(width), y1 = y0 + __cell_h(height);
+	__transform_matrix.transform_point(x0, y0);
+	__transform_matrix.transform_point(x1, y1);
+	int x = std::floor(std::min(x0, x1)) + width / 2,
+		y = std::floor(std::min(y0, y1)) + height / 2;
+	queue_draw_area(x, y, std::ceil(std::fabs(x1 - x0)) + 1,
+			std::ceil(std::fabs(y1 - y0)) + 1);
+}
+
+void CairoHeatmap::update() {
+	XR25_ALLOC_CHECK_SCOPE("CairoHeatmap::update");
+	if (!__surface)
+		return queue_draw();
+
+	int cur = __cur.load(std::memory_order_relaxed);
+	if (cur != __drawn_cur) {   // move the current cell outline
+		int prev = __drawn_cur;
+		__drawn_cur = cur;
+		if (prev >= 0)
+			draw_cell(prev), queue_draw_cell(prev);
+		__cell[cur]._dirty = TRUE;
+	}
+	for (int i = 0; i < __nx * __ny; ++i)
+		if (__cell[i]._dirty.exchange(FALSE,
+					      std::memory_order_acquire))
+			draw_cell(i), queue_draw_cell(i);
+}
+
+bool CairoHeatmap::on_draw(const Cairo::RefPtr<Cairo::Context> &cc) {
+	const int width = get_allocation().get_width(),
+		height = get_allocation().get_height();
+
+	if (!__surface)
+		draw_surface();
+	XR25_ALLOC_CHECK_SCOPE("CairoHeatmap::on_draw");
+	cc->translate(width / 2, height / 2);
+	cc->transform(__transform_matrix);
+	cc->set_source(__surface, -width / 2, -height / 2);
+	cc->paint();
+	return TRUE;
+}
@@ -0,0 +1,125 @@
+/* CairoHeatmap.hh - Operating-point heatmap widget (gtkmm)
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef CAIROHEATMAP_HH
+#define CAIROHEATMAP_HH
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cmath>
+#include <gtkmm.h>
+#include <cairomm/context.h>
+
+#define CAIROHEATMAP_FONT_SIZE     12
+#define CAIROHEATMAP_MARGIN_LEFT   40
+#define CAIROHEATMAP_MARGIN_TOP    32
+#define CAIROHEATMAP_MARGIN_RIGHT  8
+#define CAIROHEATMAP_MARGIN_BOTTOM 24
+
+/** Mean of a value (e.g. injection time) binned by two others (rpm and MAP).
+ * sample() updates the count and running mean of one cell in O(1) and marks
+ * it dirty; update() repaints the dirty cells into a cached surface and
+ * invalidates only their area, so the table can be fed at the full frame
+ * rate.
+ */
+class CairoHeatmap : public Gtk::DrawingArea {
+protected:
+	struct cell_t {
+		std::atomic<unsigned> _n;
+		std::atomic<double>   _mean;
+		std::atomic_bool      _dirty;
+	};
+
+	std::string  __text;
+	double       __x_max, __x_step, __y_max, __y_step,
+		__value_min, __value_max;
+	int          __nx, __ny;
+	std::unique_ptr<cell_t[]> __cell;
+	std::atomic_int           __cur;     // cell of the last sample
+	int                       __drawn_cur;
+	Gdk::RGBA     __text_rgba;
+	Cairo::Matrix __transform_matrix;
+	Cairo::RefPtr<Cairo::Surface> __surface;
+	Cairo::RefPtr<Cairo::Context> __surface_cc;
+
+	void draw_surface(void);
+	void draw_cell(int i);
+	void queue_draw_cell(int i);
+
+	// Override Gtk::DrawingArea::on_draw() signal handler
+	bool on_draw(const Cairo::RefPtr<Cairo::Context> &cc) override;
+	// Override Gtk::Widget::on_size_allocate() signal handler
+	void on_size_allocate(Gtk::Allocation& allocation) override {
+		Gtk::Widget::on_size_allocate(allocation);
+		if (__surface)
+			draw_surface();
+	}
+public:
+	/** Construct a CairoHeatmap object
+	 * @param text Text rendered above the table
+	 * @param x_max, x_step Horizontal axis range [0, x_max) and bin width
+	 * @param y_max, y_step Vertical axis range [0, y_max) and bin width
+	 * @param _m, _M Value mapped to the first / last color of the scale
+	 */
+	CairoHeatmap(std::string text, double x_max, double x_step,
+		     double y_max, double y_step, double _m, double _M)
+		: __text(text), __x_max(x_max), __x_step(x_step),
+		  __y_max(y_max), __y_step(y_step), __value_min(_m),
+		  __value_max(_M),
+		  __nx(static_cast<int>(std::ceil(x_max / x_step))),
+		  __ny(static_cast<int>(std::ceil(y_max / y_step))),
+		  __cell(new cell_t[__nx * __ny]()), __cur(-1),
+		  __drawn_cur(-1),
+		  __transform_matrix(Cairo::identity_matrix()) {
+		get_style_context()->lookup_color("theme_text_color",
+						  __text_rgba);
+	}
+	CairoHeatmap(const CairoHeatmap &_o)
+		: CairoHeatmap(_o.__text, _o.__x_max, _o.__x_step, _o.__y_max,
+			       _o.__y_step, _o.__value_min, _o.__value_max)
+	{ }
+	virtual ~CairoHeatmap() { }
+
+	void set_transform_matrix(Cairo::Matrix &_m)
+	{ __transform_matrix = _m;
+	  queue_draw(); }
+
+	/** Add a sample to the cell of (@a x, @a y); values out of range go to
+	 * the border cells.  Called from a single (reader) thread.
+	 */
+	void sample(double x, double y, double v) {
+		int i = bin(x, __x_step, __nx) + __nx * bin(y, __y_step, __ny);
+		cell_t &c = __cell[i];
+		unsigned n = c._n.load(std::memory_order_relaxed) + 1;
+		double m = c._mean.load(std::memory_order_relaxed);
+		c._mean.store(m + (v - m) / n, std::memory_order_relaxed);
+		c._n.store(n, std::memory_order_relaxed);
+		c._dirty.store(TRUE, std::memory_order_release);
+		__cur.store(i, std::memory_order_relaxed);
+	}
+
+	/** Repaint the cells changed since the last call; does not allocate.
+	 */
+	void update();
+
+protected:
+	static inline int bin(double v, double step, int n) {
+		int i = static_cast<int>(v / step);
+		return i < 0 ? 0 : i >= n ? n - 1 : i;
+	}
+};
+
+#endif /* CAIROHEATMAP_HH */
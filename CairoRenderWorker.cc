@@ -0,0 +1,147 @@
+/* CairoRenderWorker.cc - Render widgets off the GTK main thread
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "CairoRenderWorker.hh"
+#include "XR25alloc.hh"
+
+void CairoAsyncWidget::request_render() {
+	if (!__worker)
+		return queue_draw();
+	if (!get_mapped())   // rendered on the first on_draw()
+		return;
+	if (__in_flight) {
+		__again = true;
+		return;
+	}
+
+	take_snapshot();
+	__job_width = get_allocated_width();
+	__job_height = get_allocated_height();
+	__job_scale = get_scale_factor();
+	__job_matrix = __transform_matrix;
+	__in_flight = true;
+	__worker->post(this);
+}
+
+void CairoAsyncWidget::render_job() {
+	const int width = __job_width, height = __job_height,
+		scale = __job_scale;
+	if (width <= 0 || height <= 0)
+		return;
+	if (!__back || __back_width != width || __back_height != height
+	    || __back_scale != scale) {
+		__back = Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32,
+						     width * scale,
+						     height * scale);
+		cairo_surface_set_device_scale(__back->cobj(), scale,
+					       scale);
+		__back_width = width, __back_height = height;
+		__back_scale = scale;
+	}
+	{
+		auto cc = Cairo::Context::create(__back);
+		cc->set_operator(Cairo::OPERATOR_CLEAR);
+		cc->paint();
+		cc->set_operator(Cairo::OPERATOR_OVER);
+		render(cc, width, height, __job_matrix);
+	}
+	__back->flush();
+
+	std::lock_guard<std::mutex> lock(__surface_m);
+	std::swap(__front, __back);
+	std::swap(__front_width, __back_width);
+	std::swap(__front_height, __back_height);
+	std::swap(__front_scale, __back_scale);
+}
+
+void CairoAsyncWidget::job_done() {
+	__in_flight = false;
+	queue_draw();
+	if (__again) {
+		__again = false;
+		request_render();
+	}
+}
+
+bool CairoAsyncWidget::on_draw(const Cairo::RefPtr<Cairo::Context> &cc) {
+	const int width = get_allocated_width(),
+		height = get_allocated_height();
+
+	if (!__worker) {
+		take_snapshot();
+		render(cc, width, height, __transform_matrix);
+		return TRUE;
+	}
+
+	XR25_ALLOC_CHECK_SCOPE("CairoAsyncWidget::on_draw");
+	std::lock_guard<std::mutex> lock(__surface_m);
+	if (!__front || __front_width != width || __front_height != height)
+		request_render();
+	if (__front) {  // blit; may be stale until the job finishes
+		cc->set_source(__front, 0, 0);
+		cc->paint();
+	}
+	return TRUE;
+}
+
+CairoRenderWorker::CairoRenderWorker() : __stop(false) {
+	__queue.reserve(CAIRORENDERWORKER_MAX_QUEUE);
+	__done.reserve(CAIRORENDERWORKER_MAX_QUEUE);
+	__rendering.reserve(CAIRORENDERWORKER_MAX_QUEUE);
+	__finished.reserve(CAIRORENDERWORKER_MAX_QUEUE);
+	__dispatcher.connect(sigc::mem_fun(*this,
+					   &CairoRenderWorker::on_done));
+	__thrd = std::thread(&CairoRenderWorker::run, this);
+}
+
+CairoRenderWorker::~CairoRenderWorker() {
+	{
+		std::lock_guard<std::mutex> lock(__m);
+		__stop = true;
+	}
+	__cv.notify_one();
+	__thrd.join();
+}
+
+void CairoRenderWorker::run() {
+	std::unique_lock<std::mutex> lock(__m);
+	for (;;) {
+		__cv.wait(lock, [this]() {
+				return __stop || !__queue.empty(); });
+		if (__stop)
+			break;
+		__rendering.swap(__queue);   // capacities are swapped, too
+		lock.unlock();
+		for (auto i : __rendering)
+			i->render_job();
+		lock.lock();
+		__done.insert(__done.end(), __rendering.begin(),
+			      __rendering.end());
+		__rendering.clear();
+		__dispatcher.emit();
+	}
+}
+
+/** Called on the main thread once jobs finish.
+ */
+void CairoRenderWorker::on_done() {
+	{
+		std::lock_guard<std::mutex> lock(__m);
+		__finished.swap(__done);
+	}
+	for (auto i : __finished)
+		i->job_done();
+	__finished.clear();
+}
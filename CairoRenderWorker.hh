@@ -0,0 +1,131 @@
+/* CairoRenderWorker.hh - Render widgets off the GTK main thread
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef CAIRORENDERWORKER_HH
+#define CAIRORENDERWORKER_HH
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <gtkmm.h>
+#include <cairomm/context.h>
+#include "CairoRenderer.hh"
+
+inline CairoRGBA to_cairo_rgba(const Gdk::RGBA &c)
+{ return { c.get_red(), c.get_green(), c.get_blue(), c.get_alpha() }; }
+
+class CairoRenderWorker;
+
+/** A Gtk::DrawingArea drawn by a CairoRenderWorker: request_render() takes a
+ * snapshot of the widget data on the main thread and queues the widget; the
+ * worker thread render()s the snapshot into an image surface, which is
+ * swapped with the one on_draw() paints.  At most one job per widget is in
+ * flight; requests made meanwhile are coalesced into a single new job.
+ * Without a worker, on_draw() renders synchronously.
+ */
+class CairoAsyncWidget : public Gtk::DrawingArea {
+	friend class CairoRenderWorker;
+private:
+	CairoRenderWorker *__worker;
+	std::mutex        __surface_m;     // guards __front*
+	Cairo::RefPtr<Cairo::ImageSurface> __front, __back;
+	int               __front_width, __front_height, __front_scale,
+		__back_width, __back_height, __back_scale;   // worker only
+	int               __job_width, __job_height, __job_scale;
+	Cairo::Matrix     __job_matrix;
+	bool              __in_flight, __again;             // main only
+
+	void render_job();   // worker thread
+	void job_done();     // main thread
+protected:
+	Cairo::Matrix     __transform_matrix;
+
+	/** Copy the data to draw; called on the main thread while no job is
+	 * in flight, so render() may read the copy without locking.
+	 */
+	virtual void take_snapshot() = 0;
+	/** Draw the last snapshot in the (0, 0, @a width, @a height)
+	 * rectangle of @a cc; called on the worker thread.
+	 */
+	virtual void render(const Cairo::RefPtr<Cairo::Context> &cc,
+			    int width, int height, const Cairo::Matrix &m) = 0;
+
+	/** Render the widget again; does not allocate once warmed up.
+	 */
+	void request_render();
+
+	// Override Gtk::DrawingArea::on_draw() signal handler
+	bool on_draw(const Cairo::RefPtr<Cairo::Context> &cc) override;
+	// Override Gtk::Widget::on_size_allocate() signal handler
+	void on_size_allocate(Gtk::Allocation& allocation) override {
+		Gtk::Widget::on_size_allocate(allocation);
+		request_render();
+	}
+public:
+	CairoAsyncWidget()
+		: __worker(nullptr), __front_width(0), __front_height(0),
+		  __front_scale(0), __back_width(0), __back_height(0),
+		  __back_scale(0),
+		  __job_width(0), __job_height(0), __job_scale(1),
+		  __job_matrix(Cairo::identity_matrix()), __in_flight(false),
+		  __again(false),
+		  __transform_matrix(Cairo::identity_matrix()) { }
+	virtual ~CairoAsyncWidget() { }
+
+	/** Render through @a w; must be called before the widget is shown.
+	 * The worker must be destroyed before the widget.
+	 */
+	void set_render_worker(CairoRenderWorker *w) { __worker = w; }
+
+	void set_transform_matrix(Cairo::Matrix &_m)
+	{ __transform_matrix = _m;
+	  request_render(); }
+};
+
+/** One thread rendering CairoAsyncWidget objects; see above.  Must be
+ * constructed on the main thread (finished jobs are reported through a
+ * Glib::Dispatcher).
+ */
+class CairoRenderWorker {
+private:
+	std::mutex              __m;
+	std::condition_variable __cv;
+	bool                    __stop;
+	std::vector<CairoAsyncWidget *> __queue, __done;  // guarded by __m
+	std::vector<CairoAsyncWidget *> __rendering,      // worker only
+		__finished;                               // main only
+	Glib::Dispatcher        __dispatcher;
+	std::thread             __thrd;
+
+	void run();
+	void on_done();
+public:
+#define CAIRORENDERWORKER_MAX_QUEUE 64   // initial capacity; may grow
+	CairoRenderWorker();
+	~CairoRenderWorker();
+
+	/** Queue @a w for rendering; main thread only.
+	 */
+	void post(CairoAsyncWidget *w) {
+		{
+			std::lock_guard<std::mutex> lock(__m);
+			__queue.push_back(w);
+		}
+		__cv.notify_one();
+	}
+};
+
+#endif /* CAIRORENDERWORKER_HH */
@@ -0,0 +1,40 @@
+/* CairoRenderer.hh - Definitions shared by the Cairo renderers
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef CAIRORENDERER_HH
+#define CAIRORENDERER_HH
+
+#include <cairomm/context.h>
+#include <cairomm/surface.h>
+
+/* The renderers (CairoGaugeRenderer, CairoTSPlotRenderer) hold the drawing
+ * code of the widgets; they depend on cairomm only, so they can draw on any
+ * surface (e.g. an image surface on a CairoRenderWorker thread, or a PDF
+ * file without a display).  A renderer is not thread-safe, but needs no
+ * particular thread.
+ */
+
+struct CairoRGBA {
+	double r, g, b, a;
+};
+
+inline void set_source_rgba(const Cairo::RefPtr<Cairo::Context> &cc,
+			    const CairoRGBA &c)
+{ cc->set_source_rgba(c.r, c.g, c.b, c.a); }
+
+inline bool operator!=(const CairoRGBA &a, const CairoRGBA &b)
+{ return a.r != b.r || a.g != b.g || a.b != b.b || a.a != b.a; }
+
+#endif /* CAIRORENDERER_HH */
@@ -17,121 +17,70 @@
 #define CAIROTSPLOT_HH
 
 #include <string>
-#include <functional>
-#include <chrono>
-#include <cmath>
-#include <atomic>
-#include <gtkmm.h>
-#include <cairomm/context.h>
+#include <memory>
+#include "XR25history.hh"
+#include "CairoRenderWorker.hh"
+#include "CairoTSPlotRenderer.hh"
 
-#define CAIROTSPLOT_FONT_SIZE 14
-#define MARGIN_LEFT         4
-#define MARGIN_TOP          40
-#define MARGIN_RIGHT        32
-#define MARGIN_BOTTOM       32
-#define __RGBA_DEFAULT      Gdk::RGBA{"#2e7db3"}
-#define __RGBA_ALERT        Gdk::RGBA{"#cc0d29"}
-//  NUM_POINTS should be a power-of-2
-#define NUM_POINTS          512
-
-class CairoTSPlot : public Gtk::DrawingArea {
+/** A read-only view of a XR25history column; plots share the history,
+ * which is fed once per frame.
+ */
+class CairoTSPlot : public CairoAsyncWidget {
 protected:
-	typedef std::function<double(void *, bool&)> sample_fn_t;
-	struct value_struct {
-		double _v;
-		bool _alert;
-		bool _has_tp;
-		std::chrono::time_point<
-			std::chrono::steady_clock> _tp;
-		value_struct() : _v(HUGE_VAL), _alert(FALSE), _has_tp(FALSE) { }
-	};
-	
-	std::string  __text;
-	sample_fn_t  __sample_fn;
-	std::unique_ptr<value_struct[]> __data;
-	std::atomic_uint                __data_i;
-	std::atomic_bool              __data_chg;
-	std::chrono::time_point<std::chrono::steady_clock> __last_tp;
-	double       __value_min, __value_max,
-		__tick_step, __data_height;
-	Gdk::RGBA       __text_rgba;
-	Cairo::Matrix __transform_matrix;
-	Cairo::RefPtr<Cairo::Surface> __background;
+	typedef CairoTSPlotRenderer::time_point time_point;
 
-	void draw_background(void);
-	
-	// Override Gtk::DrawingArea::on_draw() signal handler
-	bool on_draw(const Cairo::RefPtr<Cairo::Context> &cc) override;
-	// Override Gtk::Widget::on_size_allocate() signal handler
-	void on_size_allocate(Gtk::Allocation& allocation) override {
-		Gtk::Widget::on_size_allocate(allocation);
-		__data_height = allocation.get_height() - MARGIN_TOP
-			                                - MARGIN_BOTTOM;
-		if (__background)
-			draw_background();
-	}
+	const XR25history *__history;
+	unsigned     __column;
+	unsigned long __seen;                  // history count() drawn
+	std::unique_ptr<float[]>      __snapshot_v;   // newest first
+	std::unique_ptr<bool[]>       __snapshot_alert;
+	std::unique_ptr<time_point[]> __snapshot_t;
+	unsigned     __snapshot_n;
+	time_point   __snapshot_tp;
+	CairoTSPlotRenderer __renderer;
+	CairoRGBA    __text_rgba;
+
+	void take_snapshot() override;
+	void render(const Cairo::RefPtr<Cairo::Context> &cc, int width,
+		    int height, const Cairo::Matrix &m) override;
+
+	// Override Gtk::Widget::on_style_updated() signal handler
+	void on_style_updated() override;
+	void lookup_text_rgba();
 public:
-	/** Construct a CairoTSPlot object
+	/** Construct a CairoTSPlot object; nothing is drawn until
+	 * set_history() is called.
 	 * @param text Text rendered above the plot
-	 * @param fn std::function<double(void *, bool&)> that returns the 
-	 *     next value; the second argument is used to change the _alert
-	 *     member of the current 'struct value_struct'
 	 * @param _m Minimum value of any sample
 	 * @param _M Maximum value of any sample
 	 * @param step Draw vertical axis scale using @a step increments
 	 */
-	CairoTSPlot(std::string text, sample_fn_t fn, double _m, double _M,
-		    double step = 0)
-		: __text(text), __sample_fn(fn),
-		  __data(new value_struct[NUM_POINTS]), __data_i(0),
-		  __data_chg(FALSE), __value_min(_m), __value_max(_M),
-		__tick_step(step),__transform_matrix(Cairo::identity_matrix()) {
-		get_style_context()->lookup_color("theme_text_color",
-						  __text_rgba);
+	CairoTSPlot(std::string text, double _m, double _M, double step = 0)
+		: __history(nullptr), __column(0), __seen(0),
+		  __snapshot_v(new float[NUM_POINTS]),
+		  __snapshot_alert(new bool[NUM_POINTS]),
+		  __snapshot_t(new time_point[NUM_POINTS]), __snapshot_n(0),
+		  __renderer(text, _m, _M, step), __text_rgba{ 0, 0, 0, 1 } {
+		lookup_text_rgba();
 	}
-	CairoTSPlot(const CairoTSPlot &_o) :CairoTSPlot(_o.__text,_o.__sample_fn
-				, _o.__value_min,_o.__value_max, _o.__tick_step)
+	CairoTSPlot(const CairoTSPlot &_o)
+		: CairoTSPlot(_o.__renderer.get_text(),
+			      _o.__renderer.get_value_min(),
+			      _o.__renderer.get_value_max(),
+			      _o.__renderer.get_tick_step())
 	{ }
 	virtual ~CairoTSPlot() { }
 
-	void set_transform_matrix(Cairo::Matrix &_m)
-	{ __transform_matrix = _m;
-	  queue_draw(); }
-
-#define __circbuf_get(_b, _i) (_b[(_i) & (NUM_POINTS - 1)])
-	/** Call the @a fn function (constructor argument) and rotate __data;
-	 * __data[__data_i] will be the new value.
+	/** Plot column @a c of @a h; @a h must outlive the widget.
 	 */
-	void sample(void *arg, std::chrono::time_point<
-	    std::chrono::steady_clock> _tp = std::chrono::steady_clock::now()) {
-		std::chrono::duration<double> _diff = _tp - __last_tp;
-		bool has_tp = (_diff.count() >= 5.0f);
-		struct value_struct &_s = __circbuf_get(__data,
-							__data_i.fetch_add(1));
+	void set_history(const XR25history *h, unsigned c)
+	{ __history = h, __column = c;
+	  request_render(); }
 
-		_s._v = __sample_fn(arg, _s._alert);
-		if ((_s._has_tp = has_tp))
-			__last_tp = _s._tp = _tp;
-		__data_chg = TRUE;
-	}
-	
 	void update() {
-		if (__data_chg) {  // avoid invalidate_rect() if __data[]
-			           // didn't change
-			__data_chg = FALSE;
-			get_window()->invalidate_rect
-				(Gdk::Rectangle(0, 0,
-						get_allocation().get_width(),
-						get_allocation().get_height()),
-				 FALSE);
-		}
+		if (__history && __history->count() != __seen)
+			request_render();  // only if the history changed
 	}
-
-protected:
-	inline double yoffset_of(double value)
-	{ return static_cast<int>
-			((value - __value_min) / (__value_max - __value_min)
-			 * __data_height); }
 };
 
 #endif /* CAIROTSPLOT_HH */
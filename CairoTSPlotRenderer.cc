@@ -0,0 +1,162 @@
+/* CairoTSPlotRenderer.cc - Draw a time series plot on a Cairo context
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "CairoTSPlotRenderer.hh"
+#include "XR25alloc.hh"
+#include <cstdio>
+#include <cstdlib>
+
+void CairoTSPlotRenderer::draw_background(const Cairo::RefPtr<Cairo::Context>
+					  &target, int width, int height) {
+	const int _y0 = height - MARGIN_BOTTOM;
+	Cairo::TextExtents _te;
+
+	__background = Cairo::Surface::create(target->get_target(),
+					      Cairo::CONTENT_COLOR_ALPHA,
+					      width, height);
+	__bg_width = width, __bg_height = height;
+	auto cc = Cairo::Context::create(__background);
+
+	cc->set_antialias(Cairo::ANTIALIAS_SUBPIXEL);
+	cc->set_line_cap(Cairo::LINE_CAP_ROUND);
+	cc->set_line_width(1);
+
+	// background
+	cc->set_source_rgba(1, 1, 1, 1);
+	cc->rectangle(MARGIN_LEFT, MARGIN_TOP,
+		      width - MARGIN_LEFT - MARGIN_RIGHT,
+		      height - MARGIN_TOP - MARGIN_BOTTOM);
+	cc->fill();
+	cc->translate(-0.5f, -0.5f);  // avoid AA blur
+
+	// vertical axis scale and borders
+	if (__tick_step != 0)
+		for (double i = __value_min; i <= __value_max;i +=__tick_step) {
+			double _y = yoffset_of(i, height);
+			std::string label = std::to_string(static_cast<int>(i));
+
+			if (i == __value_min || i == __value_max)
+				cc->set_source_rgba(0.70, 0.71, 0.70, 1);
+			else
+				cc->set_source_rgba(0.89, 0.89, 0.89, 1);
+			cc->move_to(MARGIN_LEFT, _y0 - _y);
+			cc->line_to(width - MARGIN_RIGHT + 4, _y0 - _y);
+			cc->stroke();
+
+			set_source_rgba(cc, __text_rgba);
+			cc->get_text_extents(label, _te);
+			cc->move_to(width - MARGIN_RIGHT + 6,
+				    _y0 - _y + (_te.height / 2));
+			cc->show_text(label);
+		}
+	cc->set_source_rgba(0.70, 0.71, 0.70, 1);
+	cc->move_to(MARGIN_LEFT, MARGIN_TOP);
+	cc->line_to(MARGIN_LEFT, height - MARGIN_BOTTOM);
+	cc->move_to(width - MARGIN_RIGHT, MARGIN_TOP);
+	cc->line_to(width - MARGIN_RIGHT, height - MARGIN_BOTTOM);
+	cc->stroke();
+
+	// draw the __text string
+	set_source_rgba(cc, __text_rgba);
+	cc->set_font_size(CAIROTSPLOT_FONT_SIZE);
+	cc->get_text_extents(__text, _te);
+	cc->move_to((width - _te.width) / 2, MARGIN_TOP / 2);
+	cc->show_text(__text);
+}
+
+void CairoTSPlotRenderer::draw(const Cairo::RefPtr<Cairo::Context> &cc,
+			       int width, int height, const float v[],
+			       const bool alert[], const time_point t[],
+			       unsigned n, time_point now,
+			       const Cairo::Matrix &m) {
+	const int _y0 = (height / 2) - MARGIN_BOTTOM,
+		_x_offset = (width / 2) - MARGIN_RIGHT;
+	const double _xstep = (width - MARGIN_LEFT
+			       - MARGIN_RIGHT)/ static_cast<double>(NUM_POINTS),
+		_data_height = height - MARGIN_TOP - MARGIN_BOTTOM;
+	bool _last;
+	Cairo::TextExtents _te;
+
+	if (!__background || __bg_width != width || __bg_height != height)
+		draw_background(cc, width, height);
+	XR25_ALLOC_CHECK_SCOPE("CairoTSPlotRenderer::draw");
+	cc->save();
+	cc->set_antialias(Cairo::ANTIALIAS_SUBPIXEL);
+	cc->translate((width / 2) - 0.5f, (height / 2) - 0.5f);
+	cc->transform(m);
+	cc->set_line_cap(Cairo::LINE_CAP_ROUND);
+	cc->set_line_join(Cairo::LINE_JOIN_ROUND);
+
+	cc->set_source(__background, -(width / 2) - 0.5f,  // avoid AA blur
+		       -(height / 2) - 0.5f);
+	cc->paint();
+	cc->set_line_width(1);
+	if (n > NUM_POINTS)
+		n = NUM_POINTS;
+
+	// horizontal axis scale; a label where the sample time crosses a
+	// multiple of __label_secs, so labels scroll with the data
+	for (unsigned i = 0; i + 1 < n; ++i) {
+		using std::chrono::duration_cast;
+		using std::chrono::seconds;
+		if (duration_cast<seconds>(t[i].time_since_epoch()).count()
+		    / __label_secs == duration_cast<seconds>
+		    (t[i + 1].time_since_epoch()).count() / __label_secs)
+			continue;
+
+		std::chrono::duration<double> diff = now - t[i];
+		const int secs = std::abs(static_cast<int>(diff.count()));
+		char label[16];
+		if (__label_secs % 60 == 0)
+			snprintf(label, sizeof(label), "%dmin", secs / 60);
+		else
+			snprintf(label, sizeof(label), "%ds", secs);
+
+		cc->set_source_rgba(0.89, 0.89, 0.89, 1);
+		cc->move_to(_x_offset - (_xstep * i), _y0 - _data_height);
+		cc->line_to(_x_offset - (_xstep * i), _y0 + 4);
+		cc->stroke();
+
+		set_source_rgba(cc, __text_rgba);
+		// cairo C API: no std::string temporaries
+		cairo_text_extents(cc->cobj(), label, &_te);
+		cc->move_to(_x_offset - (_xstep * i) - (_te.width / 2),
+			    _y0 + 11);
+		cairo_show_text(cc->cobj(), label);
+	}
+
+	// draw plot
+	if (n > 0) {
+		set_source_rgba(cc, (_last = alert[0]) ? __rgba_alert
+				: __rgba_default);
+		cc->set_line_width(2);
+		cc->move_to(_x_offset, _y0 - yoffset_of(v[0], height));
+	}
+	for (unsigned i = 1; i < n; ++i) {
+		cc->line_to(_x_offset - (_xstep * i),
+			    _y0 - yoffset_of(v[i], height));
+		if (_last ^ alert[i]) { /* set a different RGBA and
+					 * continue path if alert[i]
+					 * changed */
+			cc->stroke();
+			set_source_rgba(cc, (_last = alert[i])
+					? __rgba_alert : __rgba_default);
+			cc->move_to(_x_offset - (_xstep * i),
+				    _y0 - yoffset_of(v[i], height));
+		}
+	}
+	cc->stroke();
+	cc->restore();
+}
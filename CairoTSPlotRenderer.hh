@@ -0,0 +1,111 @@
+/* CairoTSPlotRenderer.hh - Draw a time series plot on a Cairo context
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef CAIROTSPLOTRENDERER_HH
+#define CAIROTSPLOTRENDERER_HH
+
+#include <string>
+#include <chrono>
+#include "CairoRenderer.hh"
+
+#define CAIROTSPLOT_FONT_SIZE 14
+#define MARGIN_LEFT         4
+#define MARGIN_TOP          40
+#define MARGIN_RIGHT        32
+#define MARGIN_BOTTOM       32
+#define __RGBA_DEFAULT      CairoRGBA{ 0x2e / 255., 0x7d / 255., \
+				       0xb3 / 255., 1 }   // #2e7db3
+#define __RGBA_ALERT        CairoRGBA{ 0xcc / 255., 0x0d / 255., \
+				       0x29 / 255., 1 }   // #cc0d29
+//  NUM_POINTS should be a power-of-2
+#define NUM_POINTS          512
+
+#define CAIROTSPLOT_LABEL_SECS 5   // default horizontal axis label interval
+
+/** Drawing code of CairoTSPlot; see CairoRenderer.hh.
+ */
+class CairoTSPlotRenderer {
+public:
+	typedef std::chrono::steady_clock::time_point time_point;
+protected:
+	std::string  __text;
+	double       __value_min, __value_max, __tick_step;
+	CairoRGBA    __text_rgba, __rgba_default, __rgba_alert;
+	unsigned     __label_secs;
+	Cairo::RefPtr<Cairo::Surface> __background;
+	int          __bg_width, __bg_height;
+
+	void draw_background(const Cairo::RefPtr<Cairo::Context> &cc,
+			     int width, int height);
+public:
+	/** Construct a CairoTSPlotRenderer object
+	 * @param text Text rendered above the plot
+	 * @param _m Minimum value of any sample
+	 * @param _M Maximum value of any sample
+	 * @param step Draw vertical axis scale using @a step increments
+	 */
+	CairoTSPlotRenderer(std::string text, double _m, double _M,
+			    double step = 0)
+		: __text(text), __value_min(_m), __value_max(_M),
+		  __tick_step(step), __text_rgba{ 0, 0, 0, 1 },
+		  __rgba_default(__RGBA_DEFAULT), __rgba_alert(__RGBA_ALERT),
+		  __label_secs(CAIROTSPLOT_LABEL_SECS), __bg_width(0),
+		  __bg_height(0) { }
+
+	const std::string &get_text() const { return __text; }
+	double get_value_min() const { return __value_min; }
+	double get_value_max() const { return __value_max; }
+	double get_tick_step() const { return __tick_step; }
+
+	/** Set the color of the scale and text; the cached background is
+	 * redrawn if it changes.
+	 */
+	void set_text_rgba(const CairoRGBA &c) {
+		if (c != __text_rgba)
+			__text_rgba = c, __background.clear();
+	}
+
+	/** Set the horizontal axis label interval; labels are written in
+	 * minutes if @a secs is a multiple of 60.
+	 */
+	void set_label_secs(unsigned secs) { __label_secs = secs ? secs : 1; }
+
+	/** Draw the plot in the (0, 0, @a width, @a height) rectangle of
+	 * @a cc; the background (scale and text) is drawn once into a cached
+	 * surface similar to the target of @a cc.  Samples are given newest
+	 * first as columns of @a n elements, see XR25history::copy(); at most
+	 * NUM_POINTS are drawn.
+	 * @param v Values
+	 * @param alert Draw the sample using the alert color
+	 * @param t Sample times; the horizontal axis is labeled every
+	 *     set_label_secs() seconds
+	 * @param now Time the horizontal axis labels are relative to; labels
+	 *     show the distance to it, e.g. the age of the samples or, given
+	 *     the start of a session, the time since then
+	 * @param m Transformation applied around the center (e.g. HUD mode)
+	 */
+	void draw(const Cairo::RefPtr<Cairo::Context> &cc, int width,
+		  int height, const float v[], const bool alert[],
+		  const time_point t[], unsigned n, time_point now,
+		  const Cairo::Matrix &m = Cairo::identity_matrix());
+
+protected:
+	inline double yoffset_of(double value, int height)
+	{ return static_cast<int>
+			((value - __value_min) / (__value_max - __value_min)
+			 * (height - MARGIN_TOP - MARGIN_BOTTOM)); }
+};
+
+#endif /* CAIROTSPLOTRENDERER_HH */
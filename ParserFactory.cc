@@ -0,0 +1,27 @@
+/* ParserFactory.cc - instantiate objects of type 'XXXparser'
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "ParserFactory.hh"
+
+#define REGISTER_TYPE(_typename) { #_typename, []() {     \
+		return std::make_shared<_typename>(); } }
+
+/** Use the REGISTER_TYPE(xxx) macro to add new parser types here.
+ */
+const ParserFactory::ctor_map_t ParserFactory::__map = {
+	REGISTER_TYPE(Fenix3parser),
+	REGISTER_TYPE(Fenix1parser),
+	REGISTER_TYPE(Fenix52Bparser),
+};
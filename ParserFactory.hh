@@ -16,7 +16,7 @@
 #ifndef PARSERFACTORY_HH
 #define PARSERFACTORY_HH
 
-#include <unordered_map>
+#include <map>
 #include <memory>
 #include <string>
 #include <functional>
@@ -39,15 +39,4 @@ public:
 	static const ctor_map_t &get_registered_types() { return __map; }
 };
 
-#define REGISTER_TYPE(_typename) { #_typename, []() {     \
-		return std::make_shared<_typename>(); } }
-
-/** Use the REGISTER_TYPE(xxx) macro to add new parser types here.
- */
-const ParserFactory::ctor_map_t ParserFactory::__map = {
-	REGISTER_TYPE(Fenix3parser),
-	REGISTER_TYPE(Fenix1parser),
-	REGISTER_TYPE(Fenix52Bparser),
-};
-
 #endif /* PARSERFACTORY_HH */
@@ -14,11 +14,66 @@
  */
 
 #include "UI.hh"
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 
-#define update_entry(_i, _c) __entry[_i]->set_text(std::to_string(_c))
-#define update_flag(_i, _c)  __flag[_i]->set((_c) ? Gtk::ARROW_RIGHT \
-				      : Gtk::ARROW_NONE, Gtk::SHADOW_OUT)
-void UI::update_page_diagnostic(XR25frame &fra) {
+/* Format into a stack buffer (same format as std::to_string()); called on
+ * every update_page() tick, so it must not allocate.
+ */
+static inline void format_value(char (&b)[UI_ENTRY_TEXT_MAX], int v)
+{ snprintf(b, sizeof(b), "%d", v); }
+static inline void format_value(char (&b)[UI_ENTRY_TEXT_MAX], double v)
+{ snprintf(b, sizeof(b), "%f", v); }
+
+/* initialized before main(); the reference point of startup_mark()
+ */
+static const auto startup_t0 = std::chrono::steady_clock::now();
+static const bool startup_timing = std::getenv("XR25_DIAG_TIMING");
+
+void UI::startup_mark(const char *what) {
+	using namespace std::chrono;
+	static std::mutex m;
+	static steady_clock::time_point last = startup_t0;
+	if (!startup_timing)
+		return;
+	std::lock_guard<std::mutex> lock(m);
+	auto now = steady_clock::now();
+	std::fprintf(stderr, "xr25_diag: %6.1f ms (+%6.1f ms): %s\n",
+		     duration<double, std::milli>(now - startup_t0).count(),
+		     duration<double, std::milli>(now - last).count(), what);
+	last = now;
+}
+
+void UI::startup_mark_on_draw(Gtk::Widget &w, const char *what) {
+	if (!startup_timing)
+		return;
+	auto conn = std::make_shared<sigc::connection>();
+	*conn = w.signal_draw().connect([conn,what]
+					(const Cairo::RefPtr<Cairo::Context> &) {
+			startup_mark(what), conn->disconnect();
+			return false;
+		}, /* after= */ false);
+}
+
+void UI::set_entry_text(int i, const char *text) {
+	if (std::strcmp(__entry_text[i], text) != 0) {
+		std::strcpy(__entry_text[i], text);
+		// the C API avoids a Glib::ustring temporary
+		gtk_entry_set_text(__entry[i]->gobj(), text);
+	}
+}
+
+void UI::set_flag(int i, bool state) {
+	if (__flag_state[i] != state)
+		__flag[i]->set((__flag_state[i] = state) ? Gtk::ARROW_RIGHT
+			       : Gtk::ARROW_NONE, Gtk::SHADOW_OUT);
+}
+
+#define update_entry(_i, _c) ({ char _b[UI_ENTRY_TEXT_MAX];	\
+			format_value(_b, _c), set_entry_text(_i, _b); })
+#define update_flag(_i, _c)  set_flag(_i, (_c) != 0)
+void UI::update_page_diagnostic(XR25frame &fra, sample_t &smp) {
 	update_entry(E_PROGRAM_VRSN,    fra.program_vrsn);
 	update_entry(E_CALIB_VRSN,      fra.calib_vrsn);
 	update_entry(E_MAP,             fra.map);
@@ -88,12 +143,17 @@ void UI::update_page_diagnostic(XR25frame &fra) {
 	update_flag(F_FAULT_INJECTORS,     fra.fault_flags_3 & FAULT_INJECTORS);
 }
 
-void UI::update_page_dashboard(XR25frame &fra)  {
+void UI::update_page_dashboard(XR25frame &fra, sample_t &smp)  {
 	for (auto &i : __gauge)
-		i.update(&fra);
+		i.update(&smp);
 }
 
-void UI::update_page_plots(XR25frame &fra) {
+void UI::update_page_plots(XR25frame &fra, sample_t &smp) {
 	for (auto &i : __plot)
 		i.update();
 }
+
+void UI::update_page_heatmaps(XR25frame &fra, sample_t &smp) {
+	for (auto &i : __heatmap)
+		i.update();
+}
@@ -16,13 +16,27 @@
 #ifndef UI_HH
 #define UI_HH
 
+#include <atomic>
+#include <cstdio>
 #include <mutex>
 #include <vector>
 #include <gtkmm.h>
 #include <pangomm/context.h>
 #include "XR25streamreader.hh"
+#include "XR25channels.hh"
+#include "XR25rules.hh"
+#include "XR25sink.hh"
+#include "XR25alloc.hh"
+#include "XR25history.hh"
+#include "XR25charts.hh"
 #include "CairoGauge.hh"
 #include "CairoTSPlot.hh"
+#include "CairoHeatmap.hh"
+#include "CairoRenderWorker.hh"
+
+/* xr25_diag.glade, embedded by glib-compile-resources; see Makefile
+ */
+#define UI_RESOURCE "/com/github/xr25_diag/xr25_diag.glade"
 
 class UI {
 private:
@@ -31,8 +45,37 @@ private:
 	XR25streamreader               __xr25reader;
 	const XR25frameparser          &__fp;
 
-	XR25frame  __last_recv;
-	std::mutex __last_recv_mutex;
+	XR25channelengine __channels;   // updated in the reader thread
+	XR25ruleset       &__rules;     // "
+
+	/* plot alerts, see XR25alert; the rules file may override the
+	 * default rules, see main.cc
+	 */
+	int __alert_rule[A_COUNT];
+
+	/* what gauges are passed as 'void *'
+	 */
+	struct sample_t {
+		XR25channels ch;
+		bool         alert[A_COUNT];
+	};
+
+	XR25frame    __last_recv;
+	sample_t     __last_sample;
+	std::mutex   __last_recv_mutex;
+	bool         __first_frame;   // reader thread only
+
+#define UI_UPDATE_PAGE_HZ   16
+#define UI_UPDATE_HEADER_HZ 1
+	/* idle mode: with no frame for UI_IDLE_SECS (e.g. ignition off), the
+	 * periodic timers are stopped; the next frame wakes the main loop
+	 * through __wake, see resume()
+	 */
+#define UI_IDLE_SECS        5
+	std::atomic_bool  __idle;
+	Glib::Dispatcher  __wake;
+	sigc::connection  __page_timer, __header_timer;
+	int               __idle_fra_count, __idle_ticks;   // main thread
 
 	Gtk::Label    *__hb_sync_err, *__hb_fra_s;
 	Gtk::Image    *__hb_is_sync;
@@ -101,49 +144,72 @@ private:
 	Gtk::Entry    *__entry[E_COUNT];
 	Gtk::Arrow    *__flag[F_COUNT];
 
-	std::vector<CairoGauge>     __gauge = {
-		{ "RPM", [](void *p) { return static_cast<XR25frame*>(p)->rpm; }
-		  , 7000, 500, 2 },
-		{ "km/h", [](void *p) { return static_cast<XR25frame*>(p)
-					->spd_km_h; }, 240, 10, 2 },
-		{ "Temp (C)", [](void *p) { return static_cast<XR25frame*>(p)
-					    ->temp_water; }, 120, 30, 1 },
-		{ "Battery (V)", [](void *p) { return static_cast<XR25frame*>(p)
-					       ->batt_v; }, 18, 1, 2 },
-		{ "MAP (mbar)", [](void *p) { return static_cast<XR25frame*>(p)
-					      ->map; }, 1020, 255, 1 },
-		{ "Air Temp(C)", [](void *p) { return static_cast<XR25frame*>(p)
-					       ->temp_air; }, 90, 30, 1 },
-		{ "Lambda (mV)", [](void *p) { return static_cast<XR25frame*>(p)
-					       ->lambda_v; }, 1530, 255, 1},
+	/* last text / state set on __entry and __flag; widgets are only
+	 * updated on change, see UI.cc
+	 */
+#define UI_ENTRY_TEXT_MAX 32
+	char          __entry_text[E_COUNT][UI_ENTRY_TEXT_MAX];
+	signed char   __flag_state[F_COUNT];
+	void set_entry_text(int i, const char *text);
+	void set_flag(int i, bool state);
+
+	/* XR25gauges
+	 */
+	std::vector<CairoGauge>     __gauge = make_gauges();
+	static std::vector<CairoGauge> make_gauges() {
+		std::vector<CairoGauge> g;
+		g.reserve(XR25gauge_count);
+		for (size_t i = 0; i < XR25gauge_count; ++i) {
+			const XR25gaugedef &d = XR25gauges[i];
+			const int c = d.ch;
+			g.emplace_back(d.text, [c](void *p) {
+					return static_cast<sample_t *>(p)
+						->ch[c]; },
+				d.max, d.step, d.label_step);
+		}
+		return g;
+	}
+	/* channels plotted (XR25plots), one XR25history column each;
+	 * __history is fed once per frame from frame_recv()
+	 */
+	// twice the points drawn, so a plot being copied is not overtaken
+#define UI_HISTORY_ROWS (2 * NUM_POINTS)
+	XR25history                 __history;
+	static std::vector<int> plot_channels() {
+		std::vector<int> ch;
+		for (size_t i = 0; i < XR25plot_count; ++i)
+			ch.push_back(XR25plots[i].ch);
+		return ch;
+	}
+	/* views of __history, column i for __plot[i]
+	 */
+	std::vector<CairoTSPlot>    __plot = make_plots();
+	static std::vector<CairoTSPlot> make_plots() {
+		std::vector<CairoTSPlot> p;
+		p.reserve(XR25plot_count);
+		for (size_t i = 0; i < XR25plot_count; ++i)
+			p.emplace_back(XR25plots[i].text, XR25plots[i].min,
+				       XR25plots[i].max, XR25plots[i].step);
+		return p;
+	}
+
+	/* mean of a channel per rpm x MAP cell; fed from frame_recv(), see
+	 * __heatmap_src
+	 */
+	std::vector<CairoHeatmap>   __heatmap = {
+		{ "Injection (us)", 7000, 500, 1100, 100, 1000, 12000 },
+		{ "Advance",        7000, 500, 1100, 100, 0,    45 },
+		{ "Lambda (mV)",    7000, 500, 1100, 100, 0,    1020 },
 	};
-	std::vector<CairoTSPlot>    __plot = {
-		{ "RPM", [](void *p, bool &_alert) {
-				return static_cast<XR25frame*>(p)->rpm; }, 0,
-		  6000, 1500 },
-		{ "MAP (mbar)", [](void *p, bool &_alert) {
-				return static_cast<XR25frame*>(p)->map; }, 0,
-		  1020, 255 },
-		{ "Throttle", [](void *p, bool &_alert) {
-				_alert = static_cast<XR25frame*>(p)->in_flags
-				                                & IN_THROTTLE_0;
-				return static_cast<XR25frame*>(p)->throttle; },
-		  0, 100, 20 },
-		{ "Lambda (mV)", [](void *p, bool &_alert) {
-				_alert = ~static_cast<XR25frame*>(p)->out_flags
-				                              & OUT_LAMBDA_LOOP;
-				return static_cast<XR25frame*>(p)->lambda_v; },
-		  0, 1020, 255 },
-		{ "Battery (V)", [](void *p, bool &_alert) {
-				_alert =static_cast<XR25frame*>(p)->batt_v > 15;
-				return static_cast<XR25frame*>(p)->batt_v; }, 8,
-		  16, 2 },
-		{ "Temp (C)", [](void *p, bool &_alert) {
-				return static_cast<XR25frame*>(p)->temp_water; }
-		  , 0, 120, 30 },
+	std::vector<int>            __heatmap_src = {
+		CH_INJECTION_US, CH_ADVANCE, CH_LAMBDA_V,
 	};
+	/* renders __gauge and __plot; declared after them so that it is
+	 * destroyed first
+	 */
+	CairoRenderWorker           __render_worker;
 
-	enum { GRID_DASHBOARD = 0, GRID_PLOTS,
+	enum { GRID_DASHBOARD = 0, GRID_PLOTS, GRID_HEATMAPS,
 	       _GRID_COUNT };
 	std::vector<Gdk::Rectangle> __g_rect[_GRID_COUNT] = {
 		{ // GRID_DASHBOARD
@@ -163,6 +229,11 @@ private:
 			{ 1, 1, 1, 1 }, // Battery (V)
 			{ 1, 2, 1, 1 }, // Temp (C)
 		},
+		{ // GRID_HEATMAPS
+			{ 0, 0, 1, 1 }, // Injection (us)
+			{ 1, 0, 1, 1 }, // Advance
+			{ 2, 0, 1, 1 }, // Lambda (mV)
+		},
 	};
 
 	/** Attach a vector of widgets to a GtkGrid; the left, top, width and
@@ -182,96 +253,254 @@ private:
 		_grid->show_all();
 	}
 	
-	void update_page_diagnostic(XR25frame &);
-	void update_page_dashboard(XR25frame &);
-	void update_page_plots(XR25frame &);
+	bool __grid_attached[_GRID_COUNT];
+
+	/** Attach the Cairo widgets of a notebook page when it is first shown;
+	 * pages never visited are not populated at startup.
+	 * @param page Notebook page number
+	 */
+	void attach_page(guint page) {
+		Gtk::Grid *grid = nullptr;
+		if (page == 1 && !__grid_attached[GRID_PLOTS]) {
+			__builder->get_widget("mw_plot_grid", grid);
+			attach_widgets_to_grid<CairoTSPlot>(grid,
+							 __g_rect[GRID_PLOTS],
+							 __plot);
+			__grid_attached[GRID_PLOTS] = true;
+		} else if (page == 2 && !__grid_attached[GRID_DASHBOARD]) {
+			__builder->get_widget("mw_dash_grid", grid);
+			attach_widgets_to_grid<CairoGauge>(grid,
+						__g_rect[GRID_DASHBOARD],
+						__gauge);
+			__grid_attached[GRID_DASHBOARD] = true;
+		} else if (page == 3 && !__grid_attached[GRID_HEATMAPS]) {
+			__builder->get_widget("mw_heat_grid", grid);
+			attach_widgets_to_grid<CairoHeatmap>(grid,
+						__g_rect[GRID_HEATMAPS],
+						__heatmap);
+			__grid_attached[GRID_HEATMAPS] = true;
+		}
+	}
+
+	/* Sinks registered at runtime; see add_sink()
+	 */
+	XR25dynamicsink __sinks;
+
+	/** Frame received handler; called from the XR25streamreader thread.
+	 * @param fra The parsed frame
+	 */
+	void frame_recv(XR25frame &fra) {
+		auto _ts = std::chrono::steady_clock::now();
+		sample_t smp;
+		if (__first_frame)
+			__first_frame = false, startup_mark("first frame");
+		if (__idle.load(std::memory_order_relaxed)
+		    && __idle.exchange(0))
+			__wake.emit();
+		smp.ch = __channels.update(fra, _ts);
+		__rules.evaluate(smp.ch, _ts);
+		for (int i = 0, r; i < A_COUNT; ++i)
+			smp.alert[i] = (r = __alert_rule[i]) >= 0
+				       && __rules.get_state(r);
+
+		__last_recv_mutex.lock();
+		__last_recv = fra; // copy struct
+		__last_sample = smp;
+		__last_recv_mutex.unlock();
+
+		uint32_t alert = 0;
+		for (size_t i = 0; i < XR25plot_count; ++i)
+			if (XR25plots[i].alert >= 0
+			    && smp.alert[XR25plots[i].alert])
+				alert |= 1u << i;
+		__history.push(_ts, smp.ch, alert);
+		for (size_t i = 0; i < __heatmap.size(); ++i)
+			__heatmap[i].sample(smp.ch[CH_RPM], smp.ch[CH_MAP],
+					    smp.ch[__heatmap_src[i]]);
+	}
+
+	/* Typed XR25streamreader sink; see XR25sink.hh.
+	 */
+	struct frame_sink {
+		UI *__ui;
+		inline void operator()(const unsigned char c[], int l,
+				       XR25frame &fra)
+		{ __ui->frame_recv(fra); }
+	};
+
+	void update_page_diagnostic(XR25frame &, sample_t &);
+	void update_page_dashboard(XR25frame &, sample_t &);
+	void update_page_plots(XR25frame &, sample_t &);
+	void update_page_heatmaps(XR25frame &, sample_t &);
 	/** Update current notebook page, see 'update_page_xxx()' member
 	 * functions; called UI_UPDATE_PAGE_HZ times per sec.
 	 */
 	bool update_page() {
-		sigc::bound_mem_functor1<void, UI, XR25frame&> _fn[] = {
+		sigc::bound_mem_functor2<void, UI, XR25frame&, sample_t&
+					 > _fn[] = {
 			sigc::mem_fun(*this, &UI::update_page_diagnostic),
 			sigc::mem_fun(*this, &UI::update_page_plots),
 			sigc::mem_fun(*this, &UI::update_page_dashboard),
+			sigc::mem_fun(*this, &UI::update_page_heatmaps),
 		};
 
+		XR25_ALLOC_CHECK_SCOPE("update_page");
 		__last_recv_mutex.lock();
 		XR25frame fra = __last_recv;
+		sample_t smp = __last_sample;
 		__last_recv_mutex.unlock();
 
-		_fn[__notebook->get_current_page()](fra);
+		_fn[__notebook->get_current_page()](fra, smp);
 		return TRUE;
 	}
 	
 	/** Update headerbar widgets; called UI_UPDATE_HEADER_HZ times per sec
 	 */
 	bool update_header() {
-		__hb_sync_err->set_text(std::to_string(__xr25reader
-						       .get_sync_err_count()));
-		__hb_fra_s->set_text(std::to_string(__xr25reader
-						    .get_fra_per_sec()));
-		__hb_is_sync->set_from_icon_name(__xr25reader.is_synchronized()
-						 ? "gtk-yes" : "gtk-no",
-						 Gtk::ICON_SIZE_BUTTON);
-		__hb->set_subtitle("Frame count: "
-				+ std::to_string(__xr25reader.get_fra_count()));
+		XR25_ALLOC_CHECK_SCOPE("update_header");
+		char buf[64], tip[256];
+		int n;
+
+		snprintf(buf, sizeof(buf), "%d",
+			 __xr25reader.get_sync_err_count());
+		gtk_label_set_text(__hb_sync_err->gobj(), buf);
+		n = snprintf(tip, sizeof(tip), "Dropped frames");
+		for (int i = 0; i < _DROP_COUNT; ++i) {
+			auto r = static_cast<XR25dropreason>(i);
+			n += snprintf(tip + n, sizeof(tip) - n, "\n%s: %d",
+				      __xr25reader.get_drop_reason_name(r),
+				      __xr25reader.get_drop_count(r));
+		}
+		snprintf(tip + n, sizeof(tip) - n, "\nrecovered headers: %d",
+			 __xr25reader.get_recovered_count());
+		gtk_widget_set_tooltip_text(__hb_sync_err->Gtk::Widget::gobj(),
+					    tip);
+		snprintf(buf, sizeof(buf), "%d",
+			 __xr25reader.get_fra_per_sec());
+		gtk_label_set_text(__hb_fra_s->gobj(), buf);
+		if (__xr25reader.is_jitter_enabled()) {
+			auto &j = __xr25reader.get_jitter();
+			n = snprintf(tip, sizeof(tip), "Frame lateness: "
+				     "p99 %.1f ms, max %.1f ms\n"
+				     "line utilization %.1f%%",
+				     j.quantile_us(.99) / 1000.,
+				     j.count() ? j.max_us() / 1000. : 0.,
+				     100 * j.line_utilization());
+			if (int err = __xr25reader.get_rt_error())
+				snprintf(tip + n, sizeof(tip) - n,
+					 "\nreal-time scheduling: %s",
+					 g_strerror(err));
+			gtk_widget_set_tooltip_text(__hb_fra_s->Gtk::Widget
+						    ::gobj(), tip);
+		}
+		gtk_image_set_from_icon_name(__hb_is_sync->gobj(),
+					     __xr25reader.is_synchronized()
+					     ? "gtk-yes" : "gtk-no",
+					     GTK_ICON_SIZE_BUTTON);
+		const int count = __xr25reader.get_fra_count();
+		__idle_ticks = count == __idle_fra_count ? __idle_ticks + 1 : 0;
+		__idle_fra_count = count;
+		const bool idle = __idle_ticks >= UI_IDLE_SECS
+			* UI_UPDATE_HEADER_HZ;
+		snprintf(buf, sizeof(buf), "Frame count: %d%s", count,
+			 idle ? " (idle)" : "");
+		gtk_header_bar_set_subtitle(__hb->gobj(), buf);
+
+		if (idle) {  // set __idle first: a frame from now on wakes us
+			__idle = 1;
+			__page_timer.disconnect();
+			return FALSE;
+		}
 		return TRUE;
 	}
+
+	/** Leave idle mode (or start): (re)start the periodic timers;
+	 * called on the main thread, see __wake.
+	 */
+	void resume() {
+		__idle_ticks = 0;
+		if (!__page_timer.connected())
+			__page_timer = Glib::signal_timeout().connect
+				(sigc::mem_fun(*this, &UI::update_page),
+				 1000 / UI_UPDATE_PAGE_HZ);
+		if (!__header_timer.connected())
+			__header_timer = Glib::signal_timeout().connect
+				(sigc::mem_fun(*this, &UI::update_header),
+				 1000 / UI_UPDATE_HEADER_HZ);
+	}
 public:
 	UI(Glib::RefPtr<Gtk::Application> _a, Glib::RefPtr<Gtk::Builder> _b,
-	   std::istream &_is, const XR25frameparser &_p)
+	   std::istream &_is, const XR25frameparser &_p, XR25ruleset &_r)
 		: __application(_a), __builder(_b),
-		  __xr25reader(_is, [this](const unsigned char c[], int l,
-					   XR25frame &fra) {
-				       this->__last_recv_mutex.lock();
-				       this->__last_recv = fra; // copy struct
-				       this->__last_recv_mutex.unlock();
-
-				       //call CairoTSPlots::sample() passing fra
-				       auto _ts =
-					       std::chrono::steady_clock::now();
-				       for (auto &i : __plot)
-					       i.sample(&fra, _ts);
-			       }),  __fp(_p), __last_recv() {
+		  __xr25reader(_is), __fp(_p), __rules(_r), __last_recv(),
+		  __last_sample(), __first_frame(true), __idle(0),
+		  __idle_fra_count(0), __idle_ticks(0),
+		  __history(UI_HISTORY_ROWS, plot_channels()),
+		  __grid_attached() {
+		XR25alert_rules(__rules, __alert_rule);
+
 		__builder->get_widget("mw_hb_sync_err", __hb_sync_err);
 		__builder->get_widget("mw_hb_fra_s",    __hb_fra_s);
 		__builder->get_widget("mw_hb_is_sync",  __hb_is_sync);
 		__builder->get_widget("mw_hb",          __hb);
 		__builder->get_widget("mw_notebook",    __notebook);
 		
-		for (int i = 0; i < E_COUNT; i++)
+		for (int i = 0; i < E_COUNT; i++) {
 			__builder->get_widget("mw_e" + std::to_string(i),
 					      __entry[i]);
-		for (int i = 0; i < F_COUNT; i++)
+			__entry_text[i][0] = '\0';
+		}
+		for (int i = 0; i < F_COUNT; i++) {
 			__builder->get_widget("mw_f" + std::to_string(i),
 					      __flag[i]);
+			__flag_state[i] = -1;
+		}
+		for (auto &i : __gauge)
+			i.set_render_worker(&__render_worker);
+		for (size_t i = 0; i < __plot.size(); ++i) {
+			__plot[i].set_render_worker(&__render_worker);
+			__plot[i].set_history(&__history, i);
+		}
 	}
 	~UI() { }
+
+	/** Report the time elapsed since process start to stderr if the
+	 * XR25_DIAG_TIMING environment variable is set; thread-safe.
+	 * @param what Event description
+	 */
+	static void startup_mark(const char *what);
+	/** Call startup_mark() when @a w is first drawn
+	 */
+	static void startup_mark_on_draw(Gtk::Widget &w, const char *what);
+
+	/** Add a frame consumer not known at compile time; must be called
+	 * before run().
+	 */
+	void add_sink(XR25dynamicsink::sink_fn_t fn) { __sinks.add(fn); }
+	/** @return The reader, e.g. to call set_rt() or enable_jitter()
+	 *     before run()
+	 */
+	XR25streamreader &get_reader() { return __xr25reader; }
 	
-#define UI_UPDATE_PAGE_HZ   16
-#define UI_UPDATE_HEADER_HZ 1
 	void run() {
-		Gtk::Grid *dash_grid, *plot_grid;
-		__builder->get_widget("mw_dash_grid", dash_grid);
-		__builder->get_widget("mw_plot_grid", plot_grid);
-		attach_widgets_to_grid<CairoGauge>(dash_grid,
-						__g_rect[GRID_DASHBOARD],
-						__gauge);
-		attach_widgets_to_grid<CairoTSPlot>(plot_grid,
-						 __g_rect[GRID_PLOTS],
-						 __plot);
+		attach_page(__notebook->get_current_page());
+		__notebook->signal_switch_page().connect([this](Gtk::Widget *,
+								guint page) {
+				attach_page(page);
+			});
 
 		/* connect signals */
-		Glib::signal_timeout().connect(sigc::mem_fun(*this,
-							     &UI::update_page)
-					       , 1000 / UI_UPDATE_PAGE_HZ);
-		Glib::signal_timeout().connect(sigc::mem_fun(*this,
-							     &UI::update_header)
-					       , 1000 / UI_UPDATE_HEADER_HZ);
+		__wake.connect(sigc::mem_fun(*this, &UI::resume));
+		resume();
 		Gtk::Button *about_button = nullptr;
 		__builder->get_widget("mw_about_button", about_button);
 		about_button->signal_clicked().connect([this]() {
 					Gtk::AboutDialog *ad = nullptr;
+					if (!__builder->get_object
+					    ("about_dialog"))
+						__builder->add_from_resource
+							(UI_RESOURCE,
+							 "about_dialog");
 					__builder->get_widget("about_dialog",
 							      ad);
 					ad->set_version(XR25DIAG_VERSION);
@@ -287,12 +516,17 @@ public:
 					i.set_transform_matrix(m);
 				for (auto &i : __plot)
 					i.set_transform_matrix(m);
+				for (auto &i : __heatmap)
+					i.set_transform_matrix(m);
 			});
 		
-		__xr25reader.start(const_cast<XR25frameparser &>(__fp));
+		__xr25reader.start(const_cast<XR25frameparser &>(__fp),
+				   make_sinkchain(frame_sink{ this },
+						  std::ref(__sinks)));
 		
 		Gtk::Window *main_window  = nullptr;
 		__builder->get_widget("main_window",     main_window);
+		startup_mark_on_draw(*main_window, "main window drawn");
 		__application->run(*main_window);
 	}
 };
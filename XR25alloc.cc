@@ -0,0 +1,61 @@
+/* XR25alloc.cc - Steady-state allocation checks (make ALLOC_CHECK=1)
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25alloc.hh"
+
+#ifdef XR25_ALLOC_CHECK
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static thread_local unsigned long alloc_count = 0;
+
+unsigned long xr25_alloc_count() { return alloc_count; }
+
+xr25_alloc_scope::~xr25_alloc_scope() {
+	unsigned long n = xr25_alloc_count() - __count;
+	if (__steady && n) {
+		std::fprintf(stderr, "xr25_diag: %s: %lu allocation(s) in "
+			     "steady state\n", __name, n);
+		std::abort();
+	}
+}
+
+// replace the global allocation functions to count calls per thread
+void *operator new(std::size_t n) {
+	alloc_count++;
+	if (void *p = std::malloc(n ? n : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t n) { return ::operator new(n); }
+
+void *operator new(std::size_t n, const std::nothrow_t &) noexcept {
+	alloc_count++;
+	return std::malloc(n ? n : 1);
+}
+
+void *operator new[](std::size_t n, const std::nothrow_t &t) noexcept {
+	return ::operator new(n, t);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{ std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{ std::free(p); }
+#endif /* XR25_ALLOC_CHECK */
@@ -0,0 +1,55 @@
+/* XR25alloc.hh - Steady-state allocation checks (make ALLOC_CHECK=1)
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25ALLOC_HH
+#define XR25ALLOC_HH
+
+/* Number of executions of a checked scope considered warm-up; allocations
+ * are allowed until then (e.g. gtkmm creating wrapper objects).
+ */
+#define XR25_ALLOC_WARMUP 256
+
+#ifdef XR25_ALLOC_CHECK
+/** @return Number of calls to operator new made by the calling thread
+ */
+unsigned long xr25_alloc_count();
+
+class xr25_alloc_scope {
+private:
+	const char    *__name;
+	bool          __steady;
+	unsigned long __count;
+public:
+	xr25_alloc_scope(const char *name, bool steady)
+		: __name(name), __steady(steady),
+		  __count(xr25_alloc_count()) { }
+	~xr25_alloc_scope();   // abort()s if the scope allocated
+};
+
+/** Abort if the rest of the enclosing block allocates once it has been
+ * executed more than XR25_ALLOC_WARMUP times by the calling thread.  Only C++
+ * allocations (operator new) are counted; those made by C libraries (GTK,
+ * cairo) are not.  The count, like that of allocations, is per thread: tools
+ * run a reader per worker thread.
+ */
+#define XR25_ALLOC_CHECK_SCOPE(_name)					\
+	static thread_local unsigned long __alloc_calls = 0;		\
+	xr25_alloc_scope __alloc_scope(_name,				\
+				       __alloc_calls++ >= XR25_ALLOC_WARMUP)
+#else
+#define XR25_ALLOC_CHECK_SCOPE(_name)
+#endif /* XR25_ALLOC_CHECK */
+
+#endif /* XR25ALLOC_HH */
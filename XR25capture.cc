@@ -0,0 +1,248 @@
+/* XR25capture.cc - Asynchronous, rotating capture writer
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25capture.hh"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+
+XR25capturewriter::XR25capturewriter(const std::string &pathname,
+				     size_t rotate_bytes, unsigned rotate_secs,
+				     bool compress)
+	: __pathname(pathname), __rotate_bytes(rotate_bytes),
+	  __rotate_secs(rotate_secs), __compress(compress),
+	  __ring(new char[XR25CAPTURE_RING_SIZE]), __head(0), __tail(0),
+	  __overrun(0), __fd(-1), __seg_num(0), __seg_bytes(0),
+	  __seg_alloc(0), __z(), __error(0), __stop(false) {}
+
+bool XR25capturewriter::start() {
+	if (!open_segment())
+		return false;
+	__stop = false;
+	__thrd = std::thread(&XR25capturewriter::run, this);
+	return true;
+}
+
+void XR25capturewriter::stop() {
+	if (!__thrd.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(__stop_m);
+		__stop = true;
+	}
+	__stop_cv.notify_one();
+	__thrd.join();
+}
+
+bool XR25capturewriter::open_segment() {
+	char suffix[16] = "";
+	if (__rotate_bytes || __rotate_secs)
+		snprintf(suffix, sizeof(suffix), ".%03u", __seg_num);
+	std::string name = __pathname + suffix + (__compress ? ".gz" : "");
+
+	__fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		    0644);
+	if (__fd == -1)
+		return __error = errno, false;
+	__seg_bytes = 0;
+	__seg_alloc = 0;
+	__seg_start = std::chrono::steady_clock::now();
+	if (__compress) {
+		__z = z_stream();
+		// windowBits 15 + 16: gzip wrapper; level 1: fastest
+		if (deflateInit2(&__z, 1, Z_DEFLATED, 15 + 16, 8,
+				 Z_DEFAULT_STRATEGY) != Z_OK) {
+			close(__fd), __fd = -1;
+			return __error = errno = ENOMEM, false;
+		}
+	}
+	return true;
+}
+
+void XR25capturewriter::close_segment() {
+	if (__fd == -1)
+		return;
+	if (__compress) {
+		char out[4096];
+		int ret;
+		__z.next_in = nullptr, __z.avail_in = 0;
+		do {
+			__z.next_out = reinterpret_cast<Bytef *>(out);
+			__z.avail_out = sizeof(out);
+			ret = deflate(&__z, Z_FINISH);
+			write_fd(out, sizeof(out) - __z.avail_out);
+		} while (ret == Z_OK);
+		deflateEnd(&__z);
+	}
+	// FALLOC_FL_KEEP_SIZE leaves the file size alone; release the blocks
+	// preallocated beyond it
+	ftruncate(__fd, __seg_bytes);
+	close(__fd), __fd = -1;
+	__seg_num++;
+}
+
+/** Write to the current file, preallocating XR25CAPTURE_PREALLOC-sized
+ * chunks (or the whole file, if rotating by size) ahead of the data.
+ */
+void XR25capturewriter::write_fd(const char *p, size_t n) {
+	if (__seg_bytes + n > __seg_alloc) {
+		size_t len = std::max<size_t>(__rotate_bytes,
+					      XR25CAPTURE_PREALLOC);
+		while (__seg_alloc < __seg_bytes + n)
+			__seg_alloc += len;
+		fallocate(__fd, FALLOC_FL_KEEP_SIZE, 0, __seg_alloc);
+	}
+	while (n) {
+		ssize_t ret = ::write(__fd, p, n);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1) {
+			__error = errno;
+			return;
+		}
+		p += ret, n -= ret, __seg_bytes += ret;
+	}
+}
+
+void XR25capturewriter::write_segment(const char *p, size_t n) {
+	if (!__compress)
+		return write_fd(p, n);
+
+	char out[4096];
+	__z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(p));
+	__z.avail_in = n;
+	do {
+		__z.next_out = reinterpret_cast<Bytef *>(out);
+		__z.avail_out = sizeof(out);
+		deflate(&__z, Z_NO_FLUSH);
+		write_fd(out, sizeof(out) - __z.avail_out);
+	} while (__z.avail_in);
+}
+
+/** Move the contents of the ring buffer to the current file; rotate files
+ * as configured.
+ */
+void XR25capturewriter::drain() {
+	size_t t = __tail.load(std::memory_order_relaxed),
+		h = __head.load(std::memory_order_acquire);
+	while (t != h && __fd != -1) {
+		size_t o = t % XR25CAPTURE_RING_SIZE,
+			n = std::min(h - t, XR25CAPTURE_RING_SIZE - o);
+		// split uncompressed files exactly at the size limit
+		if (__rotate_bytes && !__compress)
+			n = std::min(n, __rotate_bytes - __seg_bytes);
+		write_segment(&__ring[o], n);
+		__tail.store(t += n, std::memory_order_release);
+
+		if (__rotate_bytes && __seg_bytes >= __rotate_bytes)
+			close_segment(), open_segment();
+	}
+
+	if (__compress && __fd != -1) {
+		char out[4096];
+		do {
+			__z.next_out = reinterpret_cast<Bytef *>(out);
+			__z.avail_out = sizeof(out);
+			deflate(&__z, Z_SYNC_FLUSH);
+			write_fd(out, sizeof(out) - __z.avail_out);
+		} while (__z.avail_out == 0);
+	}
+	if (__rotate_secs && __fd != -1 && std::chrono::steady_clock::now()
+	    - __seg_start >= std::chrono::seconds(__rotate_secs))
+		close_segment(), open_segment();
+}
+
+void XR25capturewriter::run() {
+	std::unique_lock<std::mutex> lock(__stop_m);
+	while (!__stop_cv.wait_for(lock, std::chrono::milliseconds
+				   (XR25CAPTURE_FLUSH_MS),
+				   [this]() { return __stop; })) {
+		lock.unlock();
+		drain();
+		lock.lock();
+	}
+	lock.unlock();
+	drain();
+	close_segment();
+}
+
+bool XR25capturewriter::parse_rotate(const std::string &spec, size_t &bytes,
+				     unsigned &secs) {
+	static const struct {
+		const char    *suffix;
+		unsigned long mul;
+		bool          is_time;
+	} unit[] = {
+		{ "",    1,          false },
+		{ "K",   1UL << 10,  false },
+		{ "M",   1UL << 20,  false },
+		{ "G",   1UL << 30,  false },
+		{ "s",   1,          true },
+		{ "min", 60,         true },
+		{ "h",   3600,       true },
+	};
+	bytes = 0, secs = 0;
+	for (const char *p = spec.c_str(); *p; ) {
+		char *end;
+		unsigned long v = std::strtoul(p, &end, 10);
+		size_t l = std::strcspn(end, ",");
+		if (end == p)
+			return false;
+		auto i = std::begin(unit);
+		while (i != std::end(unit) && (std::strlen(i->suffix) != l
+			|| std::strncmp(end, i->suffix, l) != 0))
+			++i;
+		if (i == std::end(unit))
+			return false;
+		if (i->is_time)
+			secs = v * i->mul;
+		else
+			bytes = v * i->mul;
+		p = end + l + (end[l] == ',');
+	}
+	return true;
+}
+
+bool XR25capturebuf::open(const std::string &pathname) {
+	close();
+	int fd = ::open(pathname.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	// reads uncompressed files as is
+	if (!(__gz = gzdopen(fd, "rb")))
+		return ::close(fd), errno = ENOMEM, false;
+	gzbuffer(__gz, XR25CAPTURE_READ_BUF);
+	setg(__buf.get(), __buf.get(), __buf.get());
+	return true;
+}
+
+void XR25capturebuf::close() {
+	if (__gz)
+		gzclose(__gz), __gz = nullptr;
+}
+
+XR25capturebuf::int_type XR25capturebuf::underflow() {
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+	int n = __gz ? gzread(__gz, __buf.get(), XR25CAPTURE_READ_BUF) : 0;
+	if (n <= 0)
+		return traits_type::eof();
+	setg(__buf.get(), __buf.get(), __buf.get() + n);
+	return traits_type::to_int_type(*gptr());
+}
@@ -0,0 +1,211 @@
+/* XR25capture.hh - Asynchronous, rotating capture writer
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25CAPTURE_HH
+#define XR25CAPTURE_HH
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <zlib.h>
+#include "ParserFactory.hh"
+
+#define XR25CAPTURE_RING_SIZE   (1 << 20)   // ~160 s of data at 62500 bd
+#define XR25CAPTURE_FLUSH_MS    250         // writer thread period
+#define XR25CAPTURE_PREALLOC    (1 << 20)   // fallocate() granularity
+#define XR25CAPTURE_READ_BUF    (1 << 16)
+
+/** Writes the raw bytes received from the ECU to disk.  write() is called
+ * from the reader thread and only copies into a ring buffer; a thread of its
+ * own drains the ring to the current file, so disk stalls never delay serial
+ * reception.  If the ring fills up, bytes are dropped and counted, see
+ * get_overrun_bytes().
+ *
+ * Files are preallocated with fallocate() and optionally gzip-compressed
+ * (one gzip stream per file, sync-flushed every XR25CAPTURE_FLUSH_MS, so an
+ * interrupted capture is readable up to the last flush).  If rotation is
+ * enabled, a new file is started once the current one reaches a size or an
+ * age; files are then named <pathname>.000, <pathname>.001, ... (plus '.gz'
+ * if compressed).
+ */
+class XR25capturewriter {
+private:
+	std::string  __pathname;
+	size_t       __rotate_bytes;
+	unsigned     __rotate_secs;
+	bool         __compress;
+
+	std::unique_ptr<char[]> __ring;
+	std::atomic<size_t>     __head;    // written by write()
+	std::atomic<size_t>     __tail;    // written by the writer thread
+	std::atomic<size_t>     __overrun;
+
+	/* writer thread state */
+	int          __fd;
+	unsigned     __seg_num;
+	size_t       __seg_bytes, __seg_alloc;
+	std::chrono::steady_clock::time_point __seg_start;
+	z_stream     __z;
+	std::atomic<int> __error;
+
+	std::thread             __thrd;
+	std::mutex              __stop_m;
+	std::condition_variable __stop_cv;
+	bool                    __stop;
+
+	bool open_segment();
+	void close_segment();
+	void write_fd(const char *p, size_t n);
+	void write_segment(const char *p, size_t n);
+	void drain();
+	void run();
+public:
+	/**
+	 * @param pathname Output file name; see above for rotated files
+	 * @param rotate_bytes Start a new file after this many bytes; 0 to
+	 *     disable
+	 * @param rotate_secs Start a new file after this many seconds; 0 to
+	 *     disable
+	 * @param compress Write gzip-compressed files
+	 */
+	XR25capturewriter(const std::string &pathname, size_t rotate_bytes = 0,
+			  unsigned rotate_secs = 0, bool compress = false);
+	~XR25capturewriter() { stop(); }
+
+	/** Open the first file and start the writer thread.
+	 * @return false if the file could not be created; errno is set
+	 */
+	bool start();
+
+	/** Write the buffered data, close the current file and join the
+	 * writer thread.
+	 */
+	void stop();
+
+	/** Queue @a n bytes for writing; never blocks nor allocates.  Must be
+	 * called from a single thread.
+	 */
+	void write(const void *p, size_t n) {
+		size_t h = __head.load(std::memory_order_relaxed),
+			t = __tail.load(std::memory_order_acquire);
+		if (n > XR25CAPTURE_RING_SIZE - (h - t)) {
+			__overrun.fetch_add(n, std::memory_order_relaxed);
+			return;
+		}
+		size_t o = h % XR25CAPTURE_RING_SIZE,
+			l = std::min(n, XR25CAPTURE_RING_SIZE - o);
+		std::memcpy(&__ring[o], p, l);
+		std::memcpy(&__ring[0], static_cast<const char *>(p) + l,
+			    n - l);
+		__head.store(h + n, std::memory_order_release);
+	}
+
+	/** @return Bytes dropped because the ring buffer was full
+	 */
+	size_t get_overrun_bytes() const { return __overrun.load(); }
+	/** @return errno value of the last failed write/open, or 0
+	 */
+	int get_error() const { return __error.load(); }
+
+	/** Parse a rotation specification: a comma-separated list of sizes
+	 * (<n>[K|M|G]) and durations (<n>s, <n>min or <n>h), e.g. "64M,1h".
+	 * @return false if @a spec is malformed
+	 */
+	static bool parse_rotate(const std::string &spec, size_t &bytes,
+				 unsigned &secs);
+};
+
+/** Input stream buffer over a capture file, either plain or gzip-compressed
+ * (see XR25capturewriter); use as
+ *     XR25capturebuf b;
+ *     if (b.open(path)) { std::istream is(&b); ... }
+ * Files are read sequentially in XR25CAPTURE_READ_BUF-sized chunks.
+ */
+class XR25capturebuf : public std::streambuf {
+private:
+	gzFile __gz;
+	std::unique_ptr<char[]> __buf;
+protected:
+	int_type underflow();
+public:
+	XR25capturebuf() : __gz(nullptr),
+			   __buf(new char[XR25CAPTURE_READ_BUF]) { }
+	~XR25capturebuf() { close(); }
+
+	/** @return false if @a pathname could not be opened; errno is set
+	 */
+	bool open(const std::string &pathname);
+	bool is_open() const { return __gz != nullptr; }
+	void close();
+};
+
+/* Counts of a capture decoded by XR25capture_decode() */
+struct XR25capturestats {
+	unsigned long frames;
+	unsigned long dropped;    // see XR25streamreader::get_sync_err_count()
+	double        seconds;    // time of the last frame
+};
+
+/** Decode the capture read from @a in.  Captures carry no timestamps: a
+ * frame is stamped with the time taken on the line by the octets received
+ * up to its end, at XR25_BYTES_PER_SEC.
+ * @param parser_t A type registered in ParserFactory
+ * @param sink Called as sink(double t, XR25frame &fra) for every frame, with
+ *     @a t in seconds since the start of @a in
+ */
+template <class _Sink>
+XR25capturestats XR25capture_decode(std::istream &in,
+				    const std::string &parser_t, _Sink sink) {
+	auto parser = ParserFactory::create(parser_t);
+	XR25streamreader reader(in);
+	double t = 0;
+	reader.run(*parser, [&](const unsigned char c[], int length,
+				XR25frame &fra) {
+		t += static_cast<double>(length) / XR25_BYTES_PER_SEC;
+		sink(t, fra);
+	});
+	XR25capturestats stats = { static_cast<unsigned long>
+				   (reader.get_fra_count()),
+				   static_cast<unsigned long>
+				   (reader.get_sync_err_count()), t };
+	return stats;
+}
+
+/** Decode the capture file @a pathname, plain or gzip-compressed; see
+ * XR25capture_decode(in, parser_t, sink).
+ * @return false if @a pathname could not be opened; errno is set
+ */
+template <class _Sink>
+bool XR25capture_decode(const std::string &pathname,
+			const std::string &parser_t, _Sink sink,
+			XR25capturestats &stats) {
+	XR25capturebuf buf;
+	if (!buf.open(pathname))
+		return false;
+	std::istream in(&buf);
+	stats = XR25capture_decode(in, parser_t, sink);
+	return true;
+}
+
+#endif /* XR25CAPTURE_HH */
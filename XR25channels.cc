@@ -0,0 +1,184 @@
+/* XR25channels.cc - Per-frame derived channels and rolling statistics
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25channels.hh"
+#include <cmath>
+#include <cstring>
+
+const char *const XR25channel_name[CH_COUNT] = {
+	"program_vrsn", "calib_vrsn", "in_flags", "out_flags", "map",
+	"rpm", "throttle", "fault_flags_1", "eng_pinging", "injection_us",
+	"advance", "fault_flags_0", "fault_fugitive", "fault_flags_2",
+	"fault_flags_4", "fault_flags_3", "temp_water", "temp_air", "batt_v",
+	"lambda_v", "idle_regulation", "idle_period", "eng_pinging_delay",
+	"atmos_pressure", "afr_correction", "spd_km_h",
+	"inj_duty", "load", "speed_ratio", "gear",
+};
+
+int XR25channel_lookup(const std::string &name) {
+	for (int i = 0; i < CH_COUNT; ++i)
+		if (name == XR25channel_name[i])
+			return i;
+	return -1;
+}
+
+XR25rollingwindow::XR25rollingwindow(double span, double tau,
+				     unsigned capacity)
+	: __cap(capacity ? capacity
+		: static_cast<unsigned>(std::ceil(span * XR25_MAX_FRA_PER_SEC))
+		  + 1),
+	  __span(span), __tau(tau ? tau : span) {
+	__s.reset(new sample[__cap]);
+	__minq.reset(new unsigned long long[__cap]);
+	__maxq.reset(new unsigned long long[__cap]);
+	clear();
+}
+
+void XR25rollingwindow::clear() {
+	__head = __tail = __minq_h = __minq_t = __maxq_h = __maxq_t = 0;
+	__mean = __m2 = __ewma = 0, __last_t = NAN;
+}
+
+/* The min (max) queue holds the sequence numbers of samples in increasing
+ * (decreasing) value order; the front is the current minimum (maximum).
+ */
+#define __ring(_b, _i) (_b[(_i) % __cap])
+void XR25rollingwindow::pop_front() {
+	const double x = __ring(__s, __head)._v;
+	if (__minq_h != __minq_t && __ring(__minq, __minq_h) == __head)
+		__minq_h++;
+	if (__maxq_h != __maxq_t && __ring(__maxq, __maxq_h) == __head)
+		__maxq_h++;
+	__head++;
+
+	// remove 'x' from the running mean / sum of squares (Welford)
+	if (const unsigned n = count()) {
+		double d = x - __mean;
+		__mean -= d / n;
+		__m2 = std::max(0.0, __m2 - d * (x - __mean));
+	} else
+		__mean = __m2 = 0;
+}
+
+void XR25rollingwindow::push(double t, double v) {
+	while (count() && (count() == __cap
+			   || __ring(__s, __head)._t <= t - __span))
+		pop_front();
+
+	while (__minq_h != __minq_t
+	       && __ring(__s, __ring(__minq, __minq_t - 1))._v >= v)
+		__minq_t--;
+	__ring(__minq, __minq_t++) = __tail;
+	while (__maxq_h != __maxq_t
+	       && __ring(__s, __ring(__maxq, __maxq_t - 1))._v <= v)
+		__maxq_t--;
+	__ring(__maxq, __maxq_t++) = __tail;
+	__ring(__s, __tail++) = { t, v };
+
+	double d = v - __mean;
+	__mean += d / count();
+	__m2 += d * (v - __mean);
+
+	__ewma = std::isnan(__last_t) ? v : __ewma + (v - __ewma)
+		* (1 - std::exp((__last_t - t) / __tau));
+	__last_t = t;
+}
+
+double XR25rollingwindow::min() const {
+	return count() ? __ring(__s, __ring(__minq, __minq_h))._v : NAN;
+}
+
+double XR25rollingwindow::max() const {
+	return count() ? __ring(__s, __ring(__maxq, __maxq_h))._v : NAN;
+}
+#undef __ring
+
+double XR25rollingwindow::stddev() const {
+	return count() > 1 ? std::sqrt(__m2 / (count() - 1)) : 0;
+}
+
+XR25channelengine::XR25channelengine() : __ch(), __t0(clock::now()) {
+	// typical Renault JB-series gearbox; override with set_gear_ratios()
+	__gear_ratio = { 7.4, 13.0, 19.1, 25.8, 32.3 };
+}
+
+void XR25channelengine::compute(const XR25frame &fra, XR25channels &ch) {
+	ch[CH_PROGRAM_VRSN]   = fra.program_vrsn;
+	ch[CH_CALIB_VRSN]     = fra.calib_vrsn;
+	ch[CH_IN_FLAGS]       = fra.in_flags;
+	ch[CH_OUT_FLAGS]      = fra.out_flags;
+	ch[CH_MAP]            = fra.map;
+	ch[CH_RPM]            = fra.rpm;
+	ch[CH_THROTTLE]       = fra.throttle;
+	ch[CH_FAULT_FLAGS_1]  = fra.fault_flags_1;
+	ch[CH_ENG_PINGING]    = fra.eng_pinging;
+	ch[CH_INJECTION_US]   = fra.injection_us;
+	ch[CH_ADVANCE]        = fra.advance;
+	ch[CH_FAULT_FLAGS_0]  = fra.fault_flags_0;
+	ch[CH_FAULT_FUGITIVE] = fra.fault_fugitive;
+	ch[CH_FAULT_FLAGS_2]  = fra.fault_flags_2;
+	ch[CH_FAULT_FLAGS_4]  = fra.fault_flags_4;
+	ch[CH_FAULT_FLAGS_3]  = fra.fault_flags_3;
+	ch[CH_TEMP_WATER]     = fra.temp_water;
+	ch[CH_TEMP_AIR]       = fra.temp_air;
+	ch[CH_BATT_V]         = fra.batt_v;
+	ch[CH_LAMBDA_V]       = fra.lambda_v;
+	ch[CH_IDLE_REGULATION] = fra.idle_regulation;
+	ch[CH_IDLE_PERIOD]    = fra.idle_period;
+	ch[CH_ENG_PINGING_DELAY] = fra.eng_pinging_delay;
+	ch[CH_ATMOS_PRESSURE] = fra.atmos_pressure;
+	ch[CH_AFR_CORRECTION] = fra.afr_correction;
+	ch[CH_SPD_KM_H]       = fra.spd_km_h;
+
+	// one injection per engine cycle, i.e. two revolutions: 120e6 us/rpm
+	ch[CH_INJ_DUTY]       = static_cast<double>(fra.injection_us)
+		* fra.rpm / 1.2e6;
+	ch[CH_LOAD]           = 100.0 * fra.map / (fra.atmos_pressure
+						   ? fra.atmos_pressure : 1013);
+	ch[CH_SPEED_RATIO]    = fra.rpm ? 1000.0 * fra.spd_km_h / fra.rpm : 0;
+	ch[CH_GEAR]           = 0;
+}
+
+int XR25channelengine::add_window(int ch, double span, double tau,
+				  unsigned capacity) {
+	__win.push_back({ ch, XR25rollingwindow(span, tau, capacity) });
+	return __win.size() - 1;
+}
+
+const XR25channels &XR25channelengine::update(const XR25frame &fra,
+					      clock::time_point tp) {
+	compute(fra, __ch);
+
+	// nearest gear ratio within 12%; skip idle / rolling without drive
+	if (fra.rpm > 900 && fra.spd_km_h > 5) {
+		double best = 0.12;
+		for (size_t i = 0; i < __gear_ratio.size(); ++i) {
+			double e = std::fabs(__ch[CH_SPEED_RATIO]
+					     / __gear_ratio[i] - 1);
+			if (e < best)
+				best = e, __ch[CH_GEAR] = i + 1;
+		}
+	}
+
+	const double t = std::chrono::duration<double>(tp - __t0).count();
+	for (auto &i : __win)
+		i._w.push(t, __ch[i._ch]);
+	return __ch;
+}
+
+XR25windowstats XR25channelengine::get_stats(int i) const {
+	const XR25rollingwindow &w = __win[i]._w;
+	return { w.count(), w.min(), w.max(), w.mean(), w.stddev(), w.ewma() };
+}
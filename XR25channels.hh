@@ -0,0 +1,210 @@
+/* XR25channels.hh - Per-frame derived channels and rolling statistics
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25CHANNELS_HH
+#define XR25CHANNELS_HH
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "XR25streamreader.hh"
+
+/* Upper bound of frames per second; 62500 baud carry 6250 octets/s and no
+ * known ECU sends frames shorter than 25 octets.
+ */
+#define XR25_MAX_FRA_PER_SEC 256
+
+/* Channels computed for every frame; entries before _CH_FRAME_COUNT map 1:1
+ * to the fields of 'struct XR25frame', the rest are derived from them.
+ */
+enum XR25channel {
+	CH_PROGRAM_VRSN = 0,
+	CH_CALIB_VRSN,
+	CH_IN_FLAGS,
+	CH_OUT_FLAGS,
+	CH_MAP,
+	CH_RPM,               /* 5  */
+	CH_THROTTLE,
+	CH_FAULT_FLAGS_1,
+	CH_ENG_PINGING,
+	CH_INJECTION_US,
+	CH_ADVANCE,           /* 10 */
+	CH_FAULT_FLAGS_0,
+	CH_FAULT_FUGITIVE,
+	CH_FAULT_FLAGS_2,
+	CH_FAULT_FLAGS_4,
+	CH_FAULT_FLAGS_3,     /* 15 */
+	CH_TEMP_WATER,
+	CH_TEMP_AIR,
+	CH_BATT_V,
+	CH_LAMBDA_V,
+	CH_IDLE_REGULATION,   /* 20 */
+	CH_IDLE_PERIOD,
+	CH_ENG_PINGING_DELAY,
+	CH_ATMOS_PRESSURE,
+	CH_AFR_CORRECTION,
+	CH_SPD_KM_H,          /* 25 */
+	_CH_FRAME_COUNT,
+	CH_INJ_DUTY = _CH_FRAME_COUNT, /* injector duty cycle (%) */
+	CH_LOAD,              /* estimated load, MAP / atmos. pressure (%) */
+	CH_SPEED_RATIO,       /* km/h per 1000 rpm */
+	CH_GEAR,              /* estimated gear; 0 if unknown or declutched */
+	CH_COUNT,             // add new elements before this line
+};
+
+/** Channel names, as used in configuration files (e.g. "batt_v").
+ */
+extern const char *const XR25channel_name[CH_COUNT];
+
+/** Look up a channel by name.
+ * @return The XR25channel, or -1 if @a name is not a channel
+ */
+int XR25channel_lookup(const std::string &name);
+
+struct XR25channels {
+	double v[CH_COUNT];
+
+	double &operator[](int i) { return v[i]; }
+	double operator[](int i) const { return v[i]; }
+};
+
+/* Operating-point bands, as binned by tools/xr25_fleet and
+ * tools/xr25_compare; the last band of each is open-ended.
+ */
+#define XR25_RPM_BAND  500   // rpm
+#define XR25_RPM_BANDS 14
+#define XR25_MAP_BAND  100   // mbar
+#define XR25_MAP_BANDS 11
+
+/** @return The band of width @a width that holds @a v, clamped to [0, @a n)
+ */
+inline int XR25band(double v, double width, int n) {
+	int i = static_cast<int>(v / width);
+	return i < 0 ? 0 : i >= n ? n - 1 : i;
+}
+inline int XR25rpm_band(const XR25channels &ch) {
+	return XR25band(ch[CH_RPM], XR25_RPM_BAND, XR25_RPM_BANDS); }
+inline int XR25map_band(const XR25channels &ch) {
+	return XR25band(ch[CH_MAP], XR25_MAP_BAND, XR25_MAP_BANDS); }
+
+/** Time-based sliding window over a single channel. push() and all the
+ * getters are O(1) (amortized for min/max); no memory is allocated after
+ * construction.
+ */
+class XR25rollingwindow {
+private:
+	struct sample { double _t, _v; };
+
+	std::unique_ptr<sample[]>             __s;
+	std::unique_ptr<unsigned long long[]> __minq, __maxq;
+	unsigned           __cap;
+	unsigned long long __head, __tail,    // samples in [__head, __tail)
+		__minq_h, __minq_t, __maxq_h, __maxq_t;
+	double __span, __tau, __mean, __m2, __ewma, __last_t;
+
+	void pop_front();
+public:
+	/** Construct a XR25rollingwindow object
+	 * @param span Window length in seconds
+	 * @param tau EWMA time constant in seconds; 0 uses @a span
+	 * @param capacity Maximum number of samples kept; 0 sizes the window
+	 *     for XR25_MAX_FRA_PER_SEC
+	 */
+	XR25rollingwindow(double span, double tau = 0, unsigned capacity = 0);
+	XR25rollingwindow(XR25rollingwindow &&) = default;
+
+	/** Add a sample; samples older than the window span are discarded.
+	 * @param t Timestamp in seconds; must not decrease between calls
+	 * @param v Sample value
+	 */
+	void push(double t, double v);
+	void clear();
+
+	unsigned count()  const { return __tail - __head; }
+	double   span()   const { return __span; }
+	double   min()    const;
+	double   max()    const;
+	double   mean()   const { return __mean; }
+	double   stddev() const;
+	double   ewma()   const { return __ewma; }
+};
+
+/** Copy of the statistics of a XR25rollingwindow; see
+ * XR25channelengine::get_stats().
+ */
+struct XR25windowstats {
+	unsigned count;
+	double   min, max, mean, stddev, ewma;
+};
+
+/** Computes derived channels and updates the rolling windows once per frame,
+ * so that consumers (gauges, plots, alerts) need not scan sample history.
+ * Not thread-safe; callers serialize update() and the getters.
+ */
+class XR25channelengine {
+public:
+	typedef std::chrono::steady_clock clock;
+private:
+	struct window_t {
+		int               _ch;
+		XR25rollingwindow _w;
+	};
+
+	XR25channels          __ch;
+	std::vector<window_t> __win;
+	std::vector<double>   __gear_ratio;
+	clock::time_point     __t0;
+public:
+	XR25channelengine();
+
+	/** Compute the channels of @a fra; CH_GEAR is left as 0.
+	 */
+	static void compute(const XR25frame &fra, XR25channels &ch);
+
+	/** Set the gearbox ratios used to estimate CH_GEAR.
+	 * @param r Speed in km/h per 1000 rpm of each gear, first gear first
+	 */
+	void set_gear_ratios(const std::vector<double> &r) { __gear_ratio = r; }
+
+	/** Add a rolling window over channel @a ch; see XR25rollingwindow.
+	 * @return An index to be passed to get_window() / get_stats()
+	 */
+	int add_window(int ch, double span, double tau = 0,
+		       unsigned capacity = 0);
+
+	/** Compute the channels of @a fra and update all the windows.
+	 * @param fra The parsed frame
+	 * @param tp Reception time of the frame
+	 */
+	const XR25channels &update(const XR25frame &fra,
+				   clock::time_point tp = clock::now());
+	/** @return The time point @a t seconds after the epoch of the clock,
+	 *     e.g. for a frame stamped by XR25capture_decode()
+	 */
+	static clock::time_point at(double t) {
+		return clock::time_point(std::chrono::duration_cast
+					 <clock::duration>
+					 (std::chrono::duration<double>(t)));
+	}
+
+	const XR25channels &get_channels() const { return __ch; }
+	int window_count() const { return __win.size(); }
+	int get_window_channel(int i) const { return __win[i]._ch; }
+	const XR25rollingwindow &get_window(int i) const { return __win[i]._w; }
+	XR25windowstats get_stats(int i) const;
+};
+
+#endif /* XR25CHANNELS_HH */
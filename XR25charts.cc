@@ -0,0 +1,52 @@
+/* XR25charts.cc - Gauges and plots shown for a session
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25charts.hh"
+
+const char *const XR25alert_default[A_COUNT][2] = {
+	{ "alert_throttle", "in_flags & IN_THROTTLE_0" },
+	{ "alert_lambda",   "!(out_flags & OUT_LAMBDA_LOOP)" },
+	{ "alert_batt_v",   "batt_v > 15" },
+};
+
+void XR25alert_rules(XR25ruleset &rules, int rule[A_COUNT]) {
+	for (int i = 0; i < A_COUNT; ++i) {
+		if (rules.lookup(XR25alert_default[i][0]) < 0)
+			rules.add(XR25alert_default[i][0],
+				  XR25alert_default[i][1]);
+		rule[i] = rules.lookup(XR25alert_default[i][0]);
+	}
+}
+
+const XR25gaugedef XR25gauges[] = {
+	{ "RPM",         CH_RPM,        7000, 500, 2 },
+	{ "km/h",        CH_SPD_KM_H,   240,  10,  2 },
+	{ "Temp (C)",    CH_TEMP_WATER, 120,  30,  1 },
+	{ "Battery (V)", CH_BATT_V,     18,   1,   2 },
+	{ "MAP (mbar)",  CH_MAP,        1020, 255, 1 },
+	{ "Air Temp(C)", CH_TEMP_AIR,   90,   30,  1 },
+	{ "Lambda (mV)", CH_LAMBDA_V,   1530, 255, 1 },
+};
+const size_t XR25gauge_count = ARRAY_SIZE(XR25gauges);
+
+const XR25plotdef XR25plots[] = {
+	{ "RPM",         CH_RPM,        -1,         0, 6000, 1500 },
+	{ "MAP (mbar)",  CH_MAP,        -1,         0, 1020, 255 },
+	{ "Throttle",    CH_THROTTLE,   A_THROTTLE, 0, 100,  20 },
+	{ "Lambda (mV)", CH_LAMBDA_V,   A_LAMBDA,   0, 1020, 255 },
+	{ "Battery (V)", CH_BATT_V,     A_BATT_V,   8, 16,   2 },
+	{ "Temp (C)",    CH_TEMP_WATER, -1,         0, 120,  30 },
+};
+const size_t XR25plot_count = ARRAY_SIZE(XR25plots);
@@ -0,0 +1,65 @@
+/* XR25charts.hh - Gauges and plots shown for a session
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25CHARTS_HH
+#define XR25CHARTS_HH
+
+#include <cstddef>
+#include "XR25channels.hh"
+#include "XR25rules.hh"
+
+/* The charts of the dashboard and plots pages of xr25_diag, also drawn by
+ * tools/xr25_report; both use CairoGaugeRenderer and CairoTSPlotRenderer.
+ */
+
+/* Plot alerts are XR25ruleset rules; the defaults in XR25alert_default are
+ * added unless already defined, see XR25alert_rules().
+ */
+enum XR25alert {
+	A_THROTTLE = 0,
+	A_LAMBDA,
+	A_BATT_V,
+	A_COUNT,            // add new elements before this line
+};
+
+/** Default rule (name, expression) of every XR25alert.
+ */
+extern const char *const XR25alert_default[A_COUNT][2];
+
+/** Add the default rule of every XR25alert not defined in @a rules.
+ * @param rule Returned rule index of every XR25alert
+ */
+void XR25alert_rules(XR25ruleset &rules, int rule[A_COUNT]);
+
+struct XR25gaugedef {
+	const char *text;
+	int        ch;          // XR25channel
+	double     max, step;   // see CairoGaugeRenderer
+	size_t     label_step;
+};
+
+struct XR25plotdef {
+	const char *text;
+	int        ch;          // XR25channel
+	int        alert;       // XR25alert drawn in the alert color, or -1
+	double     min, max, step;   // see CairoTSPlotRenderer
+};
+
+extern const XR25gaugedef XR25gauges[];
+extern const size_t       XR25gauge_count;
+extern const XR25plotdef  XR25plots[];
+extern const size_t       XR25plot_count;
+
+#endif /* XR25CHARTS_HH */
@@ -0,0 +1,545 @@
+/* XR25colstore.cc - Column store of decoded captures and queries over it
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25colstore.hh"
+#include "XR25capture.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(CH_COUNT <= 64, "XR25col_zone::nan holds 64 channels");
+static_assert(sizeof(XR25col_header) <= XR25COL_HDR_SIZE,
+	      "XR25col_header does not fit in XR25COL_HDR_SIZE");
+
+/** Fill the source fields of a XR25col_header.
+ * @return false if @a capture cannot be stat()ed
+ */
+static bool set_source(XR25col_header &h, const std::string &capture,
+		       const std::string &parser_t) {
+	struct stat st;
+	if (stat(capture.c_str(), &st) == -1)
+		return false;
+	h.src_size = st.st_size;
+	h.src_mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	std::memset(h.parser, 0, sizeof(h.parser));
+	parser_t.copy(h.parser, sizeof(h.parser) - 1);
+	return true;
+}
+
+XR25colstore::XR25colstore() : __map(nullptr), __map_size(0),
+			       __block(nullptr), __zone(nullptr) {
+	std::memset(&__hdr, 0, sizeof(__hdr));
+}
+
+void XR25colstore::unmap() {
+	if (__map)
+		munmap(__map, __map_size);
+	__map = nullptr, __map_size = 0;
+	__block = nullptr, __zone = nullptr;
+}
+
+bool XR25colstore::build(const std::string &capture,
+			 const std::string &parser_t) {
+	unmap();
+	__block_v.clear(), __zone_v.clear();
+	std::memset(&__hdr, 0, sizeof(__hdr));
+	std::memcpy(__hdr.magic, XR25COL_MAGIC, sizeof(__hdr.magic));
+	__hdr.version = XR25COL_VERSION;
+	__hdr.channels = CH_COUNT, __hdr.block_rows = XR25COL_BLOCK;
+
+	if (!set_source(__hdr, capture, parser_t))
+		return false;
+	XR25channelengine engine;
+	auto add = [&](double seconds, XR25frame &fra) {
+		auto &ch = engine.update(fra, XR25channelengine::at(seconds));
+
+		const unsigned r = __hdr.rows++ % XR25COL_BLOCK;
+		if (r == 0) {
+			// zero-initialized, see XR25col_block
+			__block_v.emplace_back(new XR25col_block());
+			XR25col_zone z;
+			std::memset(&z, 0, sizeof(z));
+			z.t_first = seconds;
+			std::fill_n(z.min, CH_COUNT,
+				    std::numeric_limits<float>::infinity());
+			std::fill_n(z.max, CH_COUNT,
+				    -std::numeric_limits<float>::infinity());
+			__zone_v.push_back(z);
+		}
+		XR25col_block &b = *__block_v.back();
+		XR25col_zone &z = __zone_v.back();
+		for (int i = 0; i < CH_COUNT; ++i) {
+			const float v = ch.v[i];
+			b.v[i][r] = v;
+			if (std::isnan(v))
+				z.nan |= 1ull << i;
+			else
+				z.min[i] = std::min(z.min[i], v),
+					z.max[i] = std::max(z.max[i], v);
+		}
+		b.t[r] = z.t_last = seconds;
+		z.rows++;
+	};
+	XR25capturestats stats;
+	if (!XR25capture_decode(capture, parser_t, add, stats))
+		return false;
+	__hdr.blocks = __block_v.size();
+	__hdr.frames = stats.frames;
+	__hdr.dropped = stats.dropped;
+	__zone = __zone_v.data();
+	return true;
+}
+
+bool XR25colstore::save(const std::string &path) const {
+	const std::string tmp = path + ".tmp";
+	FILE *f = std::fopen(tmp.c_str(), "wb");
+	if (!f)
+		return false;
+
+	static const char zero[XR25COL_HDR_SIZE] = {};
+	bool ok = std::fwrite(&__hdr, sizeof(__hdr), 1, f) == 1
+		&& std::fwrite(zero, XR25COL_HDR_SIZE - sizeof(__hdr), 1, f)
+		== 1;
+	for (size_t b = 0; ok && b < blocks(); ++b)
+		ok = std::fwrite(&block(b), sizeof(XR25col_block), 1, f) == 1;
+	if (ok && blocks())
+		ok = std::fwrite(__zone, sizeof(XR25col_zone), blocks(), f)
+			== blocks();
+	int err = errno;
+	if (std::fclose(f) != 0 && ok)
+		ok = false, err = errno;
+	if (!ok || std::rename(tmp.c_str(), path.c_str()) == -1) {
+		err = ok ? errno : err;
+		std::remove(tmp.c_str());
+		return errno = err, false;
+	}
+	return true;
+}
+
+bool XR25colstore::open(const std::string &path, const std::string &capture,
+			const std::string &parser_t) {
+	unmap();
+	__block_v.clear(), __zone_v.clear();
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size)
+	    < XR25COL_HDR_SIZE) {
+		::close(fd);
+		return errno = EINVAL, false;
+	}
+	void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	int err = errno;
+	::close(fd);
+	if (p == MAP_FAILED)
+		return errno = err, false;
+
+	const unsigned char *map = static_cast<const unsigned char *>(p);
+	XR25col_header src;
+	std::memcpy(&__hdr, map, sizeof(__hdr));
+	if (std::memcmp(__hdr.magic, XR25COL_MAGIC, sizeof(__hdr.magic))
+	    || __hdr.version != XR25COL_VERSION
+	    || __hdr.channels != CH_COUNT
+	    || __hdr.block_rows != XR25COL_BLOCK
+	    || static_cast<size_t>(st.st_size) != XR25COL_HDR_SIZE
+	    + __hdr.blocks * (sizeof(XR25col_block) + sizeof(XR25col_zone))
+	    || !set_source(src, capture, parser_t)
+	    || src.src_size != __hdr.src_size
+	    || src.src_mtime != __hdr.src_mtime
+	    || std::strncmp(src.parser, __hdr.parser, sizeof(src.parser))) {
+		munmap(p, st.st_size);
+		std::memset(&__hdr, 0, sizeof(__hdr));
+		return errno = EINVAL, false;
+	}
+	__map = p, __map_size = st.st_size;
+	__block = reinterpret_cast<const XR25col_block *>
+		(map + XR25COL_HDR_SIZE);
+	__zone = reinterpret_cast<const XR25col_zone *>
+		(__block + __hdr.blocks);
+	return true;
+}
+
+bool XR25colstore::load(const std::string &capture,
+			const std::string &parser_t, bool save_cache,
+			bool *cached) {
+	const std::string path = capture + XR25COL_SUFFIX;
+	bool hit = open(path, capture, parser_t);
+	if (cached)
+		*cached = hit;
+	if (hit)
+		return true;
+	if (!build(capture, parser_t))
+		return false;
+	if (save_cache)
+		save(path);
+	return true;
+}
+
+namespace {
+/* An operand: either a constant or XR25COL_BLOCK values
+ */
+struct lane {
+	const float *p;
+	float k;
+	bool  is_k;
+};
+
+/* Value range of an operand over a block
+ */
+struct range {
+	float lo, hi;
+
+	bool is_zero() const { return lo == 0 && hi == 0; }
+	bool no_zero() const { return lo > 0 || hi < 0; }
+};
+
+/* A pending '&&' or '||': the left operand is kept on the stack until the
+ * right one is known at 'target'
+ */
+struct pending {
+	int  target;
+	bool is_or;
+};
+
+template <class _Op>
+inline void unop(lane &a, float *out, unsigned n, _Op op) {
+	if (a.is_k) {
+		a.k = op(a.k);
+		return;
+	}
+	const float *x = a.p;
+	for (unsigned i = 0; i < n; ++i)
+		out[i] = op(x[i]);
+	a.p = out;
+}
+
+template <class _Op>
+inline void binop(lane &a, const lane &b, float *out, unsigned n, _Op op) {
+	if (a.is_k && b.is_k) {
+		a.k = op(a.k, b.k);
+		return;
+	}
+	const float *x = a.p, *y = b.p;
+	if (b.is_k) {
+		const float k = b.k;
+		for (unsigned i = 0; i < n; ++i)
+			out[i] = op(x[i], k);
+	} else if (a.is_k) {
+		const float k = a.k;
+		for (unsigned i = 0; i < n; ++i)
+			out[i] = op(k, y[i]);
+	} else {
+		for (unsigned i = 0; i < n; ++i)
+			out[i] = op(x[i], y[i]);
+	}
+	a.p = out, a.is_k = false;
+}
+
+inline int to_int(float v) { return static_cast<int>(v); }
+
+/** Evaluate @a code over the first @a n rows of @a b.
+ * @param st Operand stack; at least code.size() entries
+ * @param buf Scratch; XR25COL_BLOCK floats per entry of @a st
+ * @return The value of every row; points to @a buf or to a column of @a b
+ */
+const float *eval_block(const std::vector<XR25op> &code,
+			const XR25col_block &b, unsigned n, lane st[],
+			float buf[], std::vector<pending> &pend) {
+	int sp = -1;
+	pend.clear();
+	for (size_t pc = 0; ; ++pc) {
+		// the right operand of '&&' and '||' ends with BOOL
+		while (!pend.empty() && pend.back().target == int(pc)) {
+			float *out = buf + (sp - 1) * XR25COL_BLOCK;
+			if (pend.back().is_or)
+				binop(st[sp - 1], st[sp], out, n,
+				      [](float x, float y) -> float {
+					      return (x != 0) | (y != 0); });
+			else
+				binop(st[sp - 1], st[sp], out, n,
+				      [](float x, float y) -> float {
+					      return (x != 0) & (y != 0); });
+			sp--;
+			pend.pop_back();
+		}
+		if (pc == code.size())
+			break;
+
+		const XR25op &op = code[pc];
+		// the result of an operation goes to the buffer of its slot
+		float *out = buf + std::max(sp, 0) * XR25COL_BLOCK;
+		switch (op.op) {
+		case XR25op::CONST:
+			st[++sp] = { nullptr, static_cast<float>(op.k), true };
+			break;
+		case XR25op::CHAN:
+			st[++sp] = { b.v[op.arg], 0, false };
+			break;
+		case XR25op::NOT:
+			unop(st[sp], out, n, [](float x) -> float {
+					return x == 0; });
+			break;
+		case XR25op::BNOT:
+			unop(st[sp], out, n, [](float x) -> float {
+					return ~to_int(x); });
+			break;
+		case XR25op::NEG:
+			unop(st[sp], out, n, [](float x) { return -x; });
+			break;
+		case XR25op::BOOL:
+			unop(st[sp], out, n, [](float x) -> float {
+					return x != 0; });
+			break;
+#define __binop(_expr) \
+			binop(st[sp - 1], st[sp], out - XR25COL_BLOCK, n, \
+			      [](float x, float y) -> float { \
+				      return (_expr); }); \
+			sp--; \
+			break
+		case XR25op::MUL: __binop(x * y);
+		case XR25op::DIV: __binop(y != 0 ? x / y : 0);
+		case XR25op::ADD: __binop(x + y);
+		case XR25op::SUB: __binop(x - y);
+		case XR25op::LT:  __binop(x < y);
+		case XR25op::LE:  __binop(x <= y);
+		case XR25op::GT:  __binop(x > y);
+		case XR25op::GE:  __binop(x >= y);
+		case XR25op::EQ:  __binop(x == y);
+		case XR25op::NE:  __binop(x != y);
+		case XR25op::BAND: __binop(to_int(x) & to_int(y));
+		case XR25op::BXOR: __binop(to_int(x) ^ to_int(y));
+		case XR25op::BOR:  __binop(to_int(x) | to_int(y));
+#undef __binop
+		case XR25op::ANDJ:
+		case XR25op::ORJ:
+			pend.push_back({ op.arg, op.op == XR25op::ORJ });
+			break;
+		}
+	}
+
+	if (st[0].is_k) {
+		std::fill_n(buf, n, st[0].k);
+		return buf;
+	}
+	return st[0].p;
+}
+} // namespace
+
+XR25colquery::XR25colquery(const std::string &text) : __chan(0) {
+	std::string expr;
+	__hold = std::chrono::duration<double>
+		(XR25ruleset::split_hold(text, expr)).count();
+	XR25expr::compile(expr, __code);
+	for (auto &i : __code)
+		if (i.op == XR25op::CHAN)
+			__chan |= 1ull << i.arg;
+}
+
+int XR25colquery::classify(const XR25col_zone &z) const {
+	static const float inf = std::numeric_limits<float>::infinity();
+	if (z.nan & __chan)
+		return 0;
+
+	// interval arithmetic in float, as eval_block(), so that rounding
+	// never leaves a row value outside its range
+	std::vector<range> st;
+	std::vector<pending> pend;
+	st.reserve(__code.size());
+	auto fix = [](range &r) {
+		if (std::isnan(r.lo) || std::isnan(r.hi))
+			r = { -inf, inf };
+	};
+	auto bool_range = [](bool is_true, bool is_false) -> range {
+		return is_true ? range{ 1, 1 } : is_false ? range{ 0, 0 }
+			: range{ 0, 1 };
+	};
+
+	for (size_t pc = 0; ; ++pc) {
+		while (!pend.empty() && pend.back().target == int(pc)) {
+			range y = st.back();
+			st.pop_back();
+			range &x = st.back();
+			if (pend.back().is_or)
+				x = x.no_zero() || y.no_zero() ? range{ 1, 1 }
+					: x.is_zero() ? y
+					: bool_range(false, false);
+			else
+				x = x.is_zero() || y.is_zero() ? range{ 0, 0 }
+					: x.no_zero() ? y
+					: bool_range(false, false);
+			pend.pop_back();
+		}
+		if (pc == __code.size())
+			break;
+
+		const XR25op &op = __code[pc];
+		range y = { 0, 0 };
+		if (op.op >= XR25op::MUL && op.op <= XR25op::BOR) {
+			y = st.back();
+			st.pop_back();
+		}
+		range *x = st.empty() ? nullptr : &st.back();
+		auto corners = [&](float a, float b, float c, float d) {
+			*x = { std::min(std::min(a, b), std::min(c, d)),
+			       std::max(std::max(a, b), std::max(c, d)) };
+			fix(*x);
+		};
+		const bool k = x && x->lo == x->hi && y.lo == y.hi;
+
+		switch (op.op) {
+		case XR25op::CONST:
+			st.push_back({ static_cast<float>(op.k),
+				       static_cast<float>(op.k) });
+			break;
+		case XR25op::CHAN:
+			st.push_back({ z.min[op.arg], z.max[op.arg] });
+			break;
+		case XR25op::NOT:
+			*x = bool_range(x->is_zero(), x->no_zero());
+			break;
+		case XR25op::BOOL:
+			*x = bool_range(x->no_zero(), x->is_zero());
+			break;
+		case XR25op::NEG:
+			*x = { -x->hi, -x->lo };
+			break;
+		case XR25op::BNOT:
+			if (x->lo == x->hi)
+				x->lo = x->hi = ~to_int(x->lo);
+			else
+				*x = { -inf, inf };
+			break;
+		case XR25op::ADD:
+			*x = { x->lo + y.lo, x->hi + y.hi };
+			fix(*x);
+			break;
+		case XR25op::SUB:
+			*x = { x->lo - y.hi, x->hi - y.lo };
+			fix(*x);
+			break;
+		case XR25op::MUL:
+			corners(x->lo * y.lo, x->lo * y.hi, x->hi * y.lo,
+				x->hi * y.hi);
+			break;
+		case XR25op::DIV:
+			if (y.lo <= 0 && y.hi >= 0)
+				*x = { -inf, inf };
+			else
+				corners(x->lo / y.lo, x->lo / y.hi,
+					x->hi / y.lo, x->hi / y.hi);
+			break;
+		case XR25op::LT:
+			*x = bool_range(x->hi < y.lo, x->lo >= y.hi);
+			break;
+		case XR25op::LE:
+			*x = bool_range(x->hi <= y.lo, x->lo > y.hi);
+			break;
+		case XR25op::GT:
+			*x = bool_range(x->lo > y.hi, x->hi <= y.lo);
+			break;
+		case XR25op::GE:
+			*x = bool_range(x->lo >= y.hi, x->hi < y.lo);
+			break;
+		case XR25op::EQ:
+			*x = bool_range(k && x->lo == y.lo,
+					x->hi < y.lo || y.hi < x->lo);
+			break;
+		case XR25op::NE:
+			*x = bool_range(x->hi < y.lo || y.hi < x->lo,
+					k && x->lo == y.lo);
+			break;
+		case XR25op::BAND:
+			if (k)
+				x->lo = x->hi = to_int(x->lo) & to_int(y.lo);
+			else if (x->lo >= 0 && y.lo >= 0)
+				*x = { 0, std::min(x->hi, y.hi) };
+			else
+				*x = { -inf, inf };
+			break;
+		case XR25op::BXOR:
+		case XR25op::BOR:
+			if (k)
+				x->lo = x->hi = op.op == XR25op::BOR
+					? to_int(x->lo) | to_int(y.lo)
+					: to_int(x->lo) ^ to_int(y.lo);
+			else
+				*x = { -inf, inf };
+			break;
+		case XR25op::ANDJ:
+		case XR25op::ORJ:
+			pend.push_back({ op.arg, op.op == XR25op::ORJ });
+			break;
+		}
+	}
+	const range &r = st.front();
+	return r.no_zero() ? 1 : r.is_zero() ? -1 : 0;
+}
+
+void XR25colquery::run(const XR25colstore &s,
+		       const std::function<void(double, double)> &emit,
+		       stats *st) const {
+	std::unique_ptr<lane[]> stack(new lane[__code.size() + 1]);
+	std::unique_ptr<float[]> buf(new float[(__code.size() + 1)
+					       * XR25COL_BLOCK]);
+	std::vector<pending> pend;
+	stats n = { 0, 0, 0 };
+	bool open = false;
+	double begin = 0, last = 0;
+
+	auto close = [&]() {
+		if (open && last - begin >= __hold)
+			emit(begin, last);
+		open = false;
+	};
+	auto extend = [&](double t0, double t1) {
+		if (!open)
+			open = true, begin = t0;
+		last = t1;
+	};
+
+	for (size_t i = 0; i < s.blocks(); ++i) {
+		const XR25col_zone &z = s.zone(i);
+		const int c = classify(z);
+		if (c < 0) {
+			close(), n.skipped++;
+			continue;
+		}
+		if (c > 0) {
+			extend(z.t_first, z.t_last), n.matched++;
+			continue;
+		}
+		const XR25col_block &b = s.block(i);
+		const float *v = eval_block(__code, b, z.rows, stack.get(),
+					    buf.get(), pend);
+		for (unsigned r = 0; r < z.rows; ++r)
+			if (v[r] != 0)
+				extend(b.t[r], b.t[r]);
+			else
+				close();
+		n.scanned++;
+	}
+	close();
+	if (st)
+		st->skipped += n.skipped, st->matched += n.matched,
+			st->scanned += n.scanned;
+}
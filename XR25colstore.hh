@@ -0,0 +1,168 @@
+/* XR25colstore.hh - Column store of decoded captures and queries over it
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25COLSTORE_HH
+#define XR25COLSTORE_HH
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "XR25channels.hh"
+#include "XR25rules.hh"
+
+#define XR25COL_MAGIC    "XR25COL1"
+#define XR25COL_VERSION  1
+#define XR25COL_HDR_SIZE 4096          // blocks start here
+#define XR25COL_BLOCK    1024          // rows (frames) per block
+#define XR25COL_SUFFIX   ".xr25c"      // cache file: <capture>.xr25c
+
+/* File layout: a XR25col_header, padded to XR25COL_HDR_SIZE, followed by
+ * 'blocks' XR25col_block and then by their XR25col_zone.  Zones are kept
+ * together so that skipping a block never touches its data.
+ */
+struct XR25col_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t channels;         // CH_COUNT
+	uint32_t block_rows;       // XR25COL_BLOCK
+	uint32_t blocks;
+	uint64_t rows;
+	uint64_t frames, dropped;  // reader counts, see XR25streamreader
+	int64_t  src_size;         // of the capture, to detect stale caches
+	int64_t  src_mtime;        // ns since the epoch
+	char     parser[32];
+};
+
+/* Channel values of XR25COL_BLOCK consecutive frames, column-wise; rows past
+ * XR25col_zone::rows are zero.
+ */
+struct XR25col_block {
+	float  v[CH_COUNT][XR25COL_BLOCK];
+	double t[XR25COL_BLOCK];   // end of the frame, s since the start
+};
+
+/* Summary of a XR25col_block; NaN values are not part of min/max.
+ */
+struct XR25col_zone {
+	uint32_t rows;
+	uint32_t pad;
+	uint64_t nan;              // bit c: channel c has NaN rows
+	double   t_first, t_last;
+	float    min[CH_COUNT], max[CH_COUNT];
+};
+
+/** The channels of every frame of a capture, in blocks of XR25COL_BLOCK
+ * rows.  A store is built by decoding the capture once and saved next to it;
+ * later queries map the saved file instead.
+ */
+class XR25colstore {
+private:
+	XR25col_header __hdr;
+	std::vector<std::unique_ptr<XR25col_block>> __block_v;
+	std::vector<XR25col_zone> __zone_v;
+	void  *__map;               // of a file opened by open()
+	size_t __map_size;
+	const XR25col_block *__block;
+	const XR25col_zone  *__zone;
+
+	void unmap();
+public:
+	XR25colstore();
+	XR25colstore(const XR25colstore &) = delete;
+	XR25colstore &operator=(const XR25colstore &) = delete;
+	~XR25colstore() { unmap(); }
+
+	/** Decode a capture; timestamps are derived from the line rate, see
+	 * tools/xr25_decode.
+	 * @param capture Capture file, plain or gzip-compressed
+	 * @param parser_t Parser type, see ParserFactory
+	 * @return false if @a capture could not be read; errno is set
+	 */
+	bool build(const std::string &capture, const std::string &parser_t);
+
+	/** Write a store made by build(); the file is replaced atomically.
+	 * @return false on error; errno is set
+	 */
+	bool save(const std::string &path) const;
+
+	/** Map a file written by save().
+	 * @param capture,parser_t Those given to build(); the file is rejected
+	 *     if it was made from a different (or since modified) capture
+	 * @return false if @a path could not be read or is stale
+	 */
+	bool open(const std::string &path, const std::string &capture,
+		  const std::string &parser_t);
+
+	/** open() the cache of @a capture, or build() the store and, if
+	 * @a save_cache, save() it; failing to save is not an error.
+	 * @param cached If not null, set to whether the cache was used
+	 * @return false if @a capture could not be read
+	 */
+	bool load(const std::string &capture, const std::string &parser_t,
+		  bool save_cache = true, bool *cached = nullptr);
+
+	size_t   blocks()  const { return __hdr.blocks; }
+	uint64_t rows()    const { return __hdr.rows; }
+	uint64_t frames()  const { return __hdr.frames; }
+	uint64_t dropped() const { return __hdr.dropped; }
+	double   seconds() const {
+		return blocks() ? __zone[blocks() - 1].t_last : 0; }
+	const XR25col_zone  &zone(size_t b)  const { return __zone[b]; }
+	const XR25col_block &block(size_t b) const {
+		return __map ? __block[b] : *__block_v[b]; }
+};
+
+/** A rule expression (see XR25rules.hh), evaluated over a XR25colstore a
+ * block at a time.  Blocks are first classified from their zone: blocks
+ * where the expression cannot be non-zero are skipped and blocks where it is
+ * always non-zero match as a whole; only the rest are evaluated, one
+ * instruction over all the rows of a column at a time.  Values are compared
+ * as float.
+ */
+class XR25colquery {
+public:
+	struct stats {
+		size_t skipped, matched, scanned;   // blocks
+	};
+private:
+	std::vector<XR25op> __code;
+	double   __hold;        // s
+	uint64_t __chan;        // bit c: the expression uses channel c
+public:
+	/** Compile a query.
+	 * @param text '<expression> [for <duration>]', as for alert rules
+	 * @throw XR25rule_error if @a text is malformed
+	 */
+	XR25colquery(const std::string &text);
+
+	/** @return 1 if the expression is non-zero for all the rows of the
+	 *     block of @a z, -1 if it is zero for all, or 0 if unknown
+	 */
+	int classify(const XR25col_zone &z) const;
+
+	/** Find the time ranges where the expression is non-zero for at
+	 * least the hold time; thread-safe.
+	 * @param emit Called with the time of the first and last frame of
+	 *     every range, in order
+	 * @param st If not null, block counts are added to it
+	 */
+	void run(const XR25colstore &s,
+		 const std::function<void(double, double)> &emit,
+		 stats *st = nullptr) const;
+};
+
+#endif /* XR25COLSTORE_HH */
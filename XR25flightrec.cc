@@ -0,0 +1,194 @@
+/* XR25flightrec.cc - Crash-safe recorder of the last received frames
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25flightrec.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <new>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define XR25FLIGHTREC_VERSION 1
+
+/** Rename @a from to @a to, unless @a to exists.
+ * @return 0, or the errno value of the failure; EEXIST if @a to exists
+ */
+static int rename_noreplace(const std::string &from, const std::string &to) {
+	if (renameat2(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(),
+		      RENAME_NOREPLACE) == 0)
+		return 0;
+	if (errno != EINVAL)
+		return errno;
+	// the file system does not support RENAME_NOREPLACE
+	if (link(from.c_str(), to.c_str()) == -1)
+		return errno;
+	unlink(from.c_str());
+	return 0;
+}
+
+/** Keep a file left by a run that did not end cleanly as the first of
+ * <pathname>.crash, <pathname>.crash.1, ... that does not exist.
+ * @return 0, or the errno value of the failure; EEXIST if there are
+ *     already XR25FLIGHTREC_MAX_CRASH of them
+ */
+static int keep_crash(const std::string &pathname) {
+	int old = ::open(pathname.c_str(), O_RDONLY | O_CLOEXEC);
+	if (old == -1)
+		return 0;
+	XR25flightrec_header h;
+	bool crashed = pread(old, &h, sizeof(h), 0) == sizeof(h)
+		&& std::memcmp(h.magic, XR25FLIGHTREC_MAGIC,
+			       sizeof(h.magic)) == 0 && !h.clean;
+	::close(old);
+	if (!crashed)
+		return 0;
+
+	int err = EEXIST;
+	for (unsigned i = 0; i < XR25FLIGHTREC_MAX_CRASH && err == EEXIST;
+	     ++i)
+		err = rename_noreplace(pathname, pathname + ".crash"
+				       + (i ? "." + std::to_string(i) : ""));
+	return err;
+}
+
+bool XR25flightrecorder::open(const std::string &pathname, size_t size) {
+	close();
+	size &= ~size_t(7);
+	if (size < sizeof(XR25flightrec_record) + XR25FLIGHTREC_MAX_FRAME)
+		return errno = EINVAL, false;
+
+	// keep the evidence of the previous run if it did not end cleanly
+	if (int err = keep_crash(pathname))
+		return errno = err, false;
+
+	// a new file is all zeros: no stale record of a previous run
+	__fd = ::open(pathname.c_str(),
+		      O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (__fd == -1)
+		return false;
+	const size_t total = XR25FLIGHTREC_HDR_SIZE + size;
+	// allocate the blocks now; a store to a hole of a full file system
+	// would raise SIGBUS
+	int err = posix_fallocate(__fd, 0, total);
+	if (err == 0) {
+		void *p = mmap(nullptr, total, PROT_READ | PROT_WRITE,
+			       MAP_SHARED, __fd, 0);
+		if (p != MAP_FAILED)
+			__map = static_cast<unsigned char *>(p);
+		else
+			err = errno;
+	}
+	if (!__map) {
+		::close(__fd), __fd = -1;
+		unlink(pathname.c_str());
+		return errno = err, false;
+	}
+
+	__size = size;
+	__hdr = new (__map) XR25flightrec_header;
+	std::memcpy(__hdr->magic, XR25FLIGHTREC_MAGIC, sizeof(__hdr->magic));
+	__hdr->version = XR25FLIGHTREC_VERSION;
+	__hdr->clean = 0;
+	__hdr->data_size = size;
+	__hdr->t_open = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	__hdr->frames.store(0);
+	__data = __map + XR25FLIGHTREC_HDR_SIZE;
+	__off = 0, __seq = 0;
+	return true;
+}
+
+void XR25flightrecorder::close() {
+	if (!__map)
+		return;
+	__hdr->clean = 1;
+	msync(__map, XR25FLIGHTREC_HDR_SIZE + __size, MS_ASYNC);
+	munmap(__map, XR25FLIGHTREC_HDR_SIZE + __size);
+	::close(__fd);
+	__fd = -1, __map = nullptr, __hdr = nullptr, __data = nullptr;
+}
+
+bool XR25flightrecorder::read(const std::string &pathname, info_t &info,
+			      record_fn_t fn) {
+	int fd = ::open(pathname.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size)
+	    < XR25FLIGHTREC_HDR_SIZE) {
+		::close(fd);
+		return errno = EINVAL, false;
+	}
+	void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	int err = errno;
+	::close(fd);
+	if (p == MAP_FAILED)
+		return errno = err, false;
+
+	const unsigned char *map = static_cast<const unsigned char *>(p);
+	const auto *hdr = reinterpret_cast<const XR25flightrec_header *>(map);
+	if (std::memcmp(hdr->magic, XR25FLIGHTREC_MAGIC, sizeof(hdr->magic))
+	    || hdr->version != XR25FLIGHTREC_VERSION
+	    || hdr->data_size > static_cast<size_t>(st.st_size)
+	    - XR25FLIGHTREC_HDR_SIZE) {
+		munmap(p, st.st_size);
+		return errno = EINVAL, false;
+	}
+	info.clean = hdr->clean;
+	info.t_open = hdr->t_open;
+	info.frames = hdr->frames.load();
+	info.recovered = 0, info.first_seq = info.last_seq = 0;
+
+	/* The newest lap of the ring is a chain of records from offset 0;
+	 * beyond its end lie records of the previous lap, partly overwritten.
+	 * Look for a valid record at every 8-byte boundary and skip over the
+	 * ones found.
+	 */
+	const unsigned char *data = map + XR25FLIGHTREC_HDR_SIZE;
+	const size_t size = hdr->data_size;
+	std::vector<std::pair<uint64_t, size_t>> found;   // seq, offset
+	for (size_t off = 0; off + sizeof(XR25flightrec_record) <= size; ) {
+		const auto *r = reinterpret_cast<const XR25flightrec_record *>
+			(data + off);
+		const size_t need = (sizeof(*r) + r->length + 7) & ~size_t(7);
+		if (r->magic == XR25FLIGHTREC_REC_MAGIC
+		    && r->length <= XR25FLIGHTREC_MAX_FRAME
+		    && off + need <= size
+		    && r->sum == checksum(*r, data + off + sizeof(*r))) {
+			found.emplace_back(r->seq, off);
+			off += need;
+		} else
+			off += 8;
+	}
+	std::sort(found.begin(), found.end());
+
+	for (auto &i : found) {
+		const auto *r = reinterpret_cast<const XR25flightrec_record *>
+			(data + i.second);
+		if (fn)
+			fn(*r, data + i.second + sizeof(*r));
+	}
+	info.recovered = found.size();
+	if (!found.empty())
+		info.first_seq = found.front().first,
+			info.last_seq = found.back().first;
+	munmap(p, st.st_size);
+	return true;
+}
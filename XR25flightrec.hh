@@ -0,0 +1,173 @@
+/* XR25flightrec.hh - Crash-safe recorder of the last received frames
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25FLIGHTREC_HH
+#define XR25FLIGHTREC_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include "XR25streamreader.hh"
+
+#define XR25FLIGHTREC_MAGIC      "XR25FRC1"
+#define XR25FLIGHTREC_REC_MAGIC  0x52463532u   // "25FR"
+#define XR25FLIGHTREC_WRAP_MAGIC 0x50415257u   // "WRAP"
+#define XR25FLIGHTREC_HDR_SIZE   4096          // data starts here
+#define XR25FLIGHTREC_MAX_FRAME  256
+#define XR25FLIGHTREC_MINUTES    10            // default length
+#define XR25FLIGHTREC_MAX_CRASH  100           // <file>.crash[.<n>] kept
+
+/* File layout: a XR25flightrec_header, padded to XR25FLIGHTREC_HDR_SIZE,
+ * followed by a ring of 8-byte aligned records.  A record never wraps; if it
+ * does not fit before the end of the ring, a WRAP_MAGIC word is written and
+ * the record starts at offset 0.
+ */
+struct XR25flightrec_header {
+	char          magic[8];
+	uint32_t      version;
+	uint32_t      clean;       // 1 once closed by close()
+	uint64_t      data_size;   // bytes of the ring
+	int64_t       t_open;      // system_clock, ns since the epoch
+	std::atomic<uint64_t> frames;   // records written so far
+};
+
+struct XR25flightrec_record {
+	uint32_t magic;            // written last; 0 while being written
+	uint16_t length;           // frame octets that follow
+	uint16_t reserved;
+	uint64_t seq;              // 0, 1, ... since open()
+	int64_t  t;                // system_clock, ns since the epoch
+	uint32_t sum;              // see XR25flightrecorder::checksum()
+	uint32_t pad;
+	// followed by 'length' octets, then padding to 8 bytes
+};
+
+/** Always-on recorder of the frames received in the last minutes.  Frames
+ * are copied with plain stores to a MAP_SHARED mapping of a preallocated
+ * file, so record() makes no system calls.  The page cache survives a crash
+ * of the process; the kernel writes it back on its own schedule (typically
+ * within 30 s), so most of it survives a power loss, too.  See
+ * tools/xr25_recover for turning a recorder file into a capture.
+ */
+class XR25flightrecorder {
+private:
+	int                   __fd;
+	size_t                __size;      // ring bytes
+	unsigned char         *__map;
+	XR25flightrec_header  *__hdr;
+	unsigned char         *__data;
+	size_t                __off;       // next record
+	uint64_t              __seq;
+public:
+	XR25flightrecorder() : __fd(-1), __size(0), __map(nullptr),
+			       __hdr(nullptr), __data(nullptr), __off(0),
+			       __seq(0) { }
+	~XR25flightrecorder() { close(); }
+
+	/** @return Ring size for @a minutes of frames at the line rate
+	 */
+	static size_t size_for_minutes(unsigned minutes) {
+		// a record header per frame at most doubles the data
+		return minutes * 60UL * XR25_BYTES_PER_SEC * 2;
+	}
+
+	/** Create @a pathname (truncating it) and map it.  A previous file
+	 * that was not closed cleanly is kept as <pathname>.crash, or as
+	 * <pathname>.crash.<n> with the first <n> not taken by an earlier
+	 * one, so that it is not overwritten by the next run.
+	 * @param size Ring size in bytes; it must hold a record of
+	 *     XR25FLIGHTREC_MAX_FRAME octets
+	 * @return false on failure; errno is set: EINVAL if @a size is too
+	 *     small, EEXIST if XR25FLIGHTREC_MAX_CRASH files are kept
+	 *     already
+	 */
+	bool open(const std::string &pathname, size_t size);
+	/** Mark the file as cleanly closed and unmap it.
+	 */
+	void close();
+	bool is_open() const { return __map != nullptr; }
+
+	static uint32_t checksum(const XR25flightrec_record &r,
+				 const unsigned char c[]) {
+		uint32_t h = 2166136261u;   // FNV-1a
+		auto mix = [&h](const void *p, size_t n) {
+			for (size_t i = 0; i < n; ++i)
+				h = (h ^ static_cast<const unsigned char *>
+				     (p)[i]) * 16777619u;
+		};
+		mix(&r.length, sizeof(r.length)), mix(&r.seq, sizeof(r.seq));
+		mix(&r.t, sizeof(r.t)), mix(c, r.length);
+		return h;
+	}
+
+	/** Record a frame; called from the reader thread.  Never blocks, nor
+	 * allocates, nor calls into the kernel.
+	 */
+	void record(const unsigned char c[], int length) {
+		if (!__map || length <= 0 || length > XR25FLIGHTREC_MAX_FRAME)
+			return;
+		const size_t need = (sizeof(XR25flightrec_record) + length
+				     + 7) & ~size_t(7);
+		if (__off + need > __size) {
+			const uint32_t wrap = XR25FLIGHTREC_WRAP_MAGIC;
+			if (__off + sizeof(wrap) <= __size)
+				std::memcpy(__data + __off, &wrap,
+					    sizeof(wrap));
+			__off = 0;
+		}
+
+		auto *r = reinterpret_cast<XR25flightrec_record *>
+			(__data + __off);
+		auto *magic = reinterpret_cast<std::atomic<uint32_t> *>
+			(&r->magic);
+		magic->store(0, std::memory_order_relaxed);
+		r->length = length, r->reserved = 0, r->pad = 0;
+		r->seq = __seq++;
+		r->t = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch())
+			.count();
+		std::memcpy(r + 1, c, length);
+		r->sum = checksum(*r, c);
+		magic->store(XR25FLIGHTREC_REC_MAGIC,
+			     std::memory_order_release);
+		__off += need;
+		__hdr->frames.store(__seq, std::memory_order_release);
+	}
+
+	/* Contents of a recorder file; see read() */
+	struct info_t {
+		bool     clean;
+		int64_t  t_open;
+		uint64_t frames;      // recorded since open()
+		uint64_t recovered;   // valid records passed to the callback
+		uint64_t first_seq, last_seq;
+	};
+	typedef std::function<void(const XR25flightrec_record &,
+				   const unsigned char[])> record_fn_t;
+
+	/** Scan a recorder file, e.g. after a crash, and call @a fn for every
+	 * valid record in @a seq order.  Records being overwritten or written
+	 * when the process died fail their checksum and are skipped.
+	 * @return false if the file could not be read or is not a recorder
+	 *     file; errno is set
+	 */
+	static bool read(const std::string &pathname, info_t &info,
+			 record_fn_t fn);
+};
+
+#endif /* XR25FLIGHTREC_HH */
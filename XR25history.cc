@@ -0,0 +1,58 @@
+/* XR25history.cc - Recent samples of several channels, column-wise
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25history.hh"
+#include <algorithm>
+#include <stdexcept>
+
+static unsigned round_up_pow2(unsigned v) {
+	unsigned p = 1;
+	while (p < v)
+		p <<= 1;
+	return p;
+}
+
+XR25history::XR25history(unsigned capacity, const std::vector<int> &channels)
+	: __cap(round_up_pow2(std::max(capacity, 1u))), __ch(channels),
+	  __t(new time_point[__cap]),
+	  __v(new float[__cap * std::max<size_t>(channels.size(), 1)]),
+	  __alert(new uint32_t[__cap]()), __head(0) {
+	if (channels.size() > XR25HISTORY_MAX_COLUMNS)
+		throw std::length_error("XR25history: too many columns");
+}
+
+unsigned XR25history::copy(unsigned c, unsigned n, float v[], bool alert[],
+			   time_point t[]) const {
+	const unsigned long h = count();
+	const float *col = &__v[c * __cap];
+	const uint32_t bit = 1u << c;
+
+	n = std::min<unsigned long>({ n, h, __cap });
+	for (unsigned k = 0; k < n; ++k) {
+		const unsigned i = (h - 1 - k) & (__cap - 1);
+		v[k] = col[i];
+		alert[k] = __alert[i] & bit;
+		if (t)
+			t[k] = __t[i];
+	}
+
+	// rows whose slot the writer reused (or is reusing) meanwhile are not
+	// valid; these are the oldest ones
+	std::atomic_thread_fence(std::memory_order_acquire);
+	const unsigned long lag = __head.load(std::memory_order_relaxed) - h;
+	if (lag + 1 >= __cap)
+		return 0;
+	return std::min<unsigned long>(n, __cap - lag - 1);
+}
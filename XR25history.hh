@@ -0,0 +1,84 @@
+/* XR25history.hh - Recent samples of several channels, column-wise
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25HISTORY_HH
+#define XR25HISTORY_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "XR25channels.hh"
+
+#define XR25HISTORY_MAX_COLUMNS 32   // bits of the alert column
+
+/** Circular buffer of the last rows pushed, stored as one timestamp column,
+ * one float column per channel and one alert bitmask column (bit c is the
+ * alert state of column c).  A single thread push()es; any number of threads
+ * may copy() concurrently.  Rows overwritten while being copied are detected
+ * and left out, so a reader never sees a torn row as valid.
+ */
+class XR25history {
+public:
+	typedef std::chrono::steady_clock::time_point time_point;
+private:
+	unsigned                      __cap;      // power of 2
+	std::vector<int>              __ch;       // XR25channel per column
+	std::unique_ptr<time_point[]> __t;
+	std::unique_ptr<float[]>      __v;        // column c at __v[c * __cap]
+	std::unique_ptr<uint32_t[]>   __alert;
+	std::atomic<unsigned long>    __head;     // rows pushed so far
+public:
+	/** Construct a XR25history object
+	 * @param capacity Rows kept; rounded up to a power of 2
+	 * @param channels XR25channel of each column
+	 */
+	XR25history(unsigned capacity, const std::vector<int> &channels);
+
+	unsigned columns() const { return __ch.size(); }
+	int get_channel(unsigned c) const { return __ch[c]; }
+	/** @return Number of rows pushed so far; changes on every push()
+	 */
+	unsigned long count() const {
+		return __head.load(std::memory_order_acquire); }
+
+	/** Append a row; the writer thread only.
+	 * @param t Sample time
+	 * @param ch Channel values; only the channels of the columns are read
+	 * @param alert Alert bitmask, bit c for column c
+	 */
+	void push(time_point t, const XR25channels &ch, uint32_t alert) {
+		const unsigned long h = __head.load(std::memory_order_relaxed);
+		const unsigned i = h & (__cap - 1);
+
+		__t[i] = t;
+		for (unsigned c = 0; c < __ch.size(); ++c)
+			__v[c * __cap + i] = ch[__ch[c]];
+		__alert[i] = alert;
+		__head.store(h + 1, std::memory_order_release);
+	}
+
+	/** Copy the newest rows of column @a c, newest first.
+	 * @param n Maximum number of rows to copy
+	 * @param v, alert, t Output arrays of @a n elements; @a t may be
+	 *     nullptr
+	 * @return Number of rows copied, at most @a n
+	 */
+	unsigned copy(unsigned c, unsigned n, float v[], bool alert[],
+		      time_point t[]) const;
+};
+
+#endif /* XR25HISTORY_HH */
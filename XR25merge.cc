@@ -0,0 +1,169 @@
+/* XR25merge.cc - Time-ordered merge of XR25 and auxiliary record streams
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25merge.hh"
+#include "XR25channels.hh"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+XR25merger::XR25merger(double max_delay)
+	: __max_delay(max_delay), __epoch(std::chrono::steady_clock::now()) {
+}
+
+unsigned XR25merger::add_source(unsigned capacity) {
+	__src.push_back({ std::unique_ptr<XR25record[]>
+				  (new XR25record[capacity]), capacity, 0, 0,
+			  -std::numeric_limits<double>::infinity(), false });
+	return __src.size() - 1;
+}
+
+void XR25merger::push(const XR25record &r) {
+	std::unique_lock<std::mutex> lock(__m);
+	source_t &s = __src[r.source];
+	__writable.wait(lock, [&s]() { return s._count < s._cap; });
+	XR25record &q = s._q[(s._head + s._count++) % s._cap];
+	q = r;
+	q.t = s._last_t = std::max(r.t, s._last_t);
+	__readable.notify_one();
+}
+
+void XR25merger::finish(unsigned source) {
+	std::lock_guard<std::mutex> lock(__m);
+	__src[source]._done = true;
+	__readable.notify_one();
+}
+
+bool XR25merger::pop(XR25record &r) {
+	std::unique_lock<std::mutex> lock(__m);
+	for (;;) {
+		source_t *best = nullptr;
+		bool done = true;
+		for (auto &i : __src) {
+			done &= i._done && !i._count;
+			if (i._count && (!best || i._q[i._head].t
+					 < best->_q[best->_head].t))
+				best = &i;
+		}
+		if (done)
+			return false;
+		if (!best) {
+			__readable.wait(lock);
+			continue;
+		}
+
+		// an empty source may still push a record older than 't'
+		const double t = best->_q[best->_head].t;
+		bool ready = true;
+		for (auto &i : __src)
+			if (!i._done && !i._count && i._last_t < t)
+				ready = false;
+		double wait = __max_delay < 0 ? 0 : t + __max_delay - now();
+		if (ready || (__max_delay >= 0 && wait <= 0)) {
+			r = best->_q[best->_head];
+			best->_head = (best->_head + 1) % best->_cap;
+			best->_count--;
+			__writable.notify_all();
+			return true;
+		}
+		if (__max_delay < 0)
+			__readable.wait(lock);
+		else
+			__readable.wait_for(lock, std::chrono::duration<double>
+					    (wait));
+	}
+}
+
+/** @return Room for the primary records of @a max_gap seconds, see
+ *     XR25aligner
+ */
+static unsigned held_for(double max_gap) {
+	const double n = std::ceil(max_gap * XR25_MAX_FRA_PER_SEC) + 1;
+	return std::min<double>(XR25MERGE_MAX_HELD,
+				std::max<double>(XR25MERGE_QUEUE, n));
+}
+
+XR25aligner::XR25aligner(unsigned sources, unsigned primary, double max_gap,
+			 row_fn_t fn)
+	: __sources(sources), __primary(primary), __max_gap(max_gap),
+	  __now(-std::numeric_limits<double>::infinity()), __fn(fn),
+	  __last(sources), __seen(sources),
+	  __cap(held_for(max_gap)),
+	  __p(new pending_t[__cap]), __aux(new aux_t[__cap * sources]),
+	  __head(0), __count(0) {
+	__all = (sources >= 64 ? ~0ull : (1ull << sources) - 1)
+		& ~(1ull << primary);
+}
+
+/** Set the values of source @a s for pending record @a i from the latest
+ * sample and @a b, the first one at or after it (null if none).
+ */
+void XR25aligner::fill(unsigned i, unsigned s, const XR25record *b) {
+	const XR25record *a = __seen[s] ? &__last[s] : nullptr;
+	const double t = __p[i]._r.t;
+	double *v = aux_of(i)[s];
+
+	std::fill_n(v, XR25MERGE_MAX_VALUES,
+		    std::numeric_limits<double>::quiet_NaN());
+	if (a && (t - a->t > __max_gap || a->t > t))
+		a = nullptr;
+	if (b && b->t - t > __max_gap)
+		b = nullptr;
+	if (a && b && b->t > a->t) {
+		const double k = (t - a->t) / (b->t - a->t);
+		for (unsigned j = 0; j < std::min(a->n, b->n); ++j)
+			v[j] = a->v[j] + k * (b->v[j] - a->v[j]);
+	} else if (a || b) {
+		// hold the nearest
+		const XR25record *c = !b || (a && t - a->t < b->t - t) ? a : b;
+		std::copy_n(c->v, c->n, v);
+	}
+	__p[i]._filled |= 1ull << s;
+}
+
+void XR25aligner::emit_front() {
+	for (unsigned s = 0; s < __sources; ++s)
+		if (s != __primary && !(__p[__head]._filled & 1ull << s))
+			fill(__head, s, nullptr);
+	__fn(__p[__head]._r, aux_of(__head));
+	__head = (__head + 1) % __cap, __count--;
+}
+
+void XR25aligner::add(const XR25record &r) {
+	__now = std::max(__now, r.t);
+	if (r.source == __primary) {
+		if (__count == __cap)
+			emit_front();
+		unsigned i = (__head + __count++) % __cap;
+		__p[i]._r = r, __p[i]._filled = 0;
+	} else {
+		for (unsigned k = 0; k < __count; ++k) {
+			unsigned i = (__head + k) % __cap;
+			if (!(__p[i]._filled & 1ull << r.source)
+			    && __p[i]._r.t <= r.t)
+				fill(i, r.source, &r);
+		}
+		__last[r.source] = r, __seen[r.source] = 1;
+	}
+
+	while (__count && ((__p[__head]._filled & __all) == __all
+			   || __now - __p[__head]._r.t > __max_gap))
+		emit_front();
+}
+
+void XR25aligner::finish() {
+	while (__count)
+		emit_front();
+}
@@ -0,0 +1,158 @@
+/* XR25merge.hh - Time-ordered merge of XR25 and auxiliary record streams
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25MERGE_HH
+#define XR25MERGE_HH
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define XR25MERGE_MAX_VALUES 8
+#define XR25MERGE_QUEUE      256     // records buffered per source
+#define XR25MERGE_MAX_HELD   65536   // primary records held by XR25aligner
+
+/* A timestamped sample of one source, e.g. some channels of a XR25 frame
+ * or a GPS fix.
+ */
+struct XR25record {
+	double   t;              // s; see XR25merger
+	unsigned source;
+	unsigned n;              // values used
+	double   v[XR25MERGE_MAX_VALUES];
+};
+
+/** k-way merge of record streams, each pushed by a thread of its own, into
+ * a single stream in time order.  Every source has a bounded queue; push()
+ * blocks while it is full.
+ *
+ * Replayed input (max_delay < 0): a record is only returned once every
+ * source has either a later record queued or finished, so the output is
+ * exactly ordered.  Live input (max_delay >= 0): timestamps are now(), and
+ * a source that has nothing queued is not waited for longer than
+ * max_delay seconds; its records arriving later than that are returned as
+ * soon as possible, out of order.
+ */
+class XR25merger {
+private:
+	struct source_t {
+		std::unique_ptr<XR25record[]> _q;
+		unsigned _cap, _head, _count;
+		double   _last_t;
+		bool     _done;
+	};
+	std::mutex              __m;
+	std::condition_variable __readable, __writable;
+	std::vector<source_t>   __src;
+	double                  __max_delay;
+	std::chrono::steady_clock::time_point __epoch;
+public:
+	/** @param max_delay Seconds a live source is waited for; negative for
+	 *     replayed input
+	 */
+	explicit XR25merger(double max_delay = -1);
+
+	/** Add a source; call before any push() or pop().
+	 * @param capacity Records buffered
+	 * @return The source index, to be set in XR25record::source
+	 */
+	unsigned add_source(unsigned capacity = XR25MERGE_QUEUE);
+
+	/** @return Seconds since the construction of this object; the
+	 *     timestamp of live records
+	 */
+	double now() const {
+		return std::chrono::duration<double>
+			(std::chrono::steady_clock::now() - __epoch).count(); }
+
+	/** Queue a record; blocks while the queue of @a r.source is full.
+	 * Timestamps of a source must not decrease; if they do, the previous
+	 * timestamp is used.
+	 */
+	void push(const XR25record &r);
+
+	/** Mark the end of a source; no push() may follow.
+	 */
+	void finish(unsigned source);
+
+	/** Take the next record in time order; blocks until there is one.
+	 * @return false once all the sources are finished and drained
+	 */
+	bool pop(XR25record &r);
+};
+
+/** Resamples auxiliary sources at the timestamps of a primary one: every
+ * record of the primary source is returned with the values of the others
+ * linearly interpolated between the samples before and after it.  Records
+ * must be added in time order, e.g. from XR25merger::pop(); primary
+ * records are held until all the other sources have a later sample, for at
+ * most max_gap seconds of input.  Room is made for the records of max_gap
+ * seconds at XR25_MAX_FRA_PER_SEC, but for no more than XR25MERGE_MAX_HELD
+ * (see capacity()); beyond that, the oldest is returned early.  A value is
+ * NaN if no sample is found within max_gap of the primary record; if only
+ * one is, it is held.
+ */
+class XR25aligner {
+public:
+	typedef double aux_t[XR25MERGE_MAX_VALUES];
+	/** @param aux Values of every source, indexed by XR25record::source;
+	 *     those of the primary source are unused
+	 */
+	typedef std::function<void(const XR25record &primary,
+				   const aux_t aux[])> row_fn_t;
+private:
+	struct pending_t {
+		XR25record _r;
+		uint64_t   _filled;   // bit s: aux[s] is final
+	};
+	unsigned __sources, __primary;
+	double   __max_gap, __now;
+	row_fn_t __fn;
+	std::vector<XR25record> __last;   // latest sample of every source
+	std::vector<char>       __seen;
+	unsigned __cap;
+	std::unique_ptr<pending_t[]> __p;
+	std::unique_ptr<aux_t[]>     __aux;   // __sources entries per pending
+	unsigned __head, __count;
+	uint64_t __all;
+
+	aux_t *aux_of(unsigned i) { return &__aux[i * __sources]; }
+	void fill(unsigned i, unsigned s, const XR25record *b);
+	void emit_front();
+public:
+	/** @param sources Number of sources, at most 64
+	 * @param primary Source whose records are returned
+	 * @param max_gap Seconds; see above
+	 * @param fn Called for every primary record, in order
+	 */
+	XR25aligner(unsigned sources, unsigned primary, double max_gap,
+		    row_fn_t fn);
+
+	/** @return Primary records that can be held
+	 */
+	unsigned capacity() const { return __cap; }
+
+	void add(const XR25record &r);
+
+	/** Return the primary records still held; call at the end of input.
+	 */
+	void finish();
+};
+
+#endif /* XR25MERGE_HH */
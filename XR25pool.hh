@@ -0,0 +1,86 @@
+/* XR25pool.hh - Work-stealing thread pool for batch tools
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25POOL_HH
+#define XR25POOL_HH
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Runs a fixed set of independent tasks (e.g. one per capture file) on a
+ * number of threads.  Tasks are dealt round-robin to per-thread queues; a
+ * thread takes work from the back of its own queue and, once empty, steals
+ * from the front of the others', so uneven task sizes do not leave threads
+ * idle.
+ */
+class XR25workpool {
+private:
+	struct queue_t {
+		std::mutex         _m;
+		std::deque<size_t> _q;
+	};
+	unsigned __n;
+public:
+	/** @param n Number of threads; 0 uses one per hardware thread
+	 */
+	explicit XR25workpool(unsigned n = 0)
+		: __n(n ? n : std::max(1u, std::thread::hardware_concurrency()))
+	{ }
+	unsigned size() const { return __n; }
+
+	/** Call fn(worker, task) for every task in [0, @a count) and wait for
+	 * all of them; @a worker in [0, size()) identifies the calling thread,
+	 * so that @a fn can use per-thread state without locking.  The calling
+	 * thread is worker 0.
+	 */
+	template <typename _Fn>
+	void run(size_t count, _Fn fn) {
+		std::unique_ptr<queue_t[]> q(new queue_t[__n]);
+		for (size_t i = 0; i < count; ++i)
+			q[i % __n]._q.push_back(i);
+
+		// tasks do not spawn tasks: all queues empty means done
+		auto take = [&q, this](unsigned self, size_t &task) {
+			for (unsigned k = 0; k < __n; ++k) {
+				queue_t &v = q[(self + k) % __n];
+				std::lock_guard<std::mutex> lock(v._m);
+				if (v._q.empty())
+					continue;
+				if (k == 0)
+					task = v._q.back(), v._q.pop_back();
+				else
+					task = v._q.front(), v._q.pop_front();
+				return true;
+			}
+			return false;
+		};
+		std::vector<std::thread> thrd;
+		for (unsigned i = 1; i < __n; ++i)
+			thrd.emplace_back([&take, &fn, i]() {
+					for (size_t t; take(i, t); )
+						fn(i, t);
+				});
+		for (size_t t; take(0, t); )
+			fn(0, t);
+		for (auto &i : thrd)
+			i.join();
+	}
+};
+
+#endif /* XR25POOL_HH */
@@ -0,0 +1,159 @@
+/* XR25rt.cc - Real-time options and jitter measurement of the reader
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25rt.hh"
+#include "XR25streamreader.hh"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <sched.h>
+
+bool XR25rtconf::parse(const std::string &spec, XR25rtconf &conf) {
+	conf = XR25rtconf();
+	for (size_t b = 0, e; b < spec.size(); b = e + 1) {
+		if ((e = spec.find(',', b)) == std::string::npos)
+			e = spec.size();
+		std::string opt = spec.substr(b, e - b);
+		size_t eq = opt.find('=');
+		std::string key = opt.substr(0, eq);
+		const char *val = eq != std::string::npos
+			? opt.c_str() + eq + 1 : nullptr;
+		char *end = nullptr;
+		long n = val ? std::strtol(val, &end, 10) : 0;
+		bool num_ok = val && *val && *end == '\0';
+
+		if (key == "fifo" && num_ok && n >= 1 && n <= 99)
+			conf.fifo_priority = n;
+		else if (key == "cpu" && num_ok && n >= 0 && n < CPU_SETSIZE)
+			conf.cpu = n;
+		else if (key == "mlock" && !val)
+			conf.mlock = true;
+		else if (key == "prefault" && !val)
+			conf.prefault = true;
+		else if (!opt.empty())
+			return false;
+	}
+	return true;
+}
+
+int XR25rtconf::apply(pthread_t thrd) const {
+	int err = 0;
+	if (fifo_priority) {
+		struct sched_param sp;
+		sp.sched_priority = fifo_priority;
+		err = pthread_setschedparam(thrd, SCHED_FIFO, &sp);
+	}
+	if (cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		int ret = pthread_setaffinity_np(thrd, sizeof(set), &set);
+		if (!err)
+			err = ret;
+	}
+	return err;
+}
+
+void XR25rtconf::prefault_stack() {
+	volatile unsigned char buf[XR25RT_PREFAULT_STACK];
+	for (size_t i = 0; i < sizeof(buf); i += 4096)
+		buf[i] = 0;
+}
+
+void XR25jitter::reset() {
+	for (auto &i : __bin)
+		i.store(0);
+	__count = 0, __bytes = 0;
+	__min_us = LONG_MAX, __max_us = LONG_MIN;
+	__elapsed = 0;
+}
+
+void XR25jitter::add(double dt, unsigned bytes) {
+	const long late_us = static_cast<long>
+		((dt - static_cast<double>(bytes) / XR25_BYTES_PER_SEC) * 1e6);
+	long b = late_us < XR25JITTER_MIN_US ? 0
+		: (late_us - XR25JITTER_MIN_US) / XR25JITTER_BIN_US + 1;
+	if (b > XR25JITTER_BINS + 1)
+		b = XR25JITTER_BINS + 1;
+
+	// single writer: no read-modify-write needed
+	auto inc = [](std::atomic<unsigned long> &a, unsigned long n) {
+		a.store(a.load(std::memory_order_relaxed) + n,
+			std::memory_order_relaxed); };
+	inc(__bin[b], 1), inc(__count, 1), inc(__bytes, bytes);
+	__elapsed.store(__elapsed.load(std::memory_order_relaxed) + dt,
+			std::memory_order_relaxed);
+	if (late_us < __min_us.load(std::memory_order_relaxed))
+		__min_us.store(late_us, std::memory_order_relaxed);
+	if (late_us > __max_us.load(std::memory_order_relaxed))
+		__max_us.store(late_us, std::memory_order_relaxed);
+}
+
+long XR25jitter::quantile_us(double q) const {
+	const unsigned long n = count();
+	unsigned long acc = 0;
+	if (!n)
+		return 0;
+	for (int i = 0; i < XR25JITTER_BINS + 2; ++i)
+		if ((acc += get_bin(i)) >= q * n)
+			return i == 0 ? min_us()
+				: i == XR25JITTER_BINS + 1 ? max_us()
+				: bin_start_us(i) + XR25JITTER_BIN_US;
+	return max_us();
+}
+
+double XR25jitter::line_utilization() const {
+	double t = __elapsed.load();
+	return t > 0 ? __bytes.load() / (t * XR25_BYTES_PER_SEC) : 1;
+}
+
+void XR25jitter::print(std::ostream &os) const {
+	const unsigned long n = count();
+	unsigned long peak = 1;
+	if (!n) {
+		os << "no frames timed\n";
+		return;
+	}
+	for (int i = 0; i < XR25JITTER_BINS + 2; ++i)
+		peak = std::max(peak, get_bin(i));
+
+	os << "frame lateness (ms; arrival interval minus time on the "
+	   "wire)\n" << std::fixed << std::setprecision(1);
+	for (int i = 0; i < XR25JITTER_BINS + 2; ++i) {
+		const unsigned long c = get_bin(i);
+		if (!c)
+			continue;
+		if (i == 0)
+			os << std::setw(6) << "" << " - " << std::setw(5)
+			   << XR25JITTER_MIN_US / 1000.;
+		else if (i == XR25JITTER_BINS + 1)
+			os << std::setw(6) << bin_start_us(i) / 1000.
+			   << " - " << std::setw(5) << "";
+		else
+			os << std::setw(6) << bin_start_us(i) / 1000. << " - "
+			   << std::setw(5) << (bin_start_us(i)
+					       + XR25JITTER_BIN_US) / 1000.;
+		os << std::setw(10) << c << " "
+		   << std::string(40 * c / peak, '#') << "\n";
+	}
+	os << std::setprecision(2) << n << " headers, lateness min "
+	   << min_us() / 1000. << " ms, p50 " << quantile_us(.5) / 1000.
+	   << " ms, p99 " << quantile_us(.99) / 1000. << " ms, max "
+	   << max_us() / 1000. << " ms\nline utilization "
+	   << 100 * line_utilization() << "% of " << XR25_BYTES_PER_SEC
+	   << " octets/s\n";
+}
@@ -0,0 +1,108 @@
+/* XR25rt.hh - Real-time options and jitter measurement of the reader
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25RT_HH
+#define XR25RT_HH
+
+#include <atomic>
+#include <iosfwd>
+#include <string>
+#include <pthread.h>
+
+/* Scheduling of the XR25streamreader thread; see
+ * XR25streamreader::set_rt().
+ */
+struct XR25rtconf {
+	int  fifo_priority;  // SCHED_FIFO priority (1-99); 0: SCHED_OTHER
+	int  cpu;            // CPU the thread is pinned to; -1: any
+	bool mlock;          // lock current and future pages in RAM
+	bool prefault;       // touch the thread stack before reading
+
+	XR25rtconf() : fifo_priority(0), cpu(-1), mlock(false),
+		       prefault(false) { }
+
+	/** Parse a comma-separated list of options: "fifo=<prio>",
+	 * "cpu=<n>", "mlock" and "prefault", e.g. "fifo=50,cpu=1,mlock".
+	 * @return false if @a spec is malformed
+	 */
+	static bool parse(const std::string &spec, XR25rtconf &conf);
+
+	/** Apply the scheduling policy and CPU affinity to @a thrd.
+	 * @return 0, or the errno value of the first failure (e.g. EPERM
+	 *     without CAP_SYS_NICE)
+	 */
+	int apply(pthread_t thrd) const;
+
+	/** Touch XR25RT_PREFAULT_STACK bytes of the calling thread stack,
+	 * so that page faults do not happen while reading.
+	 */
+	static void prefault_stack();
+};
+
+#define XR25RT_PREFAULT_STACK (256 * 1024)
+
+#define XR25JITTER_BIN_US 500
+#define XR25JITTER_MIN_US (-8000)
+#define XR25JITTER_BINS   64   // [-8 ms, +24 ms), plus under/overflow
+
+/** Histogram of the lateness of frame headers: the time elapsed since the
+ * previous header minus the time the octets received in between take on
+ * the wire (see XR25_BYTES_PER_SEC).  Reception that keeps up with the
+ * line stays around 0 (USB adapters add a few ms of batching); a steadily
+ * positive lateness means octets were lost.  Written by the reader thread
+ * only; the getters may be called from any thread.
+ */
+class XR25jitter {
+private:
+	std::atomic<unsigned long> __bin[XR25JITTER_BINS + 2];
+	std::atomic<unsigned long> __count, __bytes;
+	std::atomic<long>          __min_us, __max_us;
+	std::atomic<double>        __elapsed;      // seconds
+public:
+	XR25jitter() { reset(); }
+
+	void reset();
+	/** Account a header.
+	 * @param dt Seconds since the previous header
+	 * @param bytes Octets received since the previous header, escapes
+	 *     included
+	 */
+	void add(double dt, unsigned bytes);
+
+	unsigned long count() const { return __count.load(); }
+	/** @return Headers whose lateness is in bin @a i; bin 0 holds
+	 *     lateness below XR25JITTER_MIN_US, bin XR25JITTER_BINS + 1
+	 *     lateness above the last bin
+	 */
+	unsigned long get_bin(int i) const { return __bin[i].load(); }
+	static long bin_start_us(int i)
+	{ return XR25JITTER_MIN_US + (i - 1) * XR25JITTER_BIN_US; }
+	long min_us() const { return __min_us.load(); }
+	long max_us() const { return __max_us.load(); }
+	/** @return Lateness (us) not exceeded by a fraction @a q of the
+	 *     headers, at bin resolution
+	 */
+	long quantile_us(double q) const;
+	/** @return Octets received / octets the line carries in the
+	 *     measured time; 1 if nothing was lost
+	 */
+	double line_utilization() const;
+
+	/** Write the histogram and a summary as text.
+	 */
+	void print(std::ostream &os) const;
+};
+
+#endif /* XR25RT_HH */
@@ -0,0 +1,345 @@
+/* XR25rules.cc - Alert rules compiled from a small expression language
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25rules.hh"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#define __FLAG(_f) { #_f, _f }
+static const struct { const char *name; int value; } flag_names[] = {
+	__FLAG(IN_AC_REQUEST), __FLAG(IN_AC_COMPRES), __FLAG(IN_THROTTLE_0),
+	__FLAG(IN_PARKED), __FLAG(IN_THROTTLE_1),
+	__FLAG(OUT_PUMP_ENABLE), __FLAG(OUT_IDLE_REGULATION),
+	__FLAG(OUT_WASTEGATE_REG), __FLAG(OUT_LAMBDA_LOOP),
+	__FLAG(OUT_EGR_ENABLE), __FLAG(OUT_CHECK_ENGINE),
+	__FLAG(FAULT_MAP), __FLAG(FAULT_SPD_SENSOR), __FLAG(FAULT_LAMBDA_TMP),
+	__FLAG(FAULT_LAMBDA), __FLAG(FAULT_WATER_OPEN_C),
+	__FLAG(FAULT_WATER_SHORT_C), __FLAG(FAULT_AIR_OPEN_C),
+	__FLAG(FAULT_AIR_SHORT_C), __FLAG(FAULT_TPS_LOW),
+	__FLAG(FAULT_TPS_HIGH),
+	__FLAG(FAULT_EEPROM_CHECKSUM), __FLAG(FAULT_PROG_CHECKSUM),
+	__FLAG(FAULT_PUMP), __FLAG(FAULT_WASTEGATE), __FLAG(FAULT_EGR),
+	__FLAG(FAULT_IDLE_REG), __FLAG(FAULT_INJECTORS),
+};
+#undef __FLAG
+
+/* Binary operators, lowest precedence first; '&&' and '||' are handled apart
+ * because they short-circuit.
+ */
+static const struct { const char *tok; int prec; XR25op::opcode op; }
+	binary_ops[] = {
+	{ "|",  3, XR25op::BOR },  { "^",  4, XR25op::BXOR },
+	{ "&",  5, XR25op::BAND }, { "==", 6, XR25op::EQ },
+	{ "!=", 6, XR25op::NE },   { "<=", 7, XR25op::LE },
+	{ ">=", 7, XR25op::GE },   { "<",  7, XR25op::LT },
+	{ ">",  7, XR25op::GT },   { "+",  8, XR25op::ADD },
+	{ "-",  8, XR25op::SUB },  { "*",  9, XR25op::MUL },
+	{ "/",  9, XR25op::DIV },
+};
+
+namespace {
+/* Recursive-descent compiler; emits postfix code while parsing.
+ */
+class compiler {
+private:
+	const std::string   &__s;
+	size_t              __p;
+	std::vector<XR25op> &__code;
+	size_t              __start;
+	int                 __depth, __max_depth;
+
+	void error(const std::string &msg) {
+		throw XR25rule_error(msg + " at column "
+				     + std::to_string(__p + 1) + " in '" + __s
+				     + "'");
+	}
+	void skip_ws() {
+		while (__p < __s.size() && std::isspace(__s[__p]))
+			__p++;
+	}
+	bool accept(const char *tok) {
+		skip_ws();
+		size_t n = std::char_traits<char>::length(tok);
+		if (__s.compare(__p, n, tok) != 0)
+			return false;
+		// do not split '&&', '||', '<=', ...
+		if (n == 1 && __p + 1 < __s.size()
+		    && ((tok[0] == '&' && __s[__p + 1] == '&')
+			|| (tok[0] == '|' && __s[__p + 1] == '|')
+			|| (std::strchr("<>!=", tok[0])
+			    && __s[__p + 1] == '=')))
+			return false;
+		return __p += n, true;
+	}
+	void emit(XR25op::opcode op, int arg = 0, double k = 0, int push = 0) {
+		__code.push_back({ op, arg, k });
+		if ((__depth += push) > __max_depth)
+			__max_depth = __depth;
+	}
+
+	void primary();
+	void unary();
+	void binary(int min_prec);
+	void logical_and();
+	void logical_or();
+public:
+	compiler(const std::string &s, std::vector<XR25op> &code)
+		: __s(s), __p(0), __code(code), __start(code.size()),
+		  __depth(0), __max_depth(0) { }
+
+	size_t compile() {
+		logical_or();
+		skip_ws();
+		if (__p != __s.size())
+			error("unexpected '" + __s.substr(__p) + "'");
+		if (__max_depth > XR25EXPR_MAX_STACK)
+			error("expression too complex");
+		return __code.size() - __start;
+	}
+};
+
+void compiler::primary() {
+	skip_ws();
+	if (accept("(")) {
+		logical_or();
+		if (!accept(")"))
+			error("expected ')'");
+	} else if (__p < __s.size() && (std::isdigit(__s[__p])
+					|| __s[__p] == '.')) {
+		const char *b = __s.c_str() + __p;
+		char *e;
+		double k = (__s.compare(__p, 2, "0x") == 0
+			    || __s.compare(__p, 2, "0X") == 0)
+			? std::strtol(b, &e, 16) : std::strtod(b, &e);
+		__p += e - b;
+		emit(XR25op::CONST, 0, k, 1);
+	} else if (__p < __s.size() && (std::isalpha(__s[__p])
+					|| __s[__p] == '_')) {
+		size_t b = __p;
+		while (__p < __s.size() && (std::isalnum(__s[__p])
+					    || __s[__p] == '_'))
+			__p++;
+		std::string id = __s.substr(b, __p - b);
+		int ch = XR25channel_lookup(id);
+		if (ch >= 0)
+			return emit(XR25op::CHAN, ch, 0, 1);
+		for (auto &i : flag_names)
+			if (id == i.name)
+				return emit(XR25op::CONST, 0, i.value, 1);
+		__p = b, error("unknown identifier '" + id + "'");
+	} else
+		error("expected operand");
+}
+
+void compiler::unary() {
+	if (accept("!"))
+		unary(), emit(XR25op::NOT);
+	else if (accept("~"))
+		unary(), emit(XR25op::BNOT);
+	else if (accept("-"))
+		unary(), emit(XR25op::NEG);
+	else
+		primary();
+}
+
+// precedence climbing over 'binary_ops'
+void compiler::binary(int min_prec) {
+	unary();
+	for (bool found = true; found; ) {
+		found = false;
+		for (auto &i : binary_ops)
+			if (i.prec >= min_prec && accept(i.tok)) {
+				binary(i.prec + 1);
+				emit(i.op, 0, 0, -1);
+				found = true;
+				break;
+			}
+	}
+}
+
+void compiler::logical_and() {
+	binary(0);
+	while (accept("&&")) {
+		size_t j = __code.size();
+		emit(XR25op::ANDJ, 0, 0, -1);
+		binary(0);
+		emit(XR25op::BOOL);
+		__code[j].arg = __code.size() - __start;
+	}
+}
+
+void compiler::logical_or() {
+	logical_and();
+	while (accept("||")) {
+		size_t j = __code.size();
+		emit(XR25op::ORJ, 0, 0, -1);
+		logical_and();
+		emit(XR25op::BOOL);
+		__code[j].arg = __code.size() - __start;
+	}
+}
+} // namespace
+
+size_t XR25expr::compile(const std::string &text, std::vector<XR25op> &code) {
+	return compiler(text, code).compile();
+}
+
+double XR25expr::eval(const XR25op *code, const XR25op *end,
+		      const double ch[]) {
+	double st[XR25EXPR_MAX_STACK], *sp = st - 1;
+	const XR25op *base = code;  // jump targets are relative to 'code'
+
+#define __binop(_expr) ({ double b = *sp--; double a = *sp; *sp = (_expr); })
+#define __intop(_op) __binop(static_cast<double>(static_cast<long>(a) _op \
+						 static_cast<long>(b)))
+	for (const XR25op *pc = code; pc < end; ++pc)
+		switch (pc->op) {
+		case XR25op::CONST: *++sp = pc->k; break;
+		case XR25op::CHAN:  *++sp = ch[pc->arg]; break;
+		case XR25op::NOT:   *sp = !*sp; break;
+		case XR25op::BNOT:  *sp = ~static_cast<long>(*sp); break;
+		case XR25op::NEG:   *sp = -*sp; break;
+		case XR25op::MUL:   __binop(a * b); break;
+		case XR25op::DIV:   __binop(b != 0 ? a / b : 0); break;
+		case XR25op::ADD:   __binop(a + b); break;
+		case XR25op::SUB:   __binop(a - b); break;
+		case XR25op::LT:    __binop(a < b); break;
+		case XR25op::LE:    __binop(a <= b); break;
+		case XR25op::GT:    __binop(a > b); break;
+		case XR25op::GE:    __binop(a >= b); break;
+		case XR25op::EQ:    __binop(a == b); break;
+		case XR25op::NE:    __binop(a != b); break;
+		case XR25op::BAND:  __intop(&); break;
+		case XR25op::BXOR:  __intop(^); break;
+		case XR25op::BOR:   __intop(|); break;
+		case XR25op::BOOL:  *sp = *sp != 0; break;
+		case XR25op::ANDJ:
+			if (*sp == 0)
+				pc = base + pc->arg - 1;
+			else
+				sp--;
+			break;
+		case XR25op::ORJ:
+			if (*sp != 0)
+				*sp = 1, pc = base + pc->arg - 1;
+			else
+				sp--;
+			break;
+		}
+#undef __intop
+#undef __binop
+	return *sp;
+}
+
+XR25ruleset::clock::duration XR25ruleset::split_hold(const std::string &text,
+						     std::string &expr) {
+	static const char kw[] = " for ";
+	size_t p = text.rfind(kw);
+	expr = text;
+	if (p == std::string::npos)
+		return XR25ruleset::clock::duration::zero();
+
+	std::string d = text.substr(p + sizeof(kw) - 1);
+	char *e;
+	double v = std::strtod(d.c_str(), &e);
+	std::string unit(e);
+	unit.erase(unit.find_last_not_of(" \t\r") + 1);
+	if (e == d.c_str() || (unit != "s" && unit != "ms"))
+		throw XR25rule_error("bad duration '" + d + "'");
+	expr = text.substr(0, p);
+	return std::chrono::duration_cast<XR25ruleset::clock::duration>(
+		std::chrono::duration<double>(unit == "ms" ? v / 1000 : v));
+}
+
+void XR25ruleset::recompile() {
+	__code.clear();
+	for (auto &i : __rule) {
+		std::string expr;
+		split_hold(i._text, expr);
+		i._begin = __code.size();
+		i._end = i._begin + XR25expr::compile(expr, __code);
+	}
+}
+
+void XR25ruleset::add(const std::string &name, const std::string &text) {
+	std::string expr;
+	auto hold = split_hold(text, expr);
+	std::vector<XR25op> tmp;
+	XR25expr::compile(expr, tmp);   // validate before touching __rule
+
+	int i = lookup(name);
+	if (i < 0) {
+		size_t b = __code.size();
+		XR25expr::compile(expr, __code);
+		__rule.push_back({ name, text, b, __code.size(), hold,
+				   clock::time_point(), false, false });
+	} else {
+		__rule[i]._text = text, __rule[i]._hold = hold;
+		recompile();
+	}
+}
+
+void XR25ruleset::load(std::istream &s, const std::string &origin) {
+	std::string line;
+	for (int n = 1; std::getline(s, line); ++n) {
+		line.erase(std::min(line.find('#'), line.size()));
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		size_t eq = line.find('=');
+		if (eq == std::string::npos || line[eq + 1] == '=')
+			throw XR25rule_error(origin + ":" + std::to_string(n)
+					     + ": expected '<name> = <expr>'");
+		std::string name = line.substr(0, eq);
+		name.erase(0, name.find_first_not_of(" \t"));
+		name.erase(name.find_last_not_of(" \t") + 1);
+		try {
+			add(name, line.substr(eq + 1));
+		} catch (const XR25rule_error &e) {
+			throw XR25rule_error(origin + ":" + std::to_string(n)
+					     + ": " + e.what());
+		}
+	}
+}
+
+bool XR25ruleset::load_file(const std::string &path) {
+	std::ifstream f(path);
+	if (!f.is_open())
+		return false;
+	load(f, path);
+	return true;
+}
+
+int XR25ruleset::lookup(const std::string &name) const {
+	for (size_t i = 0; i < __rule.size(); ++i)
+		if (__rule[i]._name == name)
+			return i;
+	return -1;
+}
+
+void XR25ruleset::evaluate(const XR25channels &ch, clock::time_point tp) {
+	const XR25op *code = __code.data();
+	for (auto &i : __rule) {
+		bool cond = XR25expr::eval(code + i._begin, code + i._end,
+					   ch.v) != 0;
+		if (cond && !i._cond)
+			i._since = tp;
+		i._cond  = cond;
+		i._state = cond && (tp - i._since) >= i._hold;
+	}
+}
@@ -0,0 +1,144 @@
+/* XR25rules.hh - Alert rules compiled from a small expression language
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25RULES_HH
+#define XR25RULES_HH
+
+#include <chrono>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "XR25channels.hh"
+
+/* Expressions are made of numbers (e.g. 15, 0x80, 1.5), channel names (see
+ * XR25channel_name) and flag names (IN_xxx, OUT_xxx, FAULT_xxx) combined with
+ * the C operators
+ *     ! ~ - (unary)   * /   + -   < <= > >=   == !=   &   ^   |   &&   ||
+ * and parentheses.  Rules are read one per line, '#' starts a comment:
+ *     <name> = <expression> [for <duration>]
+ * where <duration> is a number followed by 's' or 'ms', e.g.
+ *     batt_high  = batt_v > 15 for 2s
+ *     lambda_off = !(out_flags & OUT_LAMBDA_LOOP) && rpm > 1500
+ * A rule is active if its expression is non-zero (for at least <duration>).
+ */
+
+#define XR25EXPR_MAX_STACK 32
+
+struct XR25rule_error : public std::runtime_error {
+	XR25rule_error(const std::string &what) : std::runtime_error(what) {}
+};
+
+/* A XR25expr instruction; see XR25expr::eval().
+ */
+struct XR25op {
+	enum opcode : int {
+		CONST = 0, CHAN,
+		NOT, BNOT, NEG,
+		MUL, DIV, ADD, SUB,
+		LT, LE, GT, GE, EQ, NE,
+		BAND, BXOR, BOR,
+		BOOL, ANDJ, ORJ,   // ANDJ/ORJ short-circuit to 'arg'
+	} op;
+	int    arg;            // channel or jump target
+	double k;              // constant
+};
+
+class XR25expr {
+public:
+	/** Compile an expression; the code is appended to @a code.
+	 * @param text Expression source
+	 * @param code Instruction vector; jump targets are relative to the
+	 *     first instruction of the expression
+	 * @return Number of instructions appended
+	 * @throw XR25rule_error if @a text is malformed
+	 */
+	static size_t compile(const std::string &text,
+			      std::vector<XR25op> &code);
+
+	/** Evaluate code compiled by compile(); does not allocate.
+	 * @param code Start of the expression code
+	 * @param end End of the expression code
+	 * @param ch Channel values, indexed by XR25channel
+	 */
+	static double eval(const XR25op *code, const XR25op *end,
+			   const double ch[]);
+};
+
+/** An ordered set of named rules, evaluated once per frame on the reader
+ * thread.  All rules share a single flat code vector; evaluate() performs no
+ * allocation and no virtual calls.
+ */
+class XR25ruleset {
+public:
+	typedef std::chrono::steady_clock clock;
+private:
+	struct rule_t {
+		std::string       _name, _text;
+		size_t            _begin, _end;
+		clock::duration   _hold;
+		clock::time_point _since;
+		bool              _cond, _state;
+	};
+
+	std::vector<XR25op> __code;
+	std::vector<rule_t> __rule;
+
+	void recompile();
+public:
+	/** Add a rule or replace the one named @a name.
+	 * @param name Rule name
+	 * @param text Expression, optionally followed by 'for <duration>'
+	 * @throw XR25rule_error if @a text is malformed
+	 */
+	void add(const std::string &name, const std::string &text);
+
+	/** Split '<expression> [for <duration>]'.
+	 * @param text Rule text
+	 * @param expr Set to the expression part of @a text
+	 * @return The hold time; zero if there is no 'for' clause
+	 * @throw XR25rule_error if the duration is malformed
+	 */
+	static clock::duration split_hold(const std::string &text,
+					  std::string &expr);
+
+	/** Read rules from a stream; see the syntax above.
+	 * @param s The input stream
+	 * @param origin Name reported in error messages
+	 * @throw XR25rule_error on syntax errors
+	 */
+	void load(std::istream &s, const std::string &origin = "<stream>");
+
+	/** Read rules from a file; see load().
+	 * @return false if @a path could not be opened
+	 */
+	bool load_file(const std::string &path);
+
+	/** Evaluate all the rules; not thread-safe.
+	 * @param ch The channels of the current frame
+	 * @param tp Reception time of the frame
+	 */
+	void evaluate(const XR25channels &ch,
+		      clock::time_point tp = clock::now());
+
+	/** @return Index of the rule named @a name or -1
+	 */
+	int lookup(const std::string &name) const;
+	size_t size() const { return __rule.size(); }
+	const std::string &get_name(int i) const { return __rule[i]._name; }
+	bool get_state(int i) const { return __rule[i]._state; }
+};
+
+#endif /* XR25RULES_HH */
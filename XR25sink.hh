@@ -0,0 +1,81 @@
+/* XR25sink.hh - Compose frame consumers at compile time
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25SINK_HH
+#define XR25SINK_HH
+
+#include <functional>
+#include <vector>
+#include "XR25streamreader.hh"
+
+/* A sink is any copyable type callable as
+ *     void (const unsigned char c[], int length, XR25frame &fra)
+ * that receives the validated frames of a XR25streamreader, see
+ * XR25streamreader::start().  Sinks combined in a XR25sinkchain are called in
+ * order through their static type, so the per-frame dispatch is inlined.
+ */
+template <typename... _Sinks> class XR25sinkchain;
+
+template <> class XR25sinkchain<> {
+public:
+	inline void operator()(const unsigned char c[], int length,
+			       XR25frame &fra) { }
+};
+
+template <typename _Head, typename... _Tail>
+class XR25sinkchain<_Head, _Tail...> {
+private:
+	_Head                   __head;
+	XR25sinkchain<_Tail...> __tail;
+public:
+	XR25sinkchain(_Head h, _Tail... t) : __head(h), __tail(t...) { }
+
+	inline void operator()(const unsigned char c[], int length,
+			       XR25frame &fra) {
+		__head(c, length, fra);
+		__tail(c, length, fra);
+	}
+};
+
+/** Build a XR25sinkchain; wrap a sink in std::ref() to share it instead of
+ * copying it into the chain.
+ */
+template <typename... _Sinks>
+inline XR25sinkchain<_Sinks...> make_sinkchain(_Sinks... s) {
+	return XR25sinkchain<_Sinks...>(s...);
+}
+
+/** Runtime-registered sinks; the escape hatch for consumers not known at
+ * compile time.  Costs one indirect call per registered sink and frame, none
+ * if empty.  add() must not be called while the reader thread is running.
+ */
+class XR25dynamicsink {
+public:
+	typedef std::function<void(const unsigned char[], int, XR25frame &)
+			      > sink_fn_t;
+private:
+	std::vector<sink_fn_t> __sinks;
+public:
+	void add(sink_fn_t fn) { __sinks.push_back(fn); }
+	bool empty() const { return __sinks.empty(); }
+
+	inline void operator()(const unsigned char c[], int length,
+			       XR25frame &fra) {
+		for (auto &i : __sinks)
+			i(c, length, fra);
+	}
+};
+
+#endif /* XR25SINK_HH */
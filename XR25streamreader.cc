@@ -14,22 +14,20 @@
  */
 
 #include "XR25streamreader.hh"
-#include <condition_variable>
-#include <tuple>
-#include <mutex>
 #include <iomanip>
+#include <sys/mman.h>
 
-/** Frame received handler.
+/** Frame received handler; validates and parses the frame.
  * @param parser The XR25frameparser to use
  * @param c Translated frame (&quot;0xff 0xff&quot; replaced by &quot;0xff
  *     &quot;)
  * @param length Length of the frame in octets
  * @param fra Reference to the parsed frame
+ * @return true if the frame is to be passed to the sink
  */
-void XR25streamreader::frame_recv(XR25frameparser &parser,
+bool XR25streamreader::frame_recv(XR25frameparser &parser,
 				  const unsigned char c[], int length,
 				  XR25frame &fra) {
-	this->__fra_count++;
 #ifdef DEBUG
 	std::cout << "[" << std::dec << length << "] " << std::hex
 		  << std::setfill('0');
@@ -38,48 +36,23 @@ void XR25streamreader::frame_recv(XR25frameparser &parser,
 	std::cout << std::endl;
 #endif
 
-	parser.parse_frame(c, length, fra);
-	if (__post_parse)
-		__post_parse(c, length, fra);
-}
+	// learn the frame length; re-learn if the ECU starts sending frames
+	// of a different length
+	if (length == __learn_length) {
+		if (++__learn_count >= XR25_LEARN_FRAMES)
+			__fra_length = length;
+	} else
+		__learn_length = length, __learn_count = 1;
+
+	if (__fra_length && length != __fra_length)
+		return drop(DROP_LENGTH), false;
+	if (!parser.parse_frame(c, length, fra))
+		return drop(DROP_PARSE), false;
 
-void XR25streamreader::read_frames(XR25frameparser &parser) {
-	unsigned char frame[128] = { 0xff, 0x00 }, c, *p = &frame[1];
-	XR25frame fra{};
-	std::condition_variable term;
-	std::mutex              term_m;
-	std::atomic_int         count(0);
-	// thread that updates __fra_sec once a second
-	std::thread stat_thread([&term, &term_m, &count, this]() {
-			std::unique_lock<std::mutex> lock(term_m);
-			while (term.wait_for(lock, std::chrono::seconds(1))
-			       == std::cv_status::timeout)
-				this->__fra_sec = count.exchange(0); });
-	
-	// thread cancellation clean-up handler
-	typedef std::tuple<std::condition_variable&, std::thread &> arg_tuple_t;
-	auto args = std::make_tuple(std::ref(term), std::ref(stat_thread));
-	pthread_cleanup_push([](void *p) {
-			auto args = *static_cast<arg_tuple_t *>(p);
-			std::get<0>(args).notify_one();
-			std::get<1>(args).join();
-		}, &args);
-	
-	while (!__in.eof()) {
-		if ((c = __in.get()) == 0xff) {
-			if ((c = __in.get()) == 0x00) { /* start of frame */
-				if (__synchronized)
-					frame_recv(parser, frame, p - frame,
-						   fra), count++;
-				__synchronized = 1, p = &frame[1];
-			} else if (c != 0xff) /* translate 'ff ff' to 'ff' */
-				__in.unget();
-		}
+	return true;
+}
 
-		if (__synchronized)
-			static_cast<unsigned>(p - frame) < ARRAY_SIZE(frame)
-				      ? *p++ = c
-				      :(__synchronized = 0, __sync_err_count++);
-	}
-	pthread_cleanup_pop(1);
+bool XR25streamreader::set_rt(const XR25rtconf &conf) {
+	__rt = conf;
+	return !conf.mlock || mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
 }
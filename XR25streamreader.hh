@@ -18,9 +18,14 @@
 
 #include <iostream>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
 #include <pthread.h>
 #include <thread>
+#include "XR25alloc.hh"
+#include "XR25rt.hh"
 
 /* XR25 frames start with 0xff 0x00; 0xff ocurrences in the frame sent on the
  * wire as 0xff 0xff.
@@ -119,50 +124,299 @@ public:
 };
 
 #define ARRAY_SIZE(_a) (unsigned int)(sizeof(_a) / sizeof(_a[0]))
-	
+
+/* Reasons for a frame not to reach the post-parse handler; see
+ * XR25streamreader::get_drop_count().
+ */
+enum XR25dropreason {
+	DROP_OVERFLOW = 0,  /* longer than the frame buffer */
+	DROP_ESCAPE,        /* 0xff followed by neither 0x00 nor 0xff */
+	DROP_LENGTH,        /* length differs from the learned frame length */
+	DROP_PARSE,         /* rejected by XR25frameparser::parse_frame() */
+	_DROP_COUNT,        // add new elements before this line
+};
+
+/* Octets per second at 62500 baud, 8N1; used to derive timestamps when
+ * replaying a capture, see tools/
+ */
+#define XR25_BYTES_PER_SEC 6250
+
+/* Number of consecutive frames of equal length required to learn (or
+ * re-learn) the frame length of the ECU.
+ */
+#define XR25_LEARN_FRAMES 8
+
+#define XR25_FRAME_BUF  128    // longest frame, header included
+#define XR25_READ_CHUNK 4096   // octets passed to feed() by read_frames()
+
 class XR25streamreader {
 private:
 	typedef std::function<void(const unsigned char[], int, XR25frame &)
 			      > post_parse_t;
 
-	std::istream     &__in;
+	std::istream     *__in;
 	std::atomic_bool __synchronized;
-	std::atomic_int  __sync_err_count, __fra_sec, __fra_count;
+	std::atomic_int  __sync_err_count, __fra_sec, __fra_count,
+		__drop_count[_DROP_COUNT], __recovered_count, __fra_length;
+	int              __learn_length, __learn_count;
+
+	/* deframer state, kept between feed() calls */
+	unsigned char    __frame[XR25_FRAME_BUF];
+	unsigned         __pos;        // octets of __frame filled
+	bool             __esc;        // last octet was a 0xff
+	unsigned         __wire;       // octets since the last header
+	std::chrono::steady_clock::time_point __t_hdr;
+	// frames per second: count since __sec_start, in ns of steady_clock
+	int              __sec_count;
+	std::atomic<long long> __sec_start;
 	post_parse_t     __post_parse;
 	std::thread      *__thrd;
+	XR25rtconf       __rt;
+	std::atomic_int  __rt_error;
+	bool             __jitter_on;
+	XR25jitter       __jitter;
 	
-	void frame_recv(XR25frameparser &parser, const unsigned char[], int
+	bool frame_recv(XR25frameparser &parser, const unsigned char[], int
 		, XR25frame &);
-	void read_frames(XR25frameparser &parser);
+	template <class _Sink>
+	void read_frames(XR25frameparser &parser, _Sink &sink);
+	void drop(XR25dropreason r) { __drop_count[r]++, __sync_err_count++; }
+	/** Account the arrival of a header in __jitter; see enable_jitter()
+	 */
+	void header_timed() {
+		auto now = std::chrono::steady_clock::now();
+		if (__t_hdr.time_since_epoch().count())
+			__jitter.add(std::chrono::duration<double>
+				     (now - __t_hdr).count(), __wire);
+		__t_hdr = now;
+	}
+	/** Account a frame passed to the sink in get_fra_per_sec()
+	 */
+	void frame_counted() {
+		const long long now = std::chrono::duration_cast
+			<std::chrono::nanoseconds>(std::chrono::steady_clock
+						   ::now().time_since_epoch())
+			.count();
+		__fra_count++, __sec_count++;
+		if (now - __sec_start.load(std::memory_order_relaxed)
+		    >= 1000000000LL) {
+			__fra_sec = __sec_count, __sec_count = 0;
+			__sec_start.store(now, std::memory_order_relaxed);
+		}
+	}
 public:
 	XR25streamreader(std::istream &s, post_parse_t p = nullptr)
-		: __in(s), __synchronized(0),
+		: XR25streamreader(p) { __in = &s; }
+	/** Construct a reader with no stream, to be driven by feed().
+	 */
+	XR25streamreader(post_parse_t p = nullptr)
+		: __in(nullptr), __synchronized(0),
 		  __sync_err_count(0), __fra_sec(0), __fra_count(0),
-		  __post_parse(p), __thrd(nullptr) {}
+		  __recovered_count(0), __fra_length(0), __learn_length(0),
+		  __learn_count(0), __frame{ 0xff, 0x00 }, __pos(0),
+		  __esc(false), __wire(0), __sec_count(0), __sec_start(0),
+		  __post_parse(p), __thrd(nullptr), __rt_error(0),
+		  __jitter_on(false) {
+		for (auto &i : __drop_count)
+			i = 0;
+	}
 	~XR25streamreader() { stop(); }
 
 	bool is_synchronized() { return __synchronized.load(); }
+	/** @return Number of dropped frames, i.e. the sum of all the
+	 *     get_drop_count() counters
+	 */
 	int  get_sync_err_count() { return __sync_err_count.load(); }
-	int  get_fra_per_sec() { return __fra_sec.load(); }
+	int  get_drop_count(XR25dropreason r) { return __drop_count[r].load(); }
+	/** @return Number of frames whose header was recovered from a
+	 *     corrupted 0xff 0x00 sequence, see feed()
+	 */
+	int  get_recovered_count() { return __recovered_count.load(); }
+	/** @return Learned frame length, including the 0xff 0x00 header, or
+	 *     0 if not learned yet
+	 */
+	int  get_frame_length() { return __fra_length.load(); }
+	/** @return Frames received in the last second; 0 if none was
+	 *     received for two seconds
+	 */
+	int  get_fra_per_sec() {
+		const long long now = std::chrono::duration_cast
+			<std::chrono::nanoseconds>(std::chrono::steady_clock
+						   ::now().time_since_epoch())
+			.count();
+		return now - __sec_start.load() > 2000000000LL
+			? 0 : __fra_sec.load();
+	}
 	int  get_fra_count() { return __fra_count.load(); }
+
+	/** Set the scheduling of the thread created by start(); call before
+	 * start().  Memory is locked (if requested) right away.
+	 * @return false if mlockall() failed; errno is set
+	 */
+	bool set_rt(const XR25rtconf &conf);
+	/** @return 0, or the errno value of applying the XR25rtconf to the
+	 *     reader thread, see set_rt()
+	 */
+	int  get_rt_error() { return __rt_error.load(); }
+
+	/** Time the arrival of frame headers; call before start() or run().
+	 */
+	void enable_jitter() { __jitter_on = true; }
+	bool is_jitter_enabled() const { return __jitter_on; }
+	const XR25jitter &get_jitter() const { return __jitter; }
+
+	/** Restore the wire form of a frame passed to a sink, which is
+	 * translated: the 0xff 0x00 header and the 0xff 0xff escapes.
+	 * @param c The frame, as passed to a sink
+	 * @param length Octets of @a c, header included
+	 * @param out Room for 2 * @a length octets
+	 * @return Octets written to @a out
+	 */
+	static size_t escape_frame(const unsigned char c[], int length,
+				   unsigned char out[]) {
+		size_t n = 0;
+		out[n++] = 0xff, out[n++] = 0x00;
+		for (int i = 2; i < length; ++i)
+			if ((out[n++] = c[i]) == 0xff)
+				out[n++] = 0xff;
+		return n;
+	}
+
+	static const char *get_drop_reason_name(XR25dropreason r) {
+		static const char *const name[_DROP_COUNT] = {
+			"overflow", "bad escape", "length", "parse" };
+		return name[r];
+	}
 	
-	/** Read frames non-blocking; call stop() to cancel thread
+	/** Read frames non-blocking; call stop() to cancel thread.  The
+	 * thread ends at once if the reader has no stream.
 	 * @param parser The XR25frameparser to use
+	 * @param sink Frame consumer, called from the internal thread; see
+	 *     XR25sink.hh.  Its type is known to read_frames(), so the call
+	 *     can be inlined.
 	 */
-	void start(XR25frameparser &parser) {
+	template <class _Sink>
+	void start(XR25frameparser &parser, _Sink sink) {
 		if (!__thrd)
-			__thrd = new std::thread([&parser, this]() {
-					this->read_frames(parser); });
+			__thrd = new std::thread([&parser, sink, this]()
+						 mutable {
+					__rt_error = __rt.apply(pthread_self());
+					if (__rt.prefault)
+						XR25rtconf::prefault_stack();
+					this->read_frames(parser, sink); });
+	}
+
+	/** Read frames non-blocking, passing them to the post-parse handler
+	 * given to the constructor; see start(parser, sink).
+	 */
+	void start(XR25frameparser &parser) {
+		start(parser, [this](const unsigned char c[], int length,
+				     XR25frame &fra) {
+			      if (__post_parse)
+				      __post_parse(c, length, fra); });
 	}
 	
-	/** Stop internal thread; see start()
+	/** Deframe the next @a n octets of the stream, which may be split at
+	 * any point (also between the two octets of a 0xff 0x00 header or of a
+	 * 0xff 0xff escape); the frames they complete are passed to @a sink.
+	 * Lets any event loop (or a test) drive the reader without a thread of
+	 * its own; do not mix with start() or run().
+	 * @param parser The XR25frameparser to use
+	 * @param c Received octets
+	 * @param n Number of octets in @a c
+	 * @param sink Frame consumer; see start()
+	 */
+	template <class _Sink>
+	void feed(XR25frameparser &parser, const unsigned char c[], size_t n,
+		  _Sink &sink);
+
+	/** Forget the frame being received, e.g. after reopening a port;
+	 * the next frame is delivered after two headers.
+	 */
+	void resync() {
+		__synchronized = 0, __esc = false;
+		__wire = 0, __t_hdr = std::chrono::steady_clock::time_point();
+	}
+
+	/** Read frames until the end of the stream in the calling thread;
+	 * returns at once if the reader has no stream.
+	 * @param parser The XR25frameparser to use
+	 * @param sink Frame consumer; see start()
+	 */
+	template <class _Sink>
+	void run(XR25frameparser &parser, _Sink sink) {
+		read_frames(parser, sink);
+	}
+
+	/** Stop internal thread; see start().  A reader driven by feed()
+	 * needs no stopping.
 	 */
 	inline void stop() {
 		if (__thrd) {
 			pthread_cancel(__thrd->native_handle()), __thrd->join();
-			delete __thrd;
+			delete __thrd, __thrd = nullptr;
 		}
 	}
 };
 
+template <class _Sink>
+void XR25streamreader::feed(XR25frameparser &parser, const unsigned char c[],
+			    size_t n, _Sink &sink) {
+	XR25frame fra{};
+	for (const unsigned char *end = c + n; c != end; ++c) {
+		unsigned char o = *c;
+		__wire++;
+		if (__esc) {
+			__esc = false;
+			/* 'ff xx' where a header is expected is taken as a
+			 * header with a corrupted 0x00 */
+			if (o != 0x00 && o != 0xff && __synchronized
+			    && __pos == static_cast<unsigned>(__fra_length))
+				o = 0x00, __recovered_count++;
+
+			if (o == 0x00) { /* start of frame */
+				XR25_ALLOC_CHECK_SCOPE("feed");
+				if (__jitter_on)
+					header_timed();
+				__wire = 0;
+				if (__synchronized && frame_recv(parser,
+						__frame, __pos, fra)) {
+					sink(__frame, __pos, fra);
+					frame_counted();
+				}
+				__synchronized = 1, __pos = 1;
+			} else if (o != 0xff) { /* 'ff ff' is 'ff' */
+				if (__synchronized)
+					__synchronized = 0, drop(DROP_ESCAPE);
+				continue;
+			}
+		} else if (o == 0xff) {
+			__esc = true;
+			continue;
+		}
+
+		if (__synchronized) {
+			if (__pos < ARRAY_SIZE(__frame))
+				__frame[__pos++] = o;
+			else
+				__synchronized = 0, drop(DROP_OVERFLOW);
+		}
+	}
+}
+
+template <class _Sink>
+void XR25streamreader::read_frames(XR25frameparser &parser, _Sink &sink) {
+	char buf[XR25_READ_CHUNK];
+	std::streamsize n;
+	if (!__in)   // constructed to be driven by feed()
+		return;
+	/* wait for an octet, then take whatever else is already buffered;
+	 * a frame is never held back waiting for a full chunk
+	 */
+	while (__in->get(buf[0])) {
+		n = 1 + __in->readsome(buf + 1, sizeof(buf) - 1);
+		feed(parser, reinterpret_cast<unsigned char *>(buf), n, sink);
+	}
+}
+
 #endif /* XR25STREAMREADER_HH */
@@ -0,0 +1,253 @@
+/* XR25trigger.cc - Capture of the frames around trigger events
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25trigger.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NO_TRIGGER    -2
+#define FAULT_TRIGGER -1
+
+static const int fault_ch[] = { CH_FAULT_FLAGS_0, CH_FAULT_FLAGS_1,
+				CH_FAULT_FLAGS_2, CH_FAULT_FLAGS_3,
+				CH_FAULT_FLAGS_4 };
+
+XR25triggercapture::XR25triggercapture()
+	: __faults(true), __size(0), __head(0), __index_size(0), __frames(0),
+	  __active(false), __missed(0), __ev_head(0), __ev_tail(0), __fd(-1),
+	  __pos(0), __lost_at_open(0), __written(0), __incomplete(0), __lost(0),
+	  __error(0), __stop(false) {
+}
+
+bool XR25triggercapture::start(const std::string &dir,
+			       const XR25ruleset &triggers, bool faults,
+			       unsigned pre_secs, unsigned post_secs) {
+	struct stat st;
+	if (stat(dir.c_str(), &st) == -1)
+		return false;
+	if (!S_ISDIR(st.st_mode) || access(dir.c_str(), W_OK) == -1)
+		return errno = S_ISDIR(st.st_mode) ? errno : ENOTDIR, false;
+
+	__dir = dir, __rules = triggers, __faults = faults;
+	__pre = std::chrono::seconds(pre_secs);
+	__post = std::chrono::seconds(post_secs);
+	/* room for both windows twice over, at the line rate and with every
+	 * octet escaped: the writer may lag by a whole event
+	 */
+	__size = 4 * (pre_secs + post_secs + 1) * XR25_BYTES_PER_SEC;
+	__ring.reset(new unsigned char[__size]);
+	__index_size = (pre_secs + 1) * XR25_MAX_FRA_PER_SEC;
+	__index.reset(new index_t[__index_size]);
+	__state.assign(__rules.size(), 0);
+	std::memset(__fault_bits, 0, sizeof(__fault_bits));
+	__head = 0, __frames = 0, __active = false;
+	__ev_head = 0, __ev_tail = 0;
+
+	__stop = false;
+	__thrd = std::thread(&XR25triggercapture::run, this);
+	return true;
+}
+
+void XR25triggercapture::stop() {
+	if (!__thrd.joinable())
+		return;
+	if (__active) {
+		__ev[(__ev_head.load() - 1) % XR25TRIGGER_EVENTS]._end
+			.store(__head.load(), std::memory_order_release);
+		__active = false;
+	}
+	{
+		std::lock_guard<std::mutex> lock(__stop_m);
+		__stop = true;
+	}
+	__stop_cv.notify_one();
+	__thrd.join();
+}
+
+void XR25triggercapture::push_bytes(const unsigned char *p, size_t n) {
+	size_t h = __head.load(std::memory_order_relaxed),
+		o = h % __size, l = std::min(n, __size - o);
+	std::memcpy(&__ring[o], p, l);
+	std::memcpy(&__ring[0], p + l, n - l);
+	__head.store(h + n, std::memory_order_release);
+}
+
+/** Evaluate the triggers on the current channels.
+ * @return The rule that fired, FAULT_TRIGGER or NO_TRIGGER
+ */
+int XR25triggercapture::fired(clock::time_point tp) {
+	// the first frame only sets the state the next ones are compared to
+	int ret = NO_TRIGGER;
+	const bool seed = __frames == 1;
+	__rules.evaluate(__ch, tp);
+	for (size_t i = 0; i < __state.size(); ++i) {
+		const bool s = __rules.get_state(i);
+		if (s && !__state[i] && !seed && ret == NO_TRIGGER)
+			ret = i;
+		__state[i] = s;
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(fault_ch); ++i) {
+		const unsigned f = static_cast<unsigned>(__ch[fault_ch[i]]);
+		if (__faults && (f & ~__fault_bits[i]) && !seed
+		    && ret == NO_TRIGGER)
+			ret = FAULT_TRIGGER;
+		__fault_bits[i] = f;
+	}
+	return ret;
+}
+
+void XR25triggercapture::frame(const unsigned char c[], int length,
+			       const XR25frame &fra, clock::time_point tp) {
+	if (!__size)
+		return;
+
+	unsigned char buf[2 * XR25_FRAME_BUF];
+	const size_t n = XR25streamreader::escape_frame(c, length, buf),
+		off = __head.load(std::memory_order_relaxed);
+	push_bytes(buf, n);
+	__index[__frames++ % __index_size] = { off, tp };
+
+	XR25channelengine::compute(fra, __ch);
+	const int trigger = fired(tp);
+	if (trigger != NO_TRIGGER && __active) {
+		__post_end = tp + __post;
+	} else if (trigger != NO_TRIGGER) {
+		const unsigned h = __ev_head.load(std::memory_order_relaxed);
+		if (h - __ev_tail.load(std::memory_order_acquire)
+		    == XR25TRIGGER_EVENTS) {
+			__missed.store(__missed.load(std::memory_order_relaxed)
+				       + 1, std::memory_order_relaxed);
+			return;
+		}
+		// the oldest frame of the pre-trigger window still in the ring
+		size_t begin = off;
+		const size_t end = off + n;
+		for (size_t k = 2; k <= std::min(__frames, __index_size); ++k) {
+			const index_t &x = __index[(__frames - k)
+						   % __index_size];
+			if (tp - x._t > __pre || end - x._off > __size / 2)
+				break;
+			begin = x._off;
+		}
+		event_t &e = __ev[h % XR25TRIGGER_EVENTS];
+		e._begin = begin, e._trigger = trigger;
+		e._end.store(SIZE_MAX, std::memory_order_relaxed);
+		e._wall = time(nullptr);
+		__ev_head.store(h + 1, std::memory_order_release);
+		__active = true, __post_end = tp + __post;
+	}
+	if (__active && tp >= __post_end) {
+		const unsigned h = __ev_head.load(std::memory_order_relaxed);
+		__ev[(h - 1) % XR25TRIGGER_EVENTS]._end.store
+			(__head.load(), std::memory_order_release);
+		__active = false;
+	}
+}
+
+/** Write the queued events, as far as received.
+ */
+void XR25triggercapture::drain() {
+	for (;;) {
+		const unsigned t = __ev_tail.load(std::memory_order_relaxed);
+		if (t == __ev_head.load(std::memory_order_acquire))
+			return;
+		event_t &e = __ev[t % XR25TRIGGER_EVENTS];
+		if (__fd == -1) {
+			char stamp[32];
+			struct tm tm;
+			strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S",
+				 localtime_r(&e._wall, &tm));
+			// events may start within the same second
+			std::string name = __dir + "/" + stamp + "-"
+				+ std::to_string(t) + "-"
+				+ (e._trigger == FAULT_TRIGGER ? "fault"
+				   : __rules.get_name(e._trigger));
+			__fd = open((name + ".bin").c_str(), O_WRONLY | O_CREAT
+				    | O_TRUNC | O_CLOEXEC, 0644);
+			if (__fd == -1)
+				__error = errno;
+			__name = name, __pos = e._begin;
+			__lost_at_open = __lost.load();
+		}
+
+		const size_t end = e._end.load(std::memory_order_acquire),
+			h = __head.load(std::memory_order_acquire);
+		if (h - __pos > __size) {   // lapped by the reader
+			const size_t kept = std::min(end, h - __size);
+			__lost += kept - __pos;
+			__pos = kept;
+		}
+		const size_t from = __pos, to = std::min(end, h);
+		while (__pos < to) {
+			size_t o = __pos % __size,
+				n = std::min(to - __pos, __size - o);
+			const unsigned char *p = &__ring[o];
+			for (size_t k = n; k && __fd != -1; ) {
+				ssize_t ret = ::write(__fd, p, k);
+				if (ret == -1 && errno == EINTR)
+					continue;
+				if (ret == -1) {
+					__error = errno;
+					break;
+				}
+				p += ret, k -= ret;
+			}
+			__pos += n;
+		}
+		// the reader may have overwritten what was being written
+		const size_t h2 = __head.load(std::memory_order_acquire);
+		if (h2 - from > __size)
+			__lost += std::min(std::max(h2 - __size, from), to)
+				- from;
+
+		if (__pos < end)
+			return;
+		if (__fd != -1) {
+			close(__fd), __written++;
+			// tell incomplete files apart
+			if (__lost.load() != __lost_at_open
+			    && rename((__name + ".bin").c_str(), (__name
+					+ "-incomplete.bin").c_str()) == 0)
+				__incomplete++;
+		}
+		__fd = -1;
+		__ev_tail.store(t + 1, std::memory_order_release);
+	}
+}
+
+void XR25triggercapture::run() {
+	std::unique_lock<std::mutex> lock(__stop_m);
+	while (!__stop_cv.wait_for(lock, std::chrono::milliseconds
+				   (XR25TRIGGER_FLUSH_MS),
+				   [this]() { return __stop; })) {
+		lock.unlock();
+		drain();
+		lock.lock();
+	}
+	lock.unlock();
+	drain();
+	if (__fd != -1)
+		close(__fd), __fd = -1;
+}
+
+void XR25triggercapture::default_triggers(XR25ruleset &r) {
+	r.add("check_engine", "out_flags & OUT_CHECK_ENGINE");
+}
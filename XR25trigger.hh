@@ -0,0 +1,163 @@
+/* XR25trigger.hh - Capture of the frames around trigger events
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25TRIGGER_HH
+#define XR25TRIGGER_HH
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "XR25channels.hh"
+#include "XR25rules.hh"
+
+#define XR25TRIGGER_PRE_SECS  30     // default pre-trigger window
+#define XR25TRIGGER_POST_SECS 30     // default post-trigger window
+#define XR25TRIGGER_EVENTS    8      // events queued to the writer thread
+#define XR25TRIGGER_FLUSH_MS  250    // writer thread period
+#define XR25TRIGGER_FILE      "xr25_diag.triggers"
+
+/** Keeps the frames of the last seconds in memory and, when a trigger
+ * fires, writes them plus those of the following seconds to a capture file
+ * of its own, <dir>/<YYYYmmdd-HHMMSS>-<n>-<trigger>.bin (<n> counts the
+ * events since start()).  Triggers are the rules of a XR25ruleset (see
+ * XR25rules.hh), e.g.
+ *     check_engine = out_flags & OUT_CHECK_ENGINE
+ *     overheat     = temp_water > 105 for 2s
+ * which fire as they become active, and optionally any fault_flags_* bit
+ * setting ("fault").  Rules active and bits set in the first frame are
+ * taken as the initial state and do not fire.  A trigger firing within the
+ * post-trigger window of an event extends it.
+ *
+ * Frames are passed on the reader thread, where they are only copied to a
+ * ring buffer and the triggers evaluated: no allocation, no locks.  A
+ * thread of its own writes the events; if it falls behind by more than the
+ * ring buffer, the overwritten data is lost and counted, see
+ * get_lost_bytes().
+ */
+class XR25triggercapture {
+public:
+	typedef std::chrono::steady_clock clock;
+private:
+	struct index_t {                 // a frame in the ring
+		size_t            _off;
+		clock::time_point _t;
+	};
+	struct event_t {
+		size_t              _begin;
+		std::atomic<size_t> _end;   // SIZE_MAX while open
+		int                 _trigger;   // -1: fault flags
+		time_t              _wall;
+	};
+
+	std::string  __dir;
+	XR25ruleset  __rules;
+	bool         __faults;
+	clock::duration __pre, __post;
+
+	/* reader thread */
+	std::unique_ptr<unsigned char[]> __ring;
+	size_t                   __size;
+	std::atomic<size_t>      __head;
+	std::unique_ptr<index_t[]> __index;
+	size_t                   __index_size, __frames;
+	std::vector<char>        __state;     // of every rule, last frame
+	unsigned                 __fault_bits[5];
+	XR25channels             __ch;
+	bool                     __active;
+	clock::time_point        __post_end;
+	std::atomic<unsigned>    __missed;
+
+	/* events, written by the reader thread, read by the writer one */
+	event_t                  __ev[XR25TRIGGER_EVENTS];
+	std::atomic<unsigned>    __ev_head, __ev_tail;
+
+	/* writer thread */
+	int                      __fd;
+	std::string              __name;      // of the file, no .bin suffix
+	size_t                   __pos, __lost_at_open;
+	std::atomic<unsigned>    __written, __incomplete;
+	std::atomic<size_t>      __lost;
+	std::atomic<int>         __error;
+	std::thread              __thrd;
+	std::mutex               __stop_m;
+	std::condition_variable  __stop_cv;
+	bool                     __stop;
+
+	void push_bytes(const unsigned char *p, size_t n);
+	int  fired(clock::time_point tp);
+	void drain();
+	void run();
+public:
+	XR25triggercapture();
+	~XR25triggercapture() { stop(); }
+
+	/** Start the writer thread; call before the first frame.
+	 * @param dir Directory of the event files
+	 * @param triggers Trigger rules; copied
+	 * @param faults Also fire when a fault flag bit sets
+	 * @param pre_secs,post_secs Seconds kept before and after a trigger
+	 * @return false if @a dir is not a writable directory; errno is set
+	 */
+	bool start(const std::string &dir, const XR25ruleset &triggers,
+		   bool faults = true, unsigned pre_secs = XR25TRIGGER_PRE_SECS,
+		   unsigned post_secs = XR25TRIGGER_POST_SECS);
+
+	/** Close the open event, write everything and join the writer
+	 * thread; the reader must be stopped first.
+	 */
+	void stop();
+
+	/** A XR25streamreader sink, see XR25sink.hh.
+	 */
+	void operator()(const unsigned char c[], int length, XR25frame &fra) {
+		frame(c, length, fra, clock::now());
+	}
+
+	/** Take a frame received at @a tp; see operator().
+	 */
+	void frame(const unsigned char c[], int length, const XR25frame &fra,
+		   clock::time_point tp);
+
+	/** @return Events written so far
+	 */
+	unsigned get_events() const { return __written.load(); }
+	/** @return Triggers ignored because XR25TRIGGER_EVENTS events were
+	 *     waiting to be written
+	 */
+	unsigned get_missed() const { return __missed.load(); }
+	/** @return Octets overwritten by the reader before they were written;
+	 *     the files of the events they belong to are renamed
+	 *     <...>-incomplete.bin
+	 */
+	size_t get_lost_bytes() const { return __lost.load(); }
+	/** @return Events written incomplete, see get_lost_bytes()
+	 */
+	unsigned get_incomplete() const { return __incomplete.load(); }
+	/** @return errno value of the last failed write/open, or 0
+	 */
+	int get_error() const { return __error.load(); }
+
+	/** Add the default triggers (check_engine) to @a r.
+	 */
+	static void default_triggers(XR25ruleset &r);
+};
+
+#endif /* XR25TRIGGER_HH */
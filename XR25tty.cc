@@ -0,0 +1,197 @@
+/* XR25tty.cc - Serial line configuration and auto-detection
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "XR25tty.hh"
+#include "XR25streamreader.hh"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <unistd.h>
+
+// octets listened to per candidate, at most; see listen()
+#define WINDOW_OCTETS 256
+/* line errors that reject a candidate before the end of its window; wrong
+ * rates cause them at once
+ */
+#define MAX_ERRORS 16
+
+typedef std::chrono::steady_clock clock_type;
+
+/* candidate rates, in the order they are tried; 62500 is that of the
+ * Fenix ECUs, 10400 that of K-line adapters
+ */
+static const unsigned rates[] = { 62500, 31250, 125000, 57600, 115200,
+				  38400, 19200, 10400, 9600 };
+
+bool XR25ttyconf::parse(const std::string &spec, XR25ttyconf &conf) {
+	unsigned baud, bits, stop;
+	char parity;
+	int n = -1;
+	if (sscanf(spec.c_str(), "%u,%1u%c%1u%n", &baud, &bits, &parity,
+		   &stop, &n) != 4 || n != static_cast<int>(spec.size()))
+		return false;
+	parity = toupper(parity);
+	if (baud == 0 || bits < 5 || bits > 8 || stop < 1 || stop > 2
+	    || (parity != 'N' && parity != 'E' && parity != 'O'))
+		return false;
+	conf.baud = baud, conf.bits = bits, conf.parity = parity;
+	conf.stop = stop;
+	return true;
+}
+
+std::string XR25ttyconf::str() const {
+	return std::to_string(baud) + "," + std::to_string(bits) + parity
+		+ std::to_string(stop);
+}
+
+int XR25ttyconf::apply(int fd) const {
+	static const tcflag_t csize[] = { CS5, CS6, CS7, CS8 };
+	struct termios2 t_io = { 0, 0, CREAD | BOTHER | csize[bits - 5],
+				 0, 0, { }, baud, baud };
+	if (parity != 'N')
+		t_io.c_iflag |= INPCK, t_io.c_cflag |= PARENB;
+	if (parity == 'O')
+		t_io.c_cflag |= PARODD;
+	if (stop == 2)
+		t_io.c_cflag |= CSTOPB;
+	t_io.c_cc[VMIN] = 1;
+	return ioctl(fd, TCSETS2, &t_io) == -1 ? errno : 0;
+}
+
+XR25ttyscore XR25ttyconf::score(const unsigned char *p, size_t n) {
+	XR25ttyscore s;
+	long len = -1, prev = -1;   // octets of the frame; -1: no header yet
+	bool esc = false;
+	for (size_t i = 0; i < n; ++i) {
+		const unsigned char c = p[i];
+		if (esc) {
+			esc = false;
+			if (c == 0x00) {
+				// two whole frames of equal length
+				if (prev >= 2 && len == prev
+				    && len <= XR25_FRAME_BUF)
+					s.consistent++;
+				prev = len, len = 2, s.frames++;
+				continue;
+			}
+			if (c == 0xff) {
+				len += len >= 0;
+				continue;
+			}
+			s.invalid += len >= 0;
+		}
+		if (c == 0xff)
+			esc = true;
+		else
+			len += len >= 0;
+	}
+	return s;
+}
+
+/** @return Framing and parity errors counted by the driver of @a fd, or 0
+ *     if it does not count them
+ */
+static unsigned line_errors(int fd) {
+	struct serial_icounter_struct ic;
+	return ioctl(fd, TIOCGICOUNT, &ic) == -1 ? 0 : ic.frame + ic.parity;
+}
+
+/** Apply @a c and score what is received for the time WINDOW_OCTETS take
+ * on the line, but no less than XR25TTY_WINDOW_MIN_MS, until @a deadline,
+ * until the candidate locks or until the driver reports more than
+ * MAX_ERRORS line errors.
+ * @return 0, or the errno value of a failure
+ */
+static int listen(int fd, const XR25ttyconf &c, clock_type::time_point
+		  deadline, XR25ttyscore &s) {
+	if (int err = c.apply(fd))
+		return err;
+	ioctl(fd, TCFLSH, TCIFLUSH);
+	const unsigned errors = line_errors(fd),
+		bits = 1 + c.bits + (c.parity != 'N') + c.stop,
+		ms = std::max<unsigned>(XR25TTY_WINDOW_MIN_MS, WINDOW_OCTETS
+					* bits * 1000ULL / c.baud);
+	const auto end = std::min(deadline, clock_type::now()
+				  + std::chrono::milliseconds(ms));
+
+	unsigned char buf[4 * WINDOW_OCTETS];
+	size_t n = 0;
+	s = XR25ttyscore();
+	for (auto now = clock_type::now(); now < end && n < sizeof(buf)
+		     && !s.locked() && s.errors <= MAX_ERRORS;
+	     now = clock_type::now()) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int ret = poll(&pfd, 1, std::chrono::duration_cast
+			       <std::chrono::milliseconds>(end - now).count()
+			       + 1);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1)
+			return errno;
+		if (ret == 0)
+			break;
+		ssize_t k = read(fd, buf + n, sizeof(buf) - n);
+		if (k == -1 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (k <= 0)
+			return k ? errno : EIO;
+		n += k;
+		s = XR25ttyconf::score(buf, n);
+		s.errors = line_errors(fd) - errors;
+	}
+	s.errors = line_errors(fd) - errors;
+	return 0;
+}
+
+int XR25ttyconf::detect(int fd, XR25ttyconf &conf, unsigned max_ms) {
+	const auto deadline = clock_type::now()
+		+ std::chrono::milliseconds(max_ms);
+	std::vector<XR25ttyconf> cand(1, conf);
+	for (char p : { 'N', 'E', 'O' })
+		for (auto r : rates)
+			if (r != conf.baud || p != conf.parity || conf.bits != 8
+			    || conf.stop != 1)
+				cand.emplace_back(r, p);
+
+	XR25ttyconf best = conf;
+	XR25ttyscore best_s;
+	for (size_t i = 0; i < cand.size()
+		     && clock_type::now() < deadline; ++i) {
+		XR25ttyscore s;
+		int err = listen(fd, cand[i], deadline, s);
+		if (err == ENOTTY)
+			return err;
+		if (err == EINVAL)   // rate not supported by the driver
+			continue;
+		if (err)
+			return err;
+		if (s.value() > best_s.value())
+			best = cand[i], best_s = s;
+		if (s.locked())
+			break;
+	}
+
+	if (best_s.value() > 0)
+		conf = best;
+	int err = conf.apply(fd);
+	return err ? err : best_s.value() > 0 ? 0 : EAGAIN;
+}
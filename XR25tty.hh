@@ -0,0 +1,98 @@
+/* XR25tty.hh - Serial line configuration and auto-detection
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef XR25TTY_HH
+#define XR25TTY_HH
+
+#include <cstddef>
+#include <string>
+
+#define XR25TTY_DETECT_MS   2000  // give up auto-detection after this
+#define XR25TTY_LOCK_FRAMES 4     // consistent frames that lock a candidate
+#define XR25TTY_WINDOW_MIN_MS 30  // shortest time listened per candidate
+
+/* Result of listening to a serial line, see XR25ttyconf::score().
+ */
+struct XR25ttyscore {
+	unsigned frames;      // headers seen
+	unsigned consistent;  // frames as long as the previous one
+	unsigned invalid;     // 0xff followed by neither 0x00 nor 0xff
+	unsigned errors;      // framing/parity errors reported by the driver
+
+	XR25ttyscore() : frames(0), consistent(0), invalid(0), errors(0) { }
+
+	/** @return Whether the line carries XR25 frames beyond doubt
+	 */
+	bool locked() const {
+		return consistent >= XR25TTY_LOCK_FRAMES && !invalid
+			&& !errors; }
+	/** @return Goodness of the candidate; <= 0 if no frames were seen
+	 */
+	int value() const {
+		return consistent - 4 * invalid - errors; }
+};
+
+/* Serial line settings, as in the "Serial configuration" entry of the
+ * configuration dialog: "<baud>,<character size><parity><stop bits>", e.g.
+ * "62500,8N1".
+ */
+struct XR25ttyconf {
+	unsigned baud;
+	unsigned bits;        // 5-8
+	char     parity;      // 'N', 'E' or 'O'
+	unsigned stop;        // 1 or 2
+
+	XR25ttyconf() : baud(62500), bits(8), parity('N'), stop(1) { }
+	XR25ttyconf(unsigned b, char p) : baud(b), bits(8), parity(p),
+					 stop(1) { }
+
+	/** Parse @a spec, e.g. "62500,8N1" or "10400,8E1"; the baud rate
+	 * need not be a standard one.
+	 * @return false if @a spec is malformed
+	 */
+	static bool parse(const std::string &spec, XR25ttyconf &conf);
+
+	std::string str() const;
+
+	/** Set the line of @a fd (raw, VMIN 1) with termios2; see
+	 * ioctl_tty(2).
+	 * @return 0, or the errno value of the failure; ENOTTY if @a fd is
+	 *     not a terminal, e.g. a pipe (see pipe_to_stdin.sh)
+	 */
+	int apply(int fd) const;
+
+	/** Rate @a n octets received: count the headers (0xff 0x00) and the
+	 * frames as long as the previous one, after escapes are removed, and
+	 * the octets breaking the escaping rule after the first header.
+	 */
+	static XR25ttyscore score(const unsigned char *p, size_t n);
+
+	/** Find the settings of the line of @a fd: listen to every candidate
+	 * rate at 8N1, then with even and odd parity; a candidate that shows
+	 * XR25TTY_LOCK_FRAMES consistent frames and no line error is taken at
+	 * once, otherwise the best scored one.  Octets received meanwhile are
+	 * discarded.  @a fd may be non-blocking.
+	 * @param conf Tried first; set to the best candidate, or left alone
+	 *     if none showed frames
+	 * @param max_ms Time limit
+	 * @return 0 if frames were found; ENOTTY if @a fd is not a terminal;
+	 *     EAGAIN if no candidate showed frames (@a conf is applied);
+	 *     the errno value of another failure
+	 */
+	static int detect(int fd, XR25ttyconf &conf,
+			  unsigned max_ms = XR25TTY_DETECT_MS);
+};
+
+#endif /* XR25TTY_HH */
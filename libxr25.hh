@@ -0,0 +1,38 @@
+/* libxr25.hh - GTK-free XR25 decoding library (libxr25.a)
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef LIBXR25_HH
+#define LIBXR25_HH
+
+/* Everything needed to decode, validate and analyse XR25 frame streams
+ * without a display; link with libxr25.a, -pthread and -lz.  None of these
+ * headers include gtkmm.
+ */
+#include "XR25streamreader.hh"
+#include "XR25sink.hh"
+#include "XR25channels.hh"
+#include "XR25rules.hh"
+#include "XR25capture.hh"
+#include "XR25history.hh"
+#include "XR25flightrec.hh"
+#include "XR25rt.hh"
+#include "XR25charts.hh"
+#include "XR25colstore.hh"
+#include "XR25merge.hh"
+#include "XR25trigger.hh"
+#include "XR25tty.hh"
+#include "ParserFactory.hh"
+
+#endif /* LIBXR25_HH */
@@ -13,19 +13,25 @@
  * GNU General Public License for more details.
  */
 
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <regex>
+#include <set>
 #include <gtkmm.h>
-#include <asm/termbits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/ioctl.h>
+#include <sys/inotify.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
 #include "XR25streamreader.hh"
 #include "ParserFactory.hh"
+#include "XR25rules.hh"
+#include "XR25capture.hh"
+#include "XR25flightrec.hh"
+#include "XR25trigger.hh"
+#include "XR25tty.hh"
 #include "UI.hh"
 #include "tee_stdio_filebuf.hh"
 
@@ -34,21 +40,57 @@ struct ParamsStruct {
 	Glib::ustring parser_t;    /* parser class typename */
 	Glib::ustring tty_conf;    /* serial port configuration; string format:
 				    * <baud>,<character size><parity><stop bits>
-				    * e.g., 62500,8N1 */
+				    * e.g., 62500,8N1, or 'auto'; see
+				    * XR25tty.hh */
 	Glib::ustring save_pathname;   /* pathname of a file to write received
 					* frames to */
+	Glib::ustring save_rotate;     /* rotation; see XR25capturewriter::
+					* parse_rotate() */
+	bool          save_compress;   /* gzip-compress saved data */
 };
 
+#define DEV_PATH "/dev/"
+
+/** @return Whether @a name is the name of a serial port device, i.e.
+ *     tty{S,ACM,USB}<n>, or 'stdin'
+ */
+static bool is_port_name(const char *name) {
+	static const char *const prefix[] = { "ttyS", "ttyACM", "ttyUSB" };
+	if (std::strcmp(name, "stdin") == 0)
+		return true;
+	for (auto p : prefix) {
+		size_t l = std::strlen(p);
+		if (std::strncmp(name, p, l) == 0 && name[l] != '\0'
+		    && name[l + std::strspn(name + l, "0123456789")] == '\0')
+			return true;
+	}
+	return false;
+}
+
+/** Fill a combo box with a set of device names; keeps the active device if
+ * still present.
+ */
+static void set_port_list(Gtk::ComboBoxText *cb,
+			  const std::set<std::string> &ports) {
+	Glib::ustring active = cb->get_active_text();
+	cb->remove_all();
+	for (auto &i : ports)
+		cb->append(DEV_PATH + i);
+	cb->set_active_text(active);
+	if (cb->get_active_row_number() == -1)
+		cb->set_active(0);
+}
+
 /** Get port configuration from user.
  * @param b Gtk::Builder object to use; 'conf_dialog' is a GtkDialog req-
  *     uesting configuration from user
  * @param params Returned parameters struct
  */
 bool get_port_conf(Glib::RefPtr<Gtk::Builder> b, ParamsStruct &params) {
-#define DEV_PATH "/dev/"
 	Gtk::Dialog *conf_dialog;
 	Gtk::ComboBoxText *dev_path, *parser_t;
-	Gtk::Entry        *tty_conf, *save_pathname;
+	Gtk::Entry        *tty_conf, *save_pathname, *save_rotate;
+	Gtk::CheckButton  *save_compress;
 	Gtk::Button       *save_as;
 	b->get_widget("conf_dialog", conf_dialog);
 	b->get_widget("cd_dev_path", dev_path);
@@ -56,16 +98,49 @@ bool get_port_conf(Glib::RefPtr<Gtk::Builder> b, ParamsStruct &params) {
 	b->get_widget("cd_tty_conf", tty_conf);
 	b->get_widget("cd_save_pathname", save_pathname);
 	b->get_widget("cd_save_as",       save_as);
+	b->get_widget("cd_save_rotate",   save_rotate);
+	b->get_widget("cd_save_compress", save_compress);
+	UI::startup_mark_on_draw(*conf_dialog, "configuration dialog drawn");
 	
+	/* /dev is listed once; devices plugged or removed while the dialog is
+	 * shown are reported by inotify
+	 */
+	std::set<std::string> ports;
+	int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ifd != -1 && inotify_add_watch(ifd, DEV_PATH, IN_CREATE
+					   | IN_DELETE) == -1)
+		close(ifd), ifd = -1;
 	DIR *dirp = opendir(DEV_PATH);
-	struct dirent *dirent;
-	for (std::regex re("tty(S|ACM|USB)[0-9]+|stdin");
-	     (dirent = readdir(dirp)) || closedir(dirp); ) {
-		std::string d_name(dirent->d_name);
-		if (std::regex_match(d_name, re))
-			dev_path->append(DEV_PATH + d_name);
-	}
-	dev_path->set_active(0);
+	for (struct dirent *dirent; dirp && (dirent = readdir(dirp)); )
+		if (is_port_name(dirent->d_name))
+			ports.insert(dirent->d_name);
+	if (dirp)
+		closedir(dirp);
+	set_port_list(dev_path, ports);
+
+	sigc::connection dev_watch;
+	if (ifd != -1)
+		dev_watch = Glib::signal_io().connect([ifd,dev_path,&ports]
+						      (Glib::IOCondition) {
+			alignas(struct inotify_event) char buf[4096];
+			bool changed = false;
+			for (ssize_t n; (n = read(ifd, buf, sizeof(buf))) > 0; )
+				for (char *p = buf; p < buf + n; ) {
+					auto ev = reinterpret_cast
+						<struct inotify_event *>(p);
+					if (ev->len && is_port_name(ev->name)) {
+						if (ev->mask & IN_CREATE)
+							ports.insert(ev->name);
+						else
+							ports.erase(ev->name);
+						changed = true;
+					}
+					p += sizeof(*ev) + ev->len;
+				}
+			if (changed)
+				set_port_list(dev_path, ports);
+			return true;
+		}, ifd, Glib::IO_IN);
 
 	for (auto &i : ParserFactory::get_registered_types())
 		parser_t->append(i.first);
@@ -82,39 +157,153 @@ bool get_port_conf(Glib::RefPtr<Gtk::Builder> b, ParamsStruct &params) {
 		});
 	int ret = conf_dialog->run();
 	conf_dialog->hide();
+	if (ifd != -1)
+		dev_watch.disconnect(), close(ifd);
 
 	return ({ params.dev_path = dev_path->get_active_text();
 		params.parser_t = parser_t->get_active_text();
 		params.tty_conf = tty_conf->get_text();
-		params.save_pathname = save_pathname->get_text(); })
+		params.save_pathname = save_pathname->get_text();
+		params.save_rotate = save_rotate->get_text();
+		params.save_compress = save_compress->get_active(); })
 		, ret == Gtk::RESPONSE_OK;
 }
 
 /** Serial port setup.
  * @param fd File descriptor
- * @param conf Serial port configuration; ignored, defaults to &quot;
- *     62500,8N1&quot;
+ * @param conf Serial port configuration; if @a detect, tried first
+ * @param detect Find the configuration, see XR25ttyconf::detect()
+ * @return 0, or the errno value of the failure; a non-terminal @a fd (e.g.
+ *     stdin, see pipe_to_stdin.sh) is left alone
  */
-void ttyS_init(int fd, Glib::ustring conf) {
-	struct termios2 t_io = { 0, 0, CREAD | BOTHER | CS8,
-				 0, 0, { }, 62500, 62500 };
-	t_io.c_cc[VMIN] = 1;
-	ioctl(fd, TCSETS2, &t_io);
+int ttyS_init(int fd, XR25ttyconf &conf, bool detect) {
+	int err = detect ? XR25ttyconf::detect(fd, conf) : conf.apply(fd);
+	if (detect && err == EAGAIN)
+		fprintf(stderr, "xr25_diag: no frames received, using %s\n",
+			conf.str().c_str()), err = 0;
+	else if (detect && !err)
+		fprintf(stderr, "xr25_diag: detected %s\n", conf.str().c_str());
 	// O_NDELAY open() flag disables blocking mode for I/O; reenable
 	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	return err == ENOTTY ? 0 : err;
+}
+
+/** Open the flight recorder (see XR25flightrec.hh), unless disabled.  The
+ * file is XR25_DIAG_FLIGHTREC, if set (an empty value disables it), or
+ * $XDG_CACHE_HOME/xr25_diag/flightrec; it keeps the last
+ * XR25_DIAG_FLIGHTREC_MIN minutes (default: XR25FLIGHTREC_MINUTES).
+ * @return false if disabled or on error
+ */
+static bool flightrec_open(XR25flightrecorder &rec) {
+	const char *env = getenv("XR25_DIAG_FLIGHTREC"),
+		*min = getenv("XR25_DIAG_FLIGHTREC_MIN");
+	std::string path = env ? env : Glib::build_filename
+		(Glib::get_user_cache_dir(), "xr25_diag", "flightrec");
+	unsigned minutes = min ? std::atoi(min) : XR25FLIGHTREC_MINUTES;
+
+	if (path.empty() || minutes == 0)
+		return false;
+	if (!env)
+		g_mkdir_with_parents(Glib::path_get_dirname(path).c_str(),
+				     0755);
+	if (!rec.open(path, XR25flightrecorder::size_for_minutes(minutes))) {
+		fprintf(stderr, "xr25_diag: flight recorder %s: %s\n",
+			path.c_str(), g_strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/** Start the triggered capture (see XR25trigger.hh) if XR25_DIAG_TRIGGER_DIR
+ * names a directory.  Triggers are read from XR25TRIGGER_FILE, if present,
+ * or are the defaults; fault flag bits setting always fire.
+ * XR25_DIAG_TRIGGER_SECS holds the seconds kept before and after a trigger,
+ * e.g. "20,60" (default: XR25TRIGGER_PRE_SECS, XR25TRIGGER_POST_SECS).
+ * @return false if disabled or on error
+ */
+static bool trigger_open(XR25triggercapture &trig) {
+	const char *dir = getenv("XR25_DIAG_TRIGGER_DIR"),
+		*secs = getenv("XR25_DIAG_TRIGGER_SECS");
+	unsigned pre = XR25TRIGGER_PRE_SECS, post = XR25TRIGGER_POST_SECS;
+	XR25ruleset triggers;
+
+	if (!dir || !*dir)
+		return false;
+	if (secs && sscanf(secs, "%u,%u", &pre, &post) != 2) {
+		fprintf(stderr, "xr25_diag: invalid XR25_DIAG_TRIGGER_SECS "
+			"'%s'\n", secs);
+		return false;
+	}
+	try {
+		if (!triggers.load_file(XR25TRIGGER_FILE))
+			XR25triggercapture::default_triggers(triggers);
+	} catch (const XR25rule_error &err) {
+		fprintf(stderr, "xr25_diag: %s\n", err.what());
+		return false;
+	}
+	if (!trig.start(dir, triggers, true, pre, post)) {
+		fprintf(stderr, "xr25_diag: trigger directory %s: %s\n", dir,
+			g_strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/** Configure the reader thread from the environment: XR25_DIAG_RT holds an
+ * XR25rtconf specification (e.g. "fifo=50,cpu=1,mlock,prefault"); if
+ * XR25_DIAG_JITTER is set, the arrival of frames is timed.
+ * @return Whether the jitter report is to be written at exit
+ */
+static bool rt_setup(XR25streamreader &reader) {
+	const char *rt = getenv("XR25_DIAG_RT"),
+		*jitter = getenv("XR25_DIAG_JITTER");
+	XR25rtconf conf;
+
+	if (rt && !XR25rtconf::parse(rt, conf))
+		fprintf(stderr, "xr25_diag: invalid XR25_DIAG_RT '%s'\n", rt);
+	else if (rt && !reader.set_rt(conf))
+		fprintf(stderr, "xr25_diag: mlockall: %s\n",
+			g_strerror(errno));
+	if (jitter)
+		reader.enable_jitter();
+	return jitter;
 }
 
 int main(int argc, char *argv[]) {
 	auto application = Gtk::Application::create(argc, argv,
 						    "com.github.xr25_diag");
-	Glib::RefPtr<Gtk::Builder> builder = Gtk::Builder::create_from_file
-		("xr25_diag.glade");
+	/* only the configuration dialog is built before it is shown; the
+	 * main window is added to the builder afterwards
+	 */
+	Glib::RefPtr<Gtk::Builder> builder = Gtk::Builder::create_from_resource
+		(UI_RESOURCE, "conf_dialog");
 	ParamsStruct params;
-	std::filebuf ob;
+	XR25ruleset  rules;
 	
+	try {
+		rules.load_file("xr25_diag.rules");
+	} catch (const XR25rule_error &err) {
+		Gtk::MessageDialog e("Invalid rules file", /* use_markup= */ 0,
+				     Gtk::MESSAGE_ERROR);
+		e.set_secondary_text(err.what()), e.run();
+		return EXIT_FAILURE;
+	}
 	if (!get_port_conf(builder, params))
 		return EXIT_SUCCESS;
+	UI::startup_mark("port configured");
+	builder->add_from_resource(UI_RESOURCE, "main_window");
 
+	XR25ttyconf tty;
+	const bool detect = params.tty_conf == "auto";
+	if (!detect && !XR25ttyconf::parse(params.tty_conf, tty)) {
+		Gtk::MessageDialog e("Invalid serial configuration: "
+				     + params.tty_conf, /* use_markup= */ 0,
+				     Gtk::MESSAGE_ERROR);
+		e.set_secondary_text("Expected <baud>,<character size><parity>"
+				     "<stop bits> (e.g. 62500,8N1) or auto");
+		e.run();
+		return EXIT_FAILURE;
+	}
 	int fd = open(params.dev_path.c_str(), O_RDWR | O_NOCTTY
 		      | O_NDELAY /* don't wait DCD signal */);
 	if (fd == -1) {
@@ -124,16 +313,69 @@ int main(int argc, char *argv[]) {
 		e.set_secondary_text(err_str), e.run();
 		return EXIT_FAILURE;
 	}
-	ttyS_init(fd, params.tty_conf);
+	if (int err = ttyS_init(fd, tty, detect)) {
+		Gtk::MessageDialog e("Cannot configure " + params.dev_path,
+				     /* use_markup= */ 0, Gtk::MESSAGE_ERROR);
+		e.set_secondary_text(g_strerror(err)), e.run();
+		return EXIT_FAILURE;
+	}
 
-	if (!params.save_pathname.empty())
-		ob.open(params.save_pathname, std::ios_base::out);
-	std::unique_ptr<__gnu_cxx::stdio_filebuf<char> > filebuf(ob.is_open()
-		   ? new tee_stdio_filebuf<char>(fd, std::ios_base::in, ob)
-		   : new __gnu_cxx::stdio_filebuf<char>(fd, std::ios_base::in));
+	/* received data is queued to the capture writer thread; reading
+	 * from the port never waits for the disk
+	 */
+	size_t rotate_bytes;
+	unsigned rotate_secs;
+	if (!XR25capturewriter::parse_rotate(params.save_rotate, rotate_bytes,
+					     rotate_secs)) {
+		Gtk::MessageDialog e("Invalid rotation: " + params.save_rotate,
+				     /* use_markup= */ 0, Gtk::MESSAGE_ERROR);
+		e.set_secondary_text("Expected a size (e.g. 64M) and/or a "
+				     "duration (e.g. 30min, 1h)"), e.run();
+		return EXIT_FAILURE;
+	}
+	XR25capturewriter capture(params.save_pathname, rotate_bytes,
+				  rotate_secs, params.save_compress);
+	if (!params.save_pathname.empty() && !capture.start()) {
+		const char *err_str = g_strerror(errno);
+		Gtk::MessageDialog e("Cannot write " + params.save_pathname,
+				     /* use_markup= */ 0, Gtk::MESSAGE_ERROR);
+		e.set_secondary_text(err_str), e.run();
+		return EXIT_FAILURE;
+	}
+	std::unique_ptr<__gnu_cxx::stdio_filebuf<char> > filebuf(
+		params.save_pathname.empty()
+		? new __gnu_cxx::stdio_filebuf<char>(fd, std::ios_base::in)
+		: new tee_stdio_filebuf<char, XR25capturewriter>
+			(fd, std::ios_base::in, capture));
 	std::istream is(filebuf.get());
 
-	UI(application, builder, is, *ParserFactory::create(params.parser_t))
-		.run();
+	// outlive 'ui', whose destructor stops the reader thread
+	XR25flightrecorder flightrec;
+	XR25triggercapture trigger;
+	UI ui(application, builder, is, *ParserFactory::create(params.parser_t),
+	      rules);
+	if (flightrec_open(flightrec))
+		ui.add_sink([&flightrec](const unsigned char c[], int length,
+					 XR25frame &) {
+				    flightrec.record(c, length); });
+	if (trigger_open(trigger))
+		ui.add_sink(std::ref(trigger));
+	const bool jitter = rt_setup(ui.get_reader());
+	ui.run();
+	if (int err = ui.get_reader().get_rt_error())
+		fprintf(stderr, "xr25_diag: real-time scheduling: %s\n",
+			g_strerror(err));
+	if (jitter)
+		ui.get_reader().get_jitter().print(std::cerr);
+	ui.get_reader().stop(), trigger.stop();
+	if (trigger.get_missed() || trigger.get_incomplete())
+		fprintf(stderr, "xr25_diag: triggered capture: %u event(s) "
+			"written, %u incomplete (%zu octets lost), %u "
+			"missed\n", trigger.get_events(),
+			trigger.get_incomplete(), trigger.get_lost_bytes(),
+			trigger.get_missed());
+	if (int err = trigger.get_error())
+		fprintf(stderr, "xr25_diag: triggered capture: %s\n",
+			g_strerror(err));
 	return EXIT_SUCCESS;
 }
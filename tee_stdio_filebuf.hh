@@ -15,11 +15,16 @@
 
 #include <ext/stdio_filebuf.h>
 
-template<typename _CharT, typename _Traits = std::char_traits<_CharT> >
+/* _Sink is any type providing write(const _CharT *, size_t), e.g.
+ * XR25capturewriter; it is called on the reading thread, so it should not
+ * block.
+ */
+template<typename _CharT, typename _Sink,
+	 typename _Traits = std::char_traits<_CharT> >
 class tee_stdio_filebuf : public __gnu_cxx::stdio_filebuf<_CharT, _Traits> {
 protected:
 	typedef __gnu_cxx::stdio_filebuf<_CharT, _Traits> filebuf_type;
-	std::ostream __out;
+	_Sink &__out;
 
 	typename filebuf_type::int_type underflow() {
 		auto ret = filebuf_type::underflow();
@@ -32,15 +37,15 @@ public:
 	/**
 	 *  @param  __fd  An open file descriptor.
 	 *  @param  __mode  Same meaning as in a standard filebuf.
-	 *  @param  __obuf The std::basic_filebuf to write if a read from this
-	 *      filebuf is attempted
+	 *  @param  __sink The _Sink to write if a read from this filebuf is
+	 *      attempted
 	 *
 	 *  This constructor associates a file stream buffer with an open
 	 *  POSIX file descriptor; a read from this filebuf will cause the read
-	 *  buffer to be written to __obuf. The file descriptor will be
+	 *  buffer to be written to __sink. The file descriptor will be
 	 *  automatically closed when the stdio_filebuf is closed/destroyed.
 	 */
 	tee_stdio_filebuf(int __fd, std::ios_base::openmode __mode,
-			  std::basic_filebuf<_CharT, _Traits> &__obuf)
-		: filebuf_type(__fd, __mode), __out(&__obuf) { }
+			  _Sink &__sink)
+		: filebuf_type(__fd, __mode), __out(__sink) { }
 };
@@ -0,0 +1,312 @@
+/* xr25_compare.cc - Compare two sessions at the same operating points
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "libxr25.hh"
+#include "XR25pool.hh"
+
+#define TEMP_BANDS   4       // see temp_edge
+#define BINS         (XR25_RPM_BANDS * XR25_MAP_BANDS * TEMP_BANDS)
+#define CMP_MAX_FIELDS 8
+#define RUN_SECS     1.0     // longest run averaged into one sample
+#define RUN_MIN_SECS 0.2     // shorter runs (transients) are ignored
+
+// temp_water (C) band boundaries: cold, warming up, normal, hot
+static const double temp_edge[TEMP_BANDS - 1] = { 40, 70, 90 };
+
+/* Mean and variance by Welford's method; merge() combines two sets of
+ * samples (Chan et al.), so that partial results can be added in any order.
+ */
+struct moments_t {
+	unsigned long n;
+	double        mean, m2;
+
+	void add(double x) {
+		double d = x - mean;
+		mean += d / ++n;
+		m2 += d * (x - mean);
+	}
+	void merge(const moments_t &o) {
+		if (!o.n)
+			return;
+		double d = o.mean - mean;
+		unsigned long t = n + o.n;
+		mean += d * o.n / t;
+		m2 += o.m2 + d * d * n * o.n / t;
+		n = t;
+	}
+	double var() const { return n > 1 ? m2 / (n - 1) : 0; }
+};
+
+/* Per-bin statistics of one side; the size does not depend on the length
+ * of the sessions.  Samples are the means of runs of frames in the same bin
+ * (at most RUN_SECS long): consecutive frames are strongly correlated, and
+ * counting each of them as a sample would overstate the significance.
+ */
+struct side_t {
+	unsigned      sessions;
+	unsigned long frames, dropped;
+	double        seconds, bin_seconds[BINS];
+	moments_t     m[BINS][CMP_MAX_FIELDS];
+
+	side_t() { std::memset(this, 0, sizeof(*this)); }
+
+	void merge(const side_t &o) {
+		sessions += o.sessions;
+		frames += o.frames, dropped += o.dropped;
+		seconds += o.seconds;
+		for (int i = 0; i < BINS; ++i) {
+			bin_seconds[i] += o.bin_seconds[i];
+			for (int j = 0; j < CMP_MAX_FIELDS; ++j)
+				m[i][j].merge(o.m[i][j]);
+		}
+	}
+};
+
+static int bin_of(const XR25channels &ch) {
+	int t = 0;
+	while (t < TEMP_BANDS - 1 && ch[CH_TEMP_WATER] >= temp_edge[t])
+		t++;
+	return (t * XR25_MAP_BANDS + XR25map_band(ch)) * XR25_RPM_BANDS
+		+ XR25rpm_band(ch);
+}
+
+/** Accumulate a capture into @a s; a single streaming pass.
+ * @return false if the file could not be read
+ */
+static bool accumulate(const std::string &path, const std::string &parser_t,
+		       const std::vector<int> &fields, side_t &s) {
+	XR25channels ch;
+	const size_t nf = fields.size();
+	double t = 0;   // start of the frame
+	// the current run
+	int run_bin = -1;
+	double run_secs = 0, run_sum[CMP_MAX_FIELDS];
+	unsigned run_n[CMP_MAX_FIELDS];
+
+	auto flush = [&]() {
+		if (run_bin >= 0 && run_secs >= RUN_MIN_SECS)
+			for (size_t i = 0; i < nf; ++i)
+				if (run_n[i])
+					s.m[run_bin][i].add(run_sum[i]
+							    / run_n[i]);
+		run_bin = -1;
+	};
+	auto add = [&](double t_end, XR25frame &fra) {
+		double dt = t_end - t;
+		t = t_end;
+		XR25channelengine::compute(fra, ch);
+		int b = bin_of(ch);
+		s.frames++, s.seconds += dt;
+		s.bin_seconds[b] += dt;
+
+		if (b != run_bin || run_secs >= RUN_SECS) {
+			flush();
+			run_bin = b, run_secs = 0;
+			std::fill_n(run_sum, nf, 0);
+			std::fill_n(run_n, nf, 0);
+		}
+		run_secs += dt;
+		for (size_t i = 0; i < nf; ++i) {
+			double v = ch[fields[i]];
+			if (!std::isnan(v))
+				run_sum[i] += v, run_n[i]++;
+		}
+	};
+	XR25capturestats stats;
+	if (!XR25capture_decode(path, parser_t, add, stats))
+		return perror(path.c_str()), false;
+	flush();
+	s.sessions = 1;
+	s.dropped = stats.dropped;
+	return true;
+}
+
+static void print_side(const char *title, const side_t &s) {
+	printf("== %s: %u session(s), %.1f min, %lu frames, %lu dropped\n",
+	       title, s.sessions, s.seconds / 60, s.frames, s.dropped);
+}
+
+static std::string band_name(int i, int width, int n) {
+	char buf[32];
+	if (i == n - 1)
+		snprintf(buf, sizeof(buf), "%d-", i * width);
+	else
+		snprintf(buf, sizeof(buf), "%d-%d", i * width, (i + 1) * width);
+	return buf;
+}
+
+static std::string temp_name(int t) {
+	char buf[32];
+	if (t == 0)
+		snprintf(buf, sizeof(buf), "<%g", temp_edge[0]);
+	else if (t == TEMP_BANDS - 1)
+		snprintf(buf, sizeof(buf), ">=%g", temp_edge[t - 1]);
+	else
+		snprintf(buf, sizeof(buf), "%g-%g", temp_edge[t - 1],
+			 temp_edge[t]);
+	return buf;
+}
+
+/** Print the bins where the means of a field differ by Welch's t-test,
+ * most significant first.
+ */
+static void print_diff(const side_t &a, const side_t &b,
+		       const std::vector<int> &fields, double min_t,
+		       unsigned min_n, unsigned top) {
+	struct diff_t { int bin; size_t f; double t; };
+	std::vector<diff_t> d;
+	for (int i = 0; i < BINS; ++i)
+		for (size_t j = 0; j < fields.size(); ++j) {
+			const moments_t &x = a.m[i][j], &y = b.m[i][j];
+			if (x.n < min_n || y.n < min_n)
+				continue;
+			double se = std::sqrt(x.var() / x.n + y.var() / y.n),
+				diff = y.mean - x.mean;
+			double t = se > 0 ? diff / se
+				: diff != 0 ? copysign(HUGE_VAL, diff) : 0;
+			if (std::fabs(t) >= min_t)
+				d.push_back({ i, j, t });
+		}
+	std::sort(d.begin(), d.end(), [](const diff_t &x, const diff_t &y) {
+			return std::fabs(x.t) > std::fabs(y.t); });
+	if (d.size() > top)
+		d.resize(top);
+
+	printf("%zu difference(s) with |t| >= %g, at least %u samples "
+	       "(runs of up to %g s) per side\n", d.size(), min_t, min_n,
+	       RUN_SECS);
+	if (d.empty())
+		return;
+	printf("%-10s %-9s %-7s %-13s %-18s %21s %21s %9s %7s\n", "rpm",
+	       "MAP", "temp_C", "A/B time (s)", "channel", "A mean+-sd (n)",
+	       "B mean+-sd (n)", "B-A", "t");
+	for (auto &i : d) {
+		const moments_t &x = a.m[i.bin][i.f], &y = b.m[i.bin][i.f];
+		const int r = i.bin % XR25_RPM_BANDS,
+			m = i.bin / XR25_RPM_BANDS % XR25_MAP_BANDS,
+			t = i.bin / XR25_RPM_BANDS / XR25_MAP_BANDS;
+		char secs[32], sx[32], sy[32];
+		snprintf(secs, sizeof(secs), "%.0f/%.0f", a.bin_seconds[i.bin],
+			 b.bin_seconds[i.bin]);
+		snprintf(sx, sizeof(sx), "%.2f+-%.2f (%lu)", x.mean,
+			 std::sqrt(x.var()), x.n);
+		snprintf(sy, sizeof(sy), "%.2f+-%.2f (%lu)", y.mean,
+			 std::sqrt(y.var()), y.n);
+		printf("%-10s %-9s %-7s %-13s %-18s %21s %21s %9.2f %7.1f\n",
+		       band_name(r, XR25_RPM_BAND, XR25_RPM_BANDS).c_str(),
+		       band_name(m, XR25_MAP_BAND, XR25_MAP_BANDS).c_str(),
+		       temp_name(t).c_str(), secs,
+		       XR25channel_name[fields[i.f]], sx, sy, y.mean - x.mean,
+		       i.t);
+	}
+}
+
+/** Parse a comma-separated list of channel names.
+ * @return false if a name is unknown or there are too many
+ */
+static bool parse_fields(const std::string &spec, std::vector<int> &out) {
+	std::istringstream ss(spec);
+	for (std::string name; std::getline(ss, name, ','); ) {
+		int ch = XR25channel_lookup(name);
+		if (ch < 0 || out.size() == CMP_MAX_FIELDS)
+			return fprintf(stderr, "%s: bad field\n",
+				       name.c_str()), false;
+		out.push_back(ch);
+	}
+	return !out.empty();
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-p parser] [-j threads] [-f fields] "
+		"[-t min_t] [-m min_samples]\n       [-n top] before after\n"
+		"Bin both sides by operating point (rpm x MAP x temp_water) "
+		"and list the bins\nwhere a field differs significantly.  "
+		"<before> and <after> are captures or\ncomma-separated lists "
+		"of captures.\n  -p parser  one of:", argv0);
+	for (auto &i : ParserFactory::get_registered_types())
+		fprintf(stderr, " %s", i.first.c_str());
+	fprintf(stderr, " (default: Fenix3parser)\n"
+		"  -j threads (default: one per CPU)\n"
+		"  -f fields  comma-separated channels, at most %d (default: "
+		"eng_pinging,advance,\n             afr_correction,"
+		"injection_us,lambda_v)\n"
+		"  -t min_t   smallest |t| (Welch's t-test) reported "
+		"(default: 3)\n"
+		"  -m min_samples per bin and side (default: 5)\n"
+		"  -n top     differences listed (default: 30)\n",
+		CMP_MAX_FIELDS);
+}
+
+int main(int argc, char *argv[]) {
+	std::string parser_t = "Fenix3parser",
+		fields_spec = "eng_pinging,advance,afr_correction,"
+		"injection_us,lambda_v";
+	unsigned threads = 0, min_n = 5, top = 30;
+	double min_t = 3;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:j:f:t:m:n:h")) != -1)
+		switch (opt) {
+		case 'p': parser_t = optarg; break;
+		case 'j': threads = std::atoi(optarg); break;
+		case 'f': fields_spec = optarg; break;
+		case 't': min_t = std::atof(optarg); break;
+		case 'm': min_n = std::max(2, std::atoi(optarg)); break;
+		case 'n': top = std::atoi(optarg); break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	std::vector<int> fields;
+	if (!ParserFactory::get_registered_types().count(parser_t)
+	    || optind != argc - 2 || !parse_fields(fields_spec, fields))
+		return usage(argv[0]), EXIT_FAILURE;
+
+	std::vector<std::string> cap;
+	std::vector<int> side_of;
+	for (int k = 0; k < 2; ++k) {
+		std::istringstream ss(argv[optind + k]);
+		for (std::string path; std::getline(ss, path, ','); )
+			cap.push_back(path), side_of.push_back(k);
+	}
+
+	// one task per capture; both sides are read at the same time
+	XR25workpool pool(threads);
+	std::vector<side_t> result(cap.size());
+	std::vector<char> ok(cap.size());
+	pool.run(cap.size(), [&](unsigned, size_t i) {
+			ok[i] = accumulate(cap[i], parser_t, fields,
+					   result[i]); });
+	side_t side[2];
+	for (size_t i = 0; i < cap.size(); ++i)
+		if (ok[i])
+			side[side_of[i]].merge(result[i]);
+
+	print_side("A (before)", side[0]);
+	print_side("B (after)", side[1]);
+	print_diff(side[0], side[1], fields, min_t, min_n, top);
+
+	fprintf(stderr, "%zu capture(s), %u thread(s)\n", cap.size(),
+		pool.size());
+	return std::count(ok.begin(), ok.end(), 0) ? EXIT_FAILURE
+		: EXIT_SUCCESS;
+}
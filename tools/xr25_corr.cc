@@ -0,0 +1,363 @@
+/* xr25_corr.cc - Find the meaning of unknown frame octets
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "libxr25.hh"
+#include "XR25pool.hh"
+
+#define CORR_MAX_BYTES  64   // longest frame, 0xff 0x00 header included
+#define CORR_MAX_FIELDS 16
+#define CORR_HEADER     2    // c[0], c[1] are always 0xff 0x00
+
+/* A decoded field octets are correlated with; 'inverse' correlates with
+ * 1 / value (e.g. rpm, which ECUs send as a period).
+ */
+struct field_t {
+	std::string name;
+	int         ch;
+	bool        inverse;
+};
+
+/* Sums over the frames of one frame length; everything else is derived from
+ * them by print_report(), so merging is order-independent.  The moments of
+ * an octet pair are those of its octets plus the 'sadj' cross term, e.g.
+ * sum((a + 256b)^2) = s2[a] + 65536 s2[b] + 512 sadj[a].
+ */
+struct moments_t {
+	unsigned long n, steps;         // frames, pairs of consecutive frames
+	double        s1[CORR_MAX_BYTES], s2[CORR_MAX_BYTES],
+		sadj[CORR_MAX_BYTES],       // sum(c[i] * c[i + 1])
+		sxy[CORR_MAX_FIELDS][CORR_MAX_BYTES],
+		fy[CORR_MAX_FIELDS], fy2[CORR_MAX_FIELDS];
+	unsigned long chg[CORR_MAX_BYTES], chg_pair[CORR_MAX_BYTES],
+		hist[CORR_MAX_BYTES][256];
+
+	moments_t() { std::memset(this, 0, sizeof(*this)); }
+
+	void merge(const moments_t &o) {
+		n += o.n, steps += o.steps;
+		for (int i = 0; i < CORR_MAX_BYTES; ++i) {
+			s1[i] += o.s1[i], s2[i] += o.s2[i];
+			sadj[i] += o.sadj[i];
+			chg[i] += o.chg[i], chg_pair[i] += o.chg_pair[i];
+			for (int j = 0; j < 256; ++j)
+				hist[i][j] += o.hist[i][j];
+		}
+		for (int f = 0; f < CORR_MAX_FIELDS; ++f) {
+			fy[f] += o.fy[f], fy2[f] += o.fy2[f];
+			for (int i = 0; i < CORR_MAX_BYTES; ++i)
+				sxy[f][i] += o.sxy[f][i];
+		}
+	}
+};
+
+/** Accumulate the frames of one capture.  The sum loops over octet positions
+ * have no loop-carried dependency and run over a multiple of 8 positions
+ * (frames are zero-padded), so the compiler vectorizes them; see the
+ * Makefile for the flags.
+ */
+class accumulator {
+private:
+	const std::vector<field_t> &__fields;
+	moments_t     &__m;
+	int           __w;                      // positions, rounded up
+	double        __x[CORR_MAX_BYTES + 1], __prev[CORR_MAX_BYTES + 1];
+	double        __y[CORR_MAX_FIELDS];
+	bool          __has_prev;
+public:
+	accumulator(const std::vector<field_t> &f, moments_t &m, int length)
+		: __fields(f), __m(m), __w((length + 7) & ~7),
+		  __has_prev(false) {
+		std::fill(std::begin(__x), std::end(__x), 0);
+	}
+
+	void frame(const unsigned char c[], int length,
+		   const XR25channels &ch) {
+		const int w = __w, nf = __fields.size();
+		double *__restrict x = __x, *__restrict p = __prev;
+
+		for (int i = 0; i < length; ++i) {
+			x[i] = c[i];
+			__m.hist[i][c[i]]++;
+		}
+		for (int f = 0; f < nf; ++f) {
+			double v = ch[__fields[f].ch];
+			__y[f] = !__fields[f].inverse ? v : v ? 1 / v : 0;
+			__m.fy[f] += __y[f], __m.fy2[f] += __y[f] * __y[f];
+		}
+
+		double *__restrict s1 = __m.s1, *__restrict s2 = __m.s2,
+			*__restrict sadj = __m.sadj;
+		for (int i = 0; i < w; ++i) {
+			s1[i] += x[i];
+			s2[i] += x[i] * x[i];
+			sadj[i] += x[i] * x[i + 1];
+		}
+		for (int f = 0; f < nf; ++f) {
+			double *__restrict sxy = __m.sxy[f];
+			const double y = __y[f];
+			for (int i = 0; i < w; ++i)
+				sxy[i] += x[i] * y;
+		}
+		if (__has_prev) {
+			unsigned long *__restrict chg = __m.chg,
+				*__restrict chg_pair = __m.chg_pair;
+			for (int i = 0; i < w; ++i) {
+				chg[i] += x[i] != p[i];
+				chg_pair[i] += (x[i] != p[i])
+					| (x[i + 1] != p[i + 1]);
+			}
+			__m.steps++;
+		}
+		std::copy(x, x + w + 1, p);
+		__has_prev = true;
+		__m.n++;
+	}
+};
+
+/* Moments keyed by frame length */
+typedef std::map<int, std::unique_ptr<moments_t>> by_length_t;
+
+/** Accumulate a single capture into @a out, which may hold the moments of
+ * other captures.
+ * @return false if the file could not be read
+ */
+static bool accumulate(const std::string &path, const std::string &parser_t,
+		       const std::vector<field_t> &fields, by_length_t &out) {
+	XR25capturebuf buf;
+	if (!buf.open(path))
+		return perror(path.c_str()), false;
+	std::istream in(&buf);
+	auto parser = ParserFactory::create(parser_t);
+	XR25streamreader reader(in);
+	XR25channels ch;
+	std::unique_ptr<accumulator> acc;
+	int acc_length = 0;
+
+	reader.run(*parser, [&](const unsigned char c[], int length,
+				XR25frame &fra) {
+		if (length > CORR_MAX_BYTES)
+			return;
+		if (length != acc_length) {   // first frame, or a new ECU
+			auto &m = out[length];
+			if (!m)
+				m.reset(new moments_t);
+			acc.reset(new accumulator(fields, *m, length));
+			acc_length = length;
+		}
+		XR25channelengine::compute(fra, ch);
+		acc->frame(c, length, ch);
+	});
+	return true;
+}
+
+/* Octet or octet pair statistics, derived from a moments_t */
+struct series_t {
+	char   name[16];
+	double entropy, chg, mean, var;
+	double r[CORR_MAX_FIELDS];
+};
+
+/** Pearson's r from the sums; 0 if either side is constant.
+ */
+static double pearson(unsigned long n, double sx, double sx2, double sy,
+		      double sy2, double sxy) {
+	long double _n = n, vx = _n * sx2 - (long double)sx * sx,
+		vy = _n * sy2 - (long double)sy * sy,
+		cxy = _n * sxy - (long double)sx * sy;
+	if (vx <= 0 || vy <= 0)
+		return 0;
+	return static_cast<double>(cxy / std::sqrt(vx * vy));
+}
+
+/** Derive the octet (@a hi == 0) or pair (value = @a lo + 256 * @a hi) at
+ * positions @a i_lo, @a i_hi.
+ */
+static series_t derive(const moments_t &m, int nf, int i_lo, int i_hi,
+		       double hi) {
+	const int adj = std::min(i_lo, i_hi);
+	series_t s;
+	double sx = m.s1[i_lo] + hi * m.s1[i_hi],
+		sx2 = m.s2[i_lo] + hi * hi * m.s2[i_hi]
+		+ 2 * hi * m.sadj[adj];
+
+	if (hi == 0) {
+		snprintf(s.name, sizeof(s.name), "c[%d]", i_lo);
+		s.entropy = 0;
+		for (int j = 0; j < 256; ++j)
+			if (m.hist[i_lo][j]) {
+				double p = static_cast<double>
+					(m.hist[i_lo][j]) / m.n;
+				s.entropy -= p * std::log2(p);
+			}
+		s.chg = m.steps ? 100. * m.chg[i_lo] / m.steps : 0;
+	} else {
+		snprintf(s.name, sizeof(s.name), "c[%d]<<8|c[%d]", i_hi,
+			 i_lo);
+		s.entropy = NAN;
+		s.chg = m.steps ? 100. * m.chg_pair[adj] / m.steps : 0;
+	}
+	s.mean = sx / m.n;
+	s.var = sx2 / m.n - s.mean * s.mean;
+	for (int f = 0; f < nf; ++f)
+		s.r[f] = pearson(m.n, sx, sx2, m.fy[f], m.fy2[f],
+				 m.sxy[f][i_lo] + hi * m.sxy[f][i_hi]);
+	return s;
+}
+
+static void print_series(const series_t &s, int nf) {
+	printf("%-14s ", s.name);
+	if (std::isnan(s.entropy))
+		printf("%5s", "-");
+	else
+		printf("%5.2f", s.entropy);
+	printf(" %5.1f %8.1f", s.chg, s.mean);
+	for (int f = 0; f < nf; ++f)
+		printf(" %6.2f", s.r[f]);
+	putchar('\n');
+}
+
+static void print_report(int length, const moments_t &m,
+			 const std::vector<field_t> &fields, unsigned top) {
+	const int nf = fields.size();
+	std::vector<series_t> byte, pair;
+
+	for (int i = CORR_HEADER; i < length; ++i)
+		byte.push_back(derive(m, nf, i, i, 0));
+	// pairs with a constant octet say nothing the other octet does not
+	for (int i = CORR_HEADER; i + 1 < length; ++i)
+		if (byte[i - CORR_HEADER].var > 0
+		    && byte[i + 1 - CORR_HEADER].var > 0) {
+			pair.push_back(derive(m, nf, i, i + 1, 256));  // LE
+			pair.push_back(derive(m, nf, i + 1, i, 256));  // BE
+		}
+
+	printf("== frame length %d: %lu frames\n", length, m.n);
+	printf("%-14s %5s %5s %8s", "octet", "H", "chg%", "mean");
+	for (auto &i : fields)
+		printf(" %6.6s", i.name.c_str());
+	putchar('\n');
+	for (auto &i : byte)
+		print_series(i, nf);
+
+	printf("\n%-14s %5s %5s %8s", "pair", "", "chg%", "mean");
+	for (auto &i : fields)
+		printf(" %6.6s", i.name.c_str());
+	putchar('\n');
+	for (auto &i : pair)
+		print_series(i, nf);
+
+	// candidates: octets and pairs by |r|; constant ones never match
+	std::vector<const series_t *> all;
+	for (auto &i : byte)
+		all.push_back(&i);
+	for (auto &i : pair)
+		all.push_back(&i);
+	printf("\nbest candidates (|r|)\n");
+	for (int f = 0; f < nf; ++f) {
+		unsigned k = std::min<size_t>(top, all.size());
+		std::partial_sort(all.begin(), all.begin() + k, all.end(),
+				  [f](const series_t *a, const series_t *b) {
+					  return std::fabs(a->r[f])
+						  > std::fabs(b->r[f]); });
+		printf("  %-12s", fields[f].name.c_str());
+		for (unsigned i = 0; i < k && all[i]->r[f] != 0; ++i)
+			printf(" %s %.2f", all[i]->name, all[i]->r[f]);
+		putchar('\n');
+	}
+	putchar('\n');
+}
+
+/** Parse a comma-separated list of channel names, each optionally prefixed
+ * with "1/".
+ * @return false if a name is unknown or there are too many
+ */
+static bool parse_fields(const std::string &spec, std::vector<field_t> &out) {
+	std::istringstream ss(spec);
+	for (std::string name; std::getline(ss, name, ','); ) {
+		bool inverse = name.compare(0, 2, "1/") == 0;
+		int ch = XR25channel_lookup(inverse ? name.substr(2) : name);
+		if (ch < 0 || out.size() == CORR_MAX_FIELDS)
+			return fprintf(stderr, "%s: bad field\n",
+				       name.c_str()), false;
+		out.push_back({ name, ch, inverse });
+	}
+	return !out.empty();
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-p parser] [-j threads] [-f fields] "
+		"[-n top] capture...\n"
+		"Entropy, change rate and correlation with decoded fields of "
+		"every frame octet\nand pair of adjacent octets.\n"
+		"  -p parser  one of:", argv0);
+	for (auto &i : ParserFactory::get_registered_types())
+		fprintf(stderr, " %s", i.first.c_str());
+	fprintf(stderr, " (default: Fenix3parser)\n"
+		"  -j threads (default: one per CPU)\n"
+		"  -f fields  comma-separated channels; \"1/name\" correlates "
+		"with 1 / name\n"
+		"             (default: rpm,1/rpm,throttle,map,temp_water,"
+		"batt_v,spd_km_h)\n"
+		"  -n top     candidates listed per field (default: 5)\n");
+}
+
+int main(int argc, char *argv[]) {
+	std::string parser_t = "Fenix3parser",
+		fields_spec = "rpm,1/rpm,throttle,map,temp_water,batt_v,"
+		"spd_km_h";
+	unsigned threads = 0, top = 5;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:j:f:n:h")) != -1)
+		switch (opt) {
+		case 'p': parser_t = optarg; break;
+		case 'j': threads = std::atoi(optarg); break;
+		case 'f': fields_spec = optarg; break;
+		case 'n': top = std::atoi(optarg); break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	std::vector<field_t> fields;
+	if (!ParserFactory::get_registered_types().count(parser_t)
+	    || optind == argc || !parse_fields(fields_spec, fields))
+		return usage(argv[0]), EXIT_FAILURE;
+
+	std::vector<std::string> cap(argv + optind, argv + argc);
+	XR25workpool pool(threads);
+	std::vector<by_length_t> result(pool.size());   // per worker
+	pool.run(cap.size(), [&](unsigned w, size_t i) {
+			accumulate(cap[i], parser_t, fields, result[w]); });
+
+	std::map<int, moments_t> total;
+	for (auto &i : result)
+		for (auto &j : i)
+			total[j.first].merge(*j.second);
+	for (auto &i : total)
+		print_report(i.first, i.second, fields, top);
+
+	fprintf(stderr, "%zu capture(s), %u thread(s)\n", cap.size(),
+		pool.size());
+	return EXIT_SUCCESS;
+}
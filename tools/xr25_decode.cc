@@ -0,0 +1,69 @@
+/* xr25_decode.cc - decode a XR25 capture to CSV without a display
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "libxr25.hh"
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-p parser] [capture]\n"
+		"Decode a XR25 capture (default: stdin; may be gzip-"
+		"compressed) and write one\nCSV line per frame.\n"
+		"  -p parser  one of:", argv0);
+	for (auto &i : ParserFactory::get_registered_types())
+		fprintf(stderr, " %s", i.first.c_str());
+	fprintf(stderr, " (default: Fenix3parser)\n");
+}
+
+int main(int argc, char *argv[]) {
+	std::string parser_t = "Fenix3parser";
+	XR25capturebuf f;
+	std::istream file(&f), *in = &std::cin;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:h")) != -1)
+		switch (opt) {
+		case 'p': parser_t = optarg; break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	if (!ParserFactory::get_registered_types().count(parser_t))
+		return usage(argv[0]), EXIT_FAILURE;
+	if (optind < argc) {
+		if (!f.open(argv[optind]))
+			return perror(argv[optind]), EXIT_FAILURE;
+		in = &file;
+	}
+
+	XR25channelengine engine;
+
+	printf("time");
+	for (int i = 0; i < CH_COUNT; ++i)
+		printf(",%s", XR25channel_name[i]);
+	putchar('\n');
+	// timestamps are derived from the line rate; captures carry none
+	auto stats = XR25capture_decode(*in, parser_t, [&](double t,
+							   XR25frame &fra) {
+		auto &ch = engine.update(fra, XR25channelengine::at(t));
+		printf("%.3f", t);
+		for (int i = 0; i < CH_COUNT; ++i)
+			printf(",%g", ch[i]);
+		putchar('\n');
+	});
+
+	fprintf(stderr, "%lu frames, %lu dropped\n", stats.frames,
+		stats.dropped);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,286 @@
+/* xr25_fleet.cc - Per-car summaries over a directory of captures
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "libxr25.hh"
+#include "XR25pool.hh"
+
+#define BATT_MIN     10.0    // battery voltage histogram, in volts
+#define BATT_STEP    0.5
+#define BATT_BINS    12
+#define WARM_COLD_C  30.0    // sessions starting below this are warm-ups
+#define WARM_MINUTES 20      // length of the warm-up curve
+
+#define __FAULT(_ch, _f) { #_f, _ch, _f }
+static const struct { const char *name; int ch, bit; } faults[] = {
+	__FAULT(CH_FAULT_FLAGS_1, FAULT_MAP),
+	__FAULT(CH_FAULT_FLAGS_1, FAULT_SPD_SENSOR),
+	__FAULT(CH_FAULT_FLAGS_1, FAULT_LAMBDA_TMP),
+	__FAULT(CH_FAULT_FLAGS_1, FAULT_LAMBDA),
+	__FAULT(CH_FAULT_FLAGS_0, FAULT_WATER_OPEN_C),
+	__FAULT(CH_FAULT_FLAGS_0, FAULT_WATER_SHORT_C),
+	__FAULT(CH_FAULT_FLAGS_0, FAULT_AIR_OPEN_C),
+	__FAULT(CH_FAULT_FLAGS_0, FAULT_AIR_SHORT_C),
+	__FAULT(CH_FAULT_FLAGS_0, FAULT_TPS_LOW),
+	__FAULT(CH_FAULT_FLAGS_0, FAULT_TPS_HIGH),
+	__FAULT(CH_FAULT_FLAGS_2, FAULT_EEPROM_CHECKSUM),
+	__FAULT(CH_FAULT_FLAGS_2, FAULT_PROG_CHECKSUM),
+	__FAULT(CH_FAULT_FLAGS_4, FAULT_PUMP),
+	__FAULT(CH_FAULT_FLAGS_4, FAULT_WASTEGATE),
+	__FAULT(CH_FAULT_FLAGS_4, FAULT_EGR),
+	__FAULT(CH_FAULT_FLAGS_4, FAULT_IDLE_REG),
+	__FAULT(CH_FAULT_FLAGS_3, FAULT_INJECTORS),
+};
+#undef __FAULT
+#define FAULT_COUNT ARRAY_SIZE(faults)
+
+/* Aggregates of one capture, or of several merged by merge(); all sums, so
+ * merging is order-independent.
+ */
+struct summary_t {
+	unsigned      sessions, cold_starts;
+	unsigned long frames, dropped;
+	double        seconds;
+	double        band[XR25_MAP_BANDS][XR25_RPM_BANDS];   // seconds
+	unsigned long fault_frames[FAULT_COUNT], fault_events[FAULT_COUNT];
+	unsigned long batt[BATT_BINS + 2];          // + under, over
+	double        batt_min, batt_max, batt_sum;
+	double        warm_sum[WARM_MINUTES + 1];
+	unsigned      warm_n[WARM_MINUTES + 1];
+
+	summary_t() {
+		std::memset(this, 0, sizeof(*this));
+		batt_min = 1e9, batt_max = -1e9;
+	}
+
+	void merge(const summary_t &o) {
+		sessions += o.sessions, cold_starts += o.cold_starts;
+		frames += o.frames, dropped += o.dropped;
+		seconds += o.seconds;
+		for (int i = 0; i < XR25_MAP_BANDS; ++i)
+			for (int j = 0; j < XR25_RPM_BANDS; ++j)
+				band[i][j] += o.band[i][j];
+		for (unsigned i = 0; i < FAULT_COUNT; ++i)
+			fault_frames[i] += o.fault_frames[i],
+				fault_events[i] += o.fault_events[i];
+		for (int i = 0; i < BATT_BINS + 2; ++i)
+			batt[i] += o.batt[i];
+		batt_min = std::min(batt_min, o.batt_min);
+		batt_max = std::max(batt_max, o.batt_max);
+		batt_sum += o.batt_sum;
+		for (int i = 0; i <= WARM_MINUTES; ++i)
+			warm_sum[i] += o.warm_sum[i],
+				warm_n[i] += o.warm_n[i];
+	}
+};
+
+struct capture_t {
+	std::string path, car;
+	off_t       size;
+};
+
+/** List regular files under @a dir, recursively.  The car of a capture is
+ * the first directory below @a dir (i.e. <dir>/<car>/.../<capture>); files
+ * directly in @a dir are taken as one car each, named after the file.
+ */
+static void list_captures(const std::string &dir, const std::string &car,
+			  std::vector<capture_t> &out) {
+	DIR *dirp = opendir(dir.c_str());
+	if (!dirp)
+		return perror(dir.c_str());
+	for (struct dirent *d; (d = readdir(dirp)); ) {
+		if (d->d_name[0] == '.')
+			continue;
+		std::string path = dir + "/" + d->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) == -1)
+			continue;
+		std::string c = car.empty() ? d->d_name : car;
+		if (S_ISDIR(st.st_mode))
+			list_captures(path, c, out);
+		else if (S_ISREG(st.st_mode))
+			out.push_back({ path, c, st.st_size });
+	}
+	closedir(dirp);
+}
+
+/** Summarize a single capture.
+ * @return false if the file could not be read
+ */
+static bool summarize(const capture_t &cap, const std::string &parser_t,
+		      summary_t &s) {
+	XR25channels ch;
+	unsigned char prev[FAULT_COUNT] = { };
+	double t = 0, warm[WARM_MINUTES + 1];   // t: start of the frame
+	int warm_last = -1;   // last minute of 'warm' filled; -1 if not cold
+	bool first = true;
+
+	auto add = [&](double t_end, XR25frame &fra) {
+		double dt = t_end - t;
+		XR25channelengine::compute(fra, ch);
+		s.frames++, s.seconds += dt;
+		s.band[XR25map_band(ch)][XR25rpm_band(ch)] += dt;
+
+		for (unsigned i = 0; i < FAULT_COUNT; ++i) {
+			bool set = static_cast<int>(ch[faults[i].ch])
+				& faults[i].bit;
+			s.fault_frames[i] += set;
+			s.fault_events[i] += set && !prev[i];
+			prev[i] = set;
+		}
+
+		double v = ch[CH_BATT_V];
+		// bin BATT_BINS: under BATT_MIN; BATT_BINS + 1: over the last
+		int b = v < BATT_MIN ? BATT_BINS : static_cast<int>
+			((v - BATT_MIN) / BATT_STEP);
+		if (v >= BATT_MIN && b >= BATT_BINS)
+			b = BATT_BINS + 1;
+		s.batt[b]++;
+		s.batt_min = std::min(s.batt_min, v);
+		s.batt_max = std::max(s.batt_max, v);
+		s.batt_sum += v;
+
+		if (first && ch[CH_TEMP_WATER] < WARM_COLD_C)
+			warm_last = 0, warm[0] = ch[CH_TEMP_WATER];
+		first = false;
+		while (warm_last >= 0 && warm_last < WARM_MINUTES
+		       && t >= 60. * (warm_last + 1))
+			warm[++warm_last] = ch[CH_TEMP_WATER];
+		t = t_end;
+	};
+	XR25capturestats stats;
+	if (!XR25capture_decode(cap.path, parser_t, add, stats))
+		return perror(cap.path.c_str()), false;
+
+	s.sessions = 1;
+	s.dropped = stats.dropped;
+	if (warm_last >= 0) {
+		s.cold_starts = 1;
+		for (int i = 0; i <= warm_last; ++i)
+			s.warm_sum[i] += warm[i], s.warm_n[i]++;
+	}
+	return true;
+}
+
+static void print_summary(const char *title, const summary_t &s) {
+	printf("== %s: %u session(s), %.1f h, %lu frames, %lu dropped\n",
+	       title, s.sessions, s.seconds / 3600, s.frames, s.dropped);
+	if (!s.frames)
+		return;
+
+	printf("time in band (%%)\n%9s", "MAP\\rpm");
+	for (int j = 0; j < XR25_RPM_BANDS; ++j)
+		printf("%5d", j * XR25_RPM_BAND);
+	putchar('\n');
+	for (int i = XR25_MAP_BANDS - 1; i >= 0; --i) {
+		printf("%9d", i * XR25_MAP_BAND);
+		for (int j = 0; j < XR25_RPM_BANDS; ++j)
+			printf("%5.1f", 100 * s.band[i][j] / s.seconds);
+		putchar('\n');
+	}
+
+	printf("%-32s %10s %8s\n", "fault flags", "time (%)", "events");
+	for (unsigned i = 0; i < FAULT_COUNT; ++i)
+		if (s.fault_frames[i])
+			printf("  %-30s %10.2f %8lu\n", faults[i].name,
+			       100. * s.fault_frames[i] / s.frames,
+			       s.fault_events[i]);
+
+	printf("battery (V): min %.2f, max %.2f, mean %.2f\n", s.batt_min,
+	       s.batt_max, s.batt_sum / s.frames);
+	printf("  %5s-%-5.1f %5.1f%%\n", "", BATT_MIN,
+	       100. * s.batt[BATT_BINS] / s.frames);
+	for (int i = 0; i < BATT_BINS; ++i)
+		printf("  %5.1f-%-5.1f %5.1f%%\n", BATT_MIN + i * BATT_STEP,
+		       BATT_MIN + (i + 1) * BATT_STEP,
+		       100. * s.batt[i] / s.frames);
+	printf("  %5.1f-%-5s %5.1f%%\n", BATT_MIN + BATT_BINS * BATT_STEP,
+	       "", 100. * s.batt[BATT_BINS + 1] / s.frames);
+
+	if (s.cold_starts) {
+		printf("warm-up, mean temp_water (C) of %u cold start(s)\n"
+		       "  min ", s.cold_starts);
+		for (int i = 0; i <= WARM_MINUTES && s.warm_n[i]; ++i)
+			printf("%5d", i);
+		printf("\n  C   ");
+		for (int i = 0; i <= WARM_MINUTES && s.warm_n[i]; ++i)
+			printf("%5.0f", s.warm_sum[i] / s.warm_n[i]);
+		putchar('\n');
+	}
+	putchar('\n');
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-p parser] [-j threads] directory\n"
+		"Summarize the captures in <directory>/<car>/..., per car "
+		"and for the whole fleet.\n  -p parser  one of:", argv0);
+	for (auto &i : ParserFactory::get_registered_types())
+		fprintf(stderr, " %s", i.first.c_str());
+	fprintf(stderr, " (default: Fenix3parser)\n"
+		"  -j threads (default: one per CPU)\n");
+}
+
+int main(int argc, char *argv[]) {
+	std::string parser_t = "Fenix3parser";
+	unsigned threads = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:j:h")) != -1)
+		switch (opt) {
+		case 'p': parser_t = optarg; break;
+		case 'j': threads = std::atoi(optarg); break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	if (!ParserFactory::get_registered_types().count(parser_t)
+	    || optind != argc - 1)
+		return usage(argv[0]), EXIT_FAILURE;
+
+	std::vector<capture_t> cap;
+	list_captures(argv[optind], "", cap);
+	// owners take the back of their queues: start with the largest files
+	std::sort(cap.begin(), cap.end(), [](const capture_t &a,
+					     const capture_t &b) {
+			  return a.size < b.size; });
+
+	XR25workpool pool(threads);
+	std::vector<summary_t> result(cap.size());
+	std::vector<char> ok(cap.size());
+	pool.run(cap.size(), [&](unsigned, size_t i) {
+			ok[i] = summarize(cap[i], parser_t, result[i]); });
+
+	std::map<std::string, summary_t> car;
+	summary_t fleet;
+	for (size_t i = 0; i < cap.size(); ++i)
+		if (ok[i])
+			car[cap[i].car].merge(result[i]),
+				fleet.merge(result[i]);
+	for (auto &i : car)
+		print_summary(i.first.c_str(), i.second);
+	if (car.size() > 1)
+		print_summary("fleet", fleet);
+
+	fprintf(stderr, "%zu capture(s), %zu car(s), %u thread(s)\n",
+		cap.size(), car.size(), pool.size());
+	return EXIT_SUCCESS;
+}
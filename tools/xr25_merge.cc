@@ -0,0 +1,398 @@
+/* xr25_merge.cc - Line up XR25 frames with auxiliary sensor streams
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ext/stdio_filebuf.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "libxr25.hh"
+#include "XR25merge.hh"
+
+#define KNOTS_TO_KM_H 1.852
+
+/* An auxiliary input: 'nmea' (GPS; RMC sentences give speed, latitude and
+ * longitude) or 'csv' (one sample per line)
+ */
+struct aux_t {
+	std::string kind, path;
+	double      offset;            // s, added to replayed timestamps
+	std::vector<std::string> names;
+};
+
+/** Parse '<kind>:<path>[@<offset>][=<name>,...]'.
+ */
+static bool parse_aux(const std::string &spec, aux_t &a) {
+	size_t c = spec.find(':'), eq = spec.find('=', c);
+	if (c == std::string::npos)
+		return false;
+	a.kind = spec.substr(0, c);
+	std::string path = spec.substr(c + 1, eq == std::string::npos
+				       ? std::string::npos : eq - c - 1);
+	size_t at = path.rfind('@');
+	a.offset = 0;
+	if (at != std::string::npos) {
+		char *end;
+		a.offset = std::strtod(path.c_str() + at + 1, &end);
+		if (*end)
+			return false;
+		path.resize(at);
+	}
+	a.path = path;
+	if (eq != std::string::npos) {
+		std::istringstream ss(spec.substr(eq + 1));
+		for (std::string n; std::getline(ss, n, ','); )
+			a.names.push_back(n);
+	}
+	if (a.kind == "nmea" && a.names.empty())
+		a.names = { "gps_speed_km_h", "gps_lat", "gps_lon" };
+	return (a.kind == "nmea" || a.kind == "csv") && !a.path.empty();
+}
+
+/** Split a CSV line into numbers (commas, spaces or tabs).
+ * @return false if a field is not a number
+ */
+static bool split_numbers(const std::string &line, std::vector<double> &v) {
+	v.clear();
+	const char *p = line.c_str();
+	while (*p) {
+		while (*p == ',' || *p == ' ' || *p == '\t' || *p == '\r')
+			p++;
+		if (!*p)
+			break;
+		char *end;
+		double x = std::strtod(p, &end);
+		if (end == p)
+			return false;
+		v.push_back(x), p = end;
+	}
+	return !v.empty();
+}
+
+/** Parse a RMC sentence, e.g.
+ *   $GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W*6A
+ * @param tod Set to the time of day, in seconds
+ * @return false if @a line is not a valid RMC sentence with a fix
+ */
+static bool parse_rmc(const std::string &line, double &tod, XR25record &r) {
+	if (line.size() < 7 || line[0] != '$' || line.compare(3, 4, "RMC,"))
+		return false;
+	size_t star = line.find('*');
+	if (star == std::string::npos || star + 3 > line.size())
+		return false;
+	unsigned char sum = 0;
+	for (size_t i = 1; i < star; ++i)
+		sum ^= line[i];
+	if (std::strtoul(line.substr(star + 1, 2).c_str(), nullptr, 16)
+	    != sum)
+		return false;
+
+	std::vector<std::string> f;
+	std::istringstream ss(line.substr(0, star));
+	for (std::string i; std::getline(ss, i, ','); )
+		f.push_back(i);
+	if (f.size() < 8 || f[2] != "A" || f[1].size() < 6)
+		return false;
+	auto deg = [](const std::string &v, const std::string &hemi) {
+		double x = std::atof(v.c_str());
+		double d = std::floor(x / 100) + std::fmod(x, 100) / 60;
+		return hemi == "S" || hemi == "W" ? -d : d;
+	};
+	const double hms = std::atof(f[1].c_str());
+	tod = std::floor(hms / 10000) * 3600
+		+ std::floor(std::fmod(hms, 10000) / 100) * 60
+		+ std::fmod(hms, 100);
+	r.n = 3;
+	r.v[0] = std::atof(f[7].c_str()) * KNOTS_TO_KM_H;
+	r.v[1] = deg(f[3], f[4]);
+	r.v[2] = deg(f[5], f[6]);
+	return true;
+}
+
+/** Read an auxiliary input and push its records until the end of input.
+ */
+static void read_aux(const aux_t &a, unsigned source, bool live,
+		     std::istream &in, XR25merger &m) {
+	std::vector<double> v;
+	double tod0 = NAN, wrap = 0, last_tod = 0;
+	for (std::string line; std::getline(in, line); ) {
+		XR25record r;
+		r.source = source;
+		if (a.kind == "nmea") {
+			double tod;
+			if (!parse_rmc(line, tod, r))
+				continue;
+			if (std::isnan(tod0))
+				tod0 = last_tod = tod;
+			if (tod < last_tod)   // midnight
+				wrap += 86400;
+			last_tod = tod;
+			r.t = tod - tod0 + wrap + a.offset;
+		} else {
+			if (!split_numbers(line, v))
+				continue;     // e.g. a header line
+			size_t first = live ? 0 : 1;
+			if (v.size() <= first)
+				continue;
+			r.t = live ? 0 : v[0] + a.offset;
+			r.n = std::min<size_t>(v.size() - first,
+					       XR25MERGE_MAX_VALUES);
+			std::copy_n(v.begin() + first, r.n, r.v);
+		}
+		if (live)
+			r.t = m.now();
+		m.push(r);
+	}
+	m.finish(source);
+}
+
+/** Name the columns of a replayed CSV input after its header line, if
+ * any and the columns are not named in the command line.
+ */
+static void read_csv_names(aux_t &a, std::istream &in) {
+	const int c = in.peek();
+	std::string line, n;
+	if (!a.names.empty() || c == EOF || std::isdigit(c) || c == '-'
+	    || c == '+' || c == '.' || !std::getline(in, line))
+		return;
+	std::istringstream ss(line);
+	std::getline(ss, n, ',');    // the time column
+	while (std::getline(ss, n, ','))
+		a.names.push_back(n);
+}
+
+/** Open a live input.  A terminal is opened without waiting for DCD and,
+ * if @a tty is given, its line is set as in xr25_diag (see ttyS_init() in
+ * main.cc); other files, e.g. pipes, are opened as they are.
+ * @param detect Find the settings of the line, see XR25ttyconf::detect()
+ * @return The file descriptor, or -1; errno is set
+ */
+static int open_live(const std::string &path, XR25ttyconf *tty, bool detect) {
+	struct stat st;
+	if (stat(path.c_str(), &st) == -1)
+		return -1;
+	if (!S_ISCHR(st.st_mode))
+		return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	int fd = open(path.c_str(), O_RDONLY | O_NOCTTY | O_NDELAY
+		      | O_CLOEXEC);
+	if (fd == -1 || !tty)
+		return fd;
+	int err = detect ? XR25ttyconf::detect(fd, *tty) : tty->apply(fd);
+	if (detect && err == EAGAIN)
+		fprintf(stderr, "%s: no frames received, using %s\n",
+			path.c_str(), tty->str().c_str()), err = 0;
+	else if (detect && !err)
+		fprintf(stderr, "%s: detected %s\n", path.c_str(),
+			tty->str().c_str());
+	if (err && err != ENOTTY)
+		return close(fd), errno = err, -1;
+	// O_NDELAY open() flag disables blocking mode for I/O; reenable
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	return fd;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-p parser] [-f fields] [-l] [-s conf] "
+		"[-d delay_ms] [-g max_gap]\n       [-r] xr25_input "
+		"aux_input...\n"
+		"Merge a XR25 stream with auxiliary streams (e.g. a GPS or "
+		"a wideband lambda\ncontroller) and write one CSV line per "
+		"frame with the auxiliary values\ninterpolated at the time of "
+		"the frame.  Inputs are replayed files, with\ntimes since the "
+		"start of the capture, or, with -l, devices or pipes read\n"
+		"live.  An auxiliary input is <kind>:<path>[@<offset>]"
+		"[=<name>,...], where\n<kind> is\n"
+		"  nmea  GPS sentences; RMC gives speed (km/h), latitude and "
+		"longitude\n"
+		"  csv   a sample per line: 't,value,...' if replayed, "
+		"'value,...' if live;\n        columns are named by <name>s "
+		"or the first line of the file\n"
+		"<offset> (s) is added to replayed times.\n"
+		"  -p parser  one of:", argv0);
+	for (auto &i : ParserFactory::get_registered_types())
+		fprintf(stderr, " %s", i.first.c_str());
+	fprintf(stderr, " (default: Fenix3parser)\n"
+		"  -f fields  comma-separated channels, at most %d (default: "
+		"rpm,map,lambda_v,spd_km_h)\n"
+		"  -l         live input; times are those of arrival\n"
+		"  -s conf    serial configuration of a live xr25_input, e.g. "
+		"62500,8N1\n             (default), or auto; other ports "
+		"must be set up beforehand\n"
+		"  -d delay   ms a live input is waited for (default: 200)\n"
+		"  -g max_gap s between samples interpolated (default: 1)\n"
+		"  -r         write the merged records instead: "
+		"'time,source,value...'\n", XR25MERGE_MAX_VALUES);
+}
+
+int main(int argc, char *argv[]) {
+	std::string parser_t = "Fenix3parser",
+		fields_spec = "rpm,map,lambda_v,spd_km_h", conf = "62500,8N1";
+	bool live = false, raw = false;
+	double delay = 0.2, max_gap = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:f:ls:d:g:rh")) != -1)
+		switch (opt) {
+		case 'p': parser_t = optarg; break;
+		case 'f': fields_spec = optarg; break;
+		case 'l': live = true; break;
+		case 's': conf = optarg; break;
+		case 'd': delay = std::atof(optarg) / 1000; break;
+		case 'g': max_gap = std::atof(optarg); break;
+		case 'r': raw = true; break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	std::vector<int> fields;
+	std::istringstream ss(fields_spec);
+	for (std::string name; std::getline(ss, name, ','); ) {
+		int ch = XR25channel_lookup(name);
+		if (ch < 0 || fields.size() == XR25MERGE_MAX_VALUES)
+			return fprintf(stderr, "%s: bad field\n",
+				       name.c_str()), EXIT_FAILURE;
+		fields.push_back(ch);
+	}
+	std::vector<aux_t> aux(argc - optind > 1 ? argc - optind - 1 : 0);
+	for (size_t i = 0; i < aux.size(); ++i)
+		if (!parse_aux(argv[optind + 1 + i], aux[i]))
+			return fprintf(stderr, "%s: bad input\n",
+				       argv[optind + 1 + i]), EXIT_FAILURE;
+	XR25ttyconf tty;
+	const bool detect = conf == "auto";
+	if (!ParserFactory::get_registered_types().count(parser_t)
+	    || fields.empty() || aux.empty()
+	    || (!detect && !XR25ttyconf::parse(conf, tty)))
+		return usage(argv[0]), EXIT_FAILURE;
+
+	/* replayed files may be gzip-compressed; live inputs are read with
+	 * a stdio_filebuf, which returns what is available
+	 */
+	const size_t n_in = aux.size() + 1;
+	std::vector<std::unique_ptr<std::streambuf>> buf(n_in);
+	std::vector<std::unique_ptr<std::istream>> in(n_in);
+	for (size_t i = 0; i < n_in; ++i) {
+		const std::string &path = i ? aux[i - 1].path : argv[optind];
+		bool ok;
+		if (live) {
+			int fd = open_live(path, i ? nullptr : &tty, detect);
+			ok = fd != -1;
+			if (ok)
+				buf[i].reset(new __gnu_cxx::stdio_filebuf<char>
+					     (fd, std::ios::in));
+		} else {
+			auto f = new XR25capturebuf;
+			buf[i].reset(f);
+			ok = f->open(path);
+		}
+		if (!ok)
+			return perror(path.c_str()), EXIT_FAILURE;
+		in[i].reset(new std::istream(buf[i].get()));
+	}
+	for (size_t i = 0; i < aux.size(); ++i) {
+		if (aux[i].kind == "csv" && !live)
+			read_csv_names(aux[i], *in[i + 1]);
+		if (aux[i].kind == "csv" && aux[i].names.empty())
+			return fprintf(stderr, "%s: name the columns, e.g. "
+				       "csv:%s=afr\n", aux[i].path.c_str(),
+				       aux[i].path.c_str()), EXIT_FAILURE;
+	}
+
+	XR25merger merger(live ? delay : -1);
+	for (size_t i = 0; i < n_in; ++i)
+		merger.add_source();
+
+	std::vector<std::thread> thrd;
+	XR25capturestats stats;
+	thrd.emplace_back([&]() {
+		stats = XR25capture_decode(*in[0], parser_t, [&](double t,
+							       XR25frame &fra) {
+			XR25channels ch;
+			XR25record r;
+			XR25channelengine::compute(fra, ch);
+			// replayed captures carry no time: use the line rate
+			r.t = live ? merger.now() : t;
+			r.source = 0, r.n = fields.size();
+			for (size_t i = 0; i < fields.size(); ++i)
+				r.v[i] = ch[fields[i]];
+			merger.push(r);
+		});
+		merger.finish(0);
+	});
+	for (size_t i = 0; i < aux.size(); ++i)
+		thrd.emplace_back(read_aux, std::cref(aux[i]), i + 1, live,
+				  std::ref(*in[i + 1]), std::ref(merger));
+
+	auto print = [](double v) {
+		if (std::isnan(v))
+			putchar(',');
+		else
+			printf(",%g", v);
+	};
+	XR25record r;
+	unsigned long rows = 0;
+	if (raw) {
+		printf("time,source,values\n");
+		while (merger.pop(r)) {
+			printf("%.3f,%u", r.t, r.source);
+			for (unsigned i = 0; i < r.n; ++i)
+				print(r.v[i]);
+			putchar('\n'), rows++;
+		}
+	} else {
+		printf("time");
+		for (int i : fields)
+			printf(",%s", XR25channel_name[i]);
+		for (auto &i : aux)
+			for (auto &j : i.names)
+				printf(",%s", j.c_str());
+		putchar('\n');
+
+		XR25aligner align(n_in, 0, max_gap, [&](const XR25record &p,
+				const XR25aligner::aux_t v[]) {
+			printf("%.3f", p.t);
+			for (unsigned i = 0; i < p.n; ++i)
+				print(p.v[i]);
+			for (size_t i = 0; i < aux.size(); ++i)
+				for (size_t j = 0; j < aux[i].names.size()
+					     && j < XR25MERGE_MAX_VALUES; ++j)
+					print(v[i + 1][j]);
+			putchar('\n'), rows++;
+		});
+		if (max_gap * XR25_MAX_FRA_PER_SEC > align.capacity())
+			fprintf(stderr, "warning: -g %g: at most %u frames "
+				"wait for later samples\n", max_gap,
+				align.capacity());
+		while (merger.pop(r))
+			align.add(r);
+		align.finish();
+	}
+	for (auto &i : thrd)
+		i.join();
+
+	fprintf(stderr, "%lu line(s), %lu frames, %lu dropped\n", rows,
+		stats.frames, stats.dropped);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+/* xr25_query.cc - Find the time ranges of captures matching an expression
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include "libxr25.hh"
+#include "XR25pool.hh"
+
+struct result_t {
+	std::vector<std::pair<double, double>> range;
+	XR25colquery::stats stats;
+	bool ok, cached;
+	int  err;          // errno of a failed load(), set on the worker
+};
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-p parser] [-j threads] [-n] [-s] "
+		"'expression [for duration]' capture...\n"
+		"Print the time ranges of every capture where the expression "
+		"(see XR25rules.hh)\nis non-zero, as '<capture> <start> <end> "
+		"<length>' in seconds since the start\nof the capture, e.g.\n"
+		"  %s 'rpm > 3000 && map > 800 && lambda_v < 300 for 1s' "
+		"*.bin\nCaptures are decoded once to <capture>%s; later "
+		"queries read that file.\n  -p parser  one of:", argv0, argv0,
+		XR25COL_SUFFIX);
+	for (auto &i : ParserFactory::get_registered_types())
+		fprintf(stderr, " %s", i.first.c_str());
+	fprintf(stderr, " (default: Fenix3parser)\n"
+		"  -j threads (default: one per CPU)\n"
+		"  -n         do not write <capture>%s files\n"
+		"  -s         print block statistics and the elapsed time to "
+		"stderr\n", XR25COL_SUFFIX);
+}
+
+int main(int argc, char *argv[]) {
+	std::string parser_t = "Fenix3parser";
+	unsigned threads = 0;
+	bool save_cache = true, print_stats = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:j:nsh")) != -1)
+		switch (opt) {
+		case 'p': parser_t = optarg; break;
+		case 'j': threads = std::atoi(optarg); break;
+		case 'n': save_cache = false; break;
+		case 's': print_stats = true; break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	if (!ParserFactory::get_registered_types().count(parser_t)
+	    || argc - optind < 2)
+		return usage(argv[0]), EXIT_FAILURE;
+
+	std::unique_ptr<XR25colquery> query;
+	try {
+		query.reset(new XR25colquery(argv[optind]));
+	} catch (const XR25rule_error &err) {
+		fprintf(stderr, "%s\n", err.what());
+		return EXIT_FAILURE;
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	std::vector<std::string> cap(argv + optind + 1, argv + argc);
+	std::vector<result_t> res(cap.size());
+	// one capture per task; XR25colquery::run() is thread-safe
+	XR25workpool pool(threads);
+	pool.run(cap.size(), [&](unsigned, size_t i) {
+			result_t &r = res[i];
+			XR25colstore store;
+			r.stats = { 0, 0, 0 };
+			r.ok = store.load(cap[i], parser_t, save_cache,
+					  &r.cached);
+			r.err = r.ok ? 0 : errno;
+			if (r.ok)
+				query->run(store, [&](double b, double e) {
+						r.range.emplace_back(b, e); },
+					&r.stats); });
+	double elapsed = std::chrono::duration<double>
+		(std::chrono::steady_clock::now() - t0).count();
+
+	size_t failed = 0, ranges = 0, cached = 0;
+	XR25colquery::stats total = { 0, 0, 0 };
+	for (size_t i = 0; i < cap.size(); ++i) {
+		const result_t &r = res[i];
+		if (!r.ok) {
+			fprintf(stderr, "%s: %s\n", cap[i].c_str(),
+				strerror(r.err)), failed++;
+			continue;
+		}
+		for (auto &j : r.range)
+			printf("%s\t%.3f\t%.3f\t%.3f\n", cap[i].c_str(),
+			       j.first, j.second, j.second - j.first);
+		ranges += r.range.size(), cached += r.cached;
+		total.skipped += r.stats.skipped;
+		total.matched += r.stats.matched;
+		total.scanned += r.stats.scanned;
+	}
+	if (print_stats)
+		fprintf(stderr, "%zu range(s) in %zu capture(s) (%zu cached, "
+			"%zu failed), %.3f s, %u thread(s)\nblocks of %d "
+			"frames: %zu skipped, %zu matched whole, %zu "
+			"scanned\n", ranges, cap.size() - failed, cached,
+			failed, elapsed, pool.size(), XR25COL_BLOCK,
+			total.skipped, total.matched, total.scanned);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
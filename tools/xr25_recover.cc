@@ -0,0 +1,95 @@
+/* xr25_recover.cc - Turn a flight recorder file back into a capture
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include "libxr25.hh"
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-i] [-o capture] recorder-file\n"
+		"Write the frames kept by the flight recorder (see "
+		"XR25flightrec.hh) as a\ncapture (default: stdout).\n"
+		"  -i  only print what the file holds\n", argv0);
+}
+
+static void print_time(const char *what, int64_t ns) {
+	char buf[32];
+	time_t t = ns / 1000000000;
+	strftime(buf, sizeof(buf), "%F %T", localtime(&t));
+	fprintf(stderr, "%s%s.%03d\n", what, buf,
+		static_cast<int>(ns / 1000000 % 1000));
+}
+
+int main(int argc, char *argv[]) {
+	const char *out_path = nullptr;
+	bool info_only = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "io:h")) != -1)
+		switch (opt) {
+		case 'i': info_only = true; break;
+		case 'o': out_path = optarg; break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	if (optind != argc - 1)
+		return usage(argv[0]), EXIT_FAILURE;
+
+	FILE *out = stdout;
+	if (!info_only && out_path && !(out = fopen(out_path, "wb")))
+		return perror(out_path), EXIT_FAILURE;
+
+	XR25flightrecorder::info_t info;
+	int64_t t_first = 0, t_last = 0;
+	uint64_t prev_seq = 0, gaps = 0;
+	bool ok = XR25flightrecorder::read(argv[optind], info,
+		[&](const XR25flightrec_record &r, const unsigned char c[]) {
+			if (!t_first)
+				t_first = r.t;
+			else if (r.seq != prev_seq + 1)
+				gaps++;
+			t_last = r.t, prev_seq = r.seq;
+			if (info_only)
+				return;
+			unsigned char buf[2 * XR25FLIGHTREC_MAX_FRAME];
+			fwrite(buf, 1, XR25streamreader::escape_frame
+			       (c, r.length, buf), out);
+		});
+	if (!ok) {
+		fprintf(stderr, "%s: %s\n", argv[optind], errno == EINVAL
+			? "not a flight recorder file" : strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (out != stdout && fclose(out) != 0)
+		return perror(out_path), EXIT_FAILURE;
+
+	fprintf(stderr, "%s: %s\n", argv[optind], info.clean
+		? "closed cleanly" : "not closed (crash or power loss)");
+	print_time("  opened:     ", info.t_open);
+	fprintf(stderr, "  recorded:   %llu frames\n"
+		"  recovered:  %llu frames (#%llu-#%llu), %llu gap(s)\n",
+		(unsigned long long)info.frames,
+		(unsigned long long)info.recovered,
+		(unsigned long long)info.first_seq,
+		(unsigned long long)info.last_seq,
+		(unsigned long long)gaps);
+	if (info.recovered) {
+		print_time("  first frame: ", t_first);
+		print_time("  last frame:  ", t_last);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,309 @@
+/* xr25_renderbench.cc - Benchmark of the gauge and plot drawing code
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <cairomm/context.h>
+#include <cairomm/surface.h>
+#include "libxr25.hh"
+#include "CairoGaugeRenderer.hh"
+#include "CairoTSPlotRenderer.hh"
+
+/* Samples are spaced as frames of this length at the line rate */
+#define BENCH_FRAME_OCTETS 40
+
+typedef std::chrono::steady_clock clock_;
+
+/* Access to the cached background of a renderer, to time compositing it
+ * alone and to time rebuilding it.
+ */
+template <class _Renderer>
+struct probe : _Renderer {
+	using _Renderer::_Renderer;
+
+	/** Paint the background as draw() does, without the data.
+	 */
+	void composite(const Cairo::RefPtr<Cairo::Context> &cc) {
+		cc->save();
+		cc->set_source(this->__background, 0, 0);
+		cc->paint();
+		cc->restore();
+	}
+	void drop_background() { this->__background.clear(); }
+};
+
+#define BENCH_RUNS 3   // the fastest run is reported
+
+/** @return Mean time in microseconds of @a iter calls of @a fn, in the
+ *     fastest of BENCH_RUNS runs; the surface is flushed after each call
+ */
+template <class _Fn>
+static double time_us(const Cairo::RefPtr<Cairo::Surface> &surface,
+		      unsigned iter, _Fn fn) {
+	double best = HUGE_VAL;
+	for (int r = 0; r < BENCH_RUNS; ++r) {
+		auto t0 = clock_::now();
+		for (unsigned i = 0; i < iter; ++i)
+			fn(), surface->flush();
+		best = std::min(best, std::chrono::duration<double,
+				std::micro>(clock_::now() - t0).count());
+	}
+	return best / iter;
+}
+
+/* Synthetic plot data, newest first: a noisy sine over the value range,
+ * with @a segments changes of alert state and @a labels horizontal axis
+ * labels
+ */
+struct plot_data {
+	std::vector<float>                          v;
+	std::unique_ptr<bool[]>                     alert;
+	std::vector<CairoTSPlotRenderer::time_point> t, t_nolabel;
+	CairoTSPlotRenderer::time_point             now;
+
+	plot_data(unsigned n, unsigned segments, unsigned labels, double min,
+		  double max) : v(n), alert(new bool[n]), t(n), t_nolabel(n) {
+		const double dt = static_cast<double>(BENCH_FRAME_OCTETS)
+			/ XR25_BYTES_PER_SEC;
+		const double span = dt * n;
+		// stretch time so that 'labels' label intervals are crossed
+		const double scale = labels ? labels * CAIROTSPLOT_LABEL_SECS
+			/ span : 0;
+		now = CairoTSPlotRenderer::time_point(std::chrono::hours(1));
+		for (unsigned i = 0; i < n; ++i) {
+			double x = static_cast<double>(i) / n;
+			v[i] = min + (max - min) * (0.5 + 0.4 * std::sin(12 * x)
+						    + 0.05 * std::sin(97 * x));
+			alert[i] = (i * (segments + 1) / n) % 2;
+			auto d = std::chrono::duration_cast<clock_::duration>
+				(std::chrono::duration<double>(dt * i * scale));
+			t[i] = now - d;
+			// within one label interval: no label
+			t_nolabel[i] = now;
+		}
+	}
+};
+
+struct plot_result {
+	double draw, composite, stroke, text, background;
+};
+
+static plot_result bench_plot(int w, int h, unsigned n, unsigned segments,
+			      unsigned labels, unsigned iter) {
+	auto surface = Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32, w, h);
+	auto cc = Cairo::Context::create(surface);
+	probe<CairoTSPlotRenderer> r("RPM", 0, 6000, 1500);
+	plot_data d(n, segments, labels, 0, 6000);
+	plot_result res;
+
+	r.draw(cc, w, h, d.v.data(), d.alert.get(), d.t.data(), n, d.now);
+	res.draw = time_us(surface, iter, [&]() {
+			r.draw(cc, w, h, d.v.data(), d.alert.get(), d.t.data(),
+			       n, d.now); });
+	const double nolabel = time_us(surface, iter, [&]() {
+			r.draw(cc, w, h, d.v.data(), d.alert.get(),
+			       d.t_nolabel.data(), n, d.now); });
+	res.composite = time_us(surface, iter, [&]() { r.composite(cc); });
+	res.stroke = nolabel - res.composite;
+	res.text = res.draw - nolabel;
+	res.background = time_us(surface, iter, [&]() {
+			r.drop_background();
+			r.draw(cc, w, h, d.v.data(), d.alert.get(), d.t.data(),
+			       n, d.now); }) - res.draw;
+	return res;
+}
+
+struct gauge_result {
+	double draw, composite, hand, background;
+};
+
+static gauge_result bench_gauge(int size, unsigned iter) {
+	auto surface = Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32, size,
+						   size);
+	auto cc = Cairo::Context::create(surface);
+	probe<CairoGaugeRenderer> r("RPM", 7000, 500, 2);
+	gauge_result res;
+	double value = 0;
+
+	r.draw(cc, size, size, value);
+	res.draw = time_us(surface, iter, [&]() {
+			r.draw(cc, size, size, value);
+			value = value < 7000 ? value + 37 : 0; });
+	res.composite = time_us(surface, iter, [&]() { r.composite(cc); });
+	res.hand = res.draw - res.composite;
+	res.background = time_us(surface, iter, [&]() {
+			r.drop_background();
+			r.draw(cc, size, size, value); }) - res.draw;
+	return res;
+}
+
+/** Time a whole page: every XR25gauges (XR25plots) entry drawn once, as
+ * xr25_diag does for each refresh of the dashboard (plots) page.
+ */
+static void bench_pages(int gauge, int w, int h, unsigned iter) {
+	auto gs = Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32, gauge,
+					      gauge);
+	auto gc = Cairo::Context::create(gs);
+	std::vector<CairoGaugeRenderer> g;
+	for (size_t i = 0; i < XR25gauge_count; ++i)
+		g.emplace_back(XR25gauges[i].text, XR25gauges[i].max,
+			       XR25gauges[i].step, XR25gauges[i].label_step);
+	double value = 0;
+	auto draw_gauges = [&]() {
+		for (auto &i : g)
+			i.draw(gc, gauge, gauge, value);
+		value = value < 100 ? value + 1 : 0;
+	};
+	draw_gauges();
+	double dashboard = time_us(gs, iter, draw_gauges);
+
+	auto ps = Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32, w, h);
+	auto pc = Cairo::Context::create(ps);
+	std::vector<CairoTSPlotRenderer> p;
+	std::vector<plot_data> d;
+	for (size_t i = 0; i < XR25plot_count; ++i) {
+		p.emplace_back(XR25plots[i].text, XR25plots[i].min,
+			       XR25plots[i].max, XR25plots[i].step);
+		d.emplace_back(NUM_POINTS, 0, 1, XR25plots[i].min,
+			       XR25plots[i].max);
+	}
+	auto draw_plots = [&]() {
+		for (size_t i = 0; i < p.size(); ++i)
+			p[i].draw(pc, w, h, d[i].v.data(), d[i].alert.get(),
+				  d[i].t.data(), NUM_POINTS, d[i].now);
+	};
+	draw_plots();
+	double plots = time_us(ps, iter, draw_plots);
+
+	printf("\nper frame: dashboard (%zu gauges %dx%d) %.1f us, plots "
+	       "page (%zu plots %dx%d) %.1f us\n", XR25gauge_count, gauge,
+	       gauge, dashboard, XR25plot_count, w, h, plots);
+}
+
+/** Parse a comma-separated list of unsigned integers.
+ */
+static bool parse_list(const char *s, std::vector<unsigned> &out) {
+	out.clear();
+	for (char *end; *s; s = *end ? end + 1 : end) {
+		out.push_back(std::strtoul(s, &end, 10));
+		if (end == s || (*end && *end != ','))
+			return false;
+	}
+	return !out.empty();
+}
+
+/** Parse a comma-separated list of <width>x<height>.
+ */
+static bool parse_sizes(const char *s, std::vector<std::pair<int, int>> &out)
+{
+	out.clear();
+	for (int w, h, n; *s; s += n + (s[n] == ',')) {
+		if (sscanf(s, "%dx%d%n", &w, &h, &n) != 2 || w <= 0 || h <= 0)
+			return false;
+		out.emplace_back(w, h);
+	}
+	return !out.empty();
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-i iterations] [-n points] [-s sizes] "
+		"[-a segments] [-l labels] [-g sizes]\n"
+		"Time CairoTSPlotRenderer and CairoGaugeRenderer on image "
+		"surfaces; lists are\ncomma-separated and every combination "
+		"is timed.\n"
+		"  -i iterations per measure (default: 500)\n"
+		"  -n plot points (default: 64,128,256,%d)\n"
+		"  -s plot sizes (default: 300x100,600x200,1200x400)\n"
+		"  -a alert segments, i.e. color changes (default: 0,8,64)\n"
+		"  -l horizontal axis labels (default: 2)\n"
+		"  -g gauge sizes (default: 150,250,400)\n", argv0,
+		NUM_POINTS);
+}
+
+int main(int argc, char *argv[]) {
+	std::vector<unsigned> points = { 64, 128, 256, NUM_POINTS },
+		segments = { 0, 8, 64 }, gauges = { 150, 250, 400 };
+	std::vector<std::pair<int, int>> sizes = { { 300, 100 },
+						    { 600, 200 },
+						    { 1200, 400 } };
+	unsigned iter = 500, labels = 2;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:n:s:a:l:g:h")) != -1)
+		switch (opt) {
+		case 'i': iter = std::max(1, std::atoi(optarg)); break;
+		case 'l': labels = std::atoi(optarg); break;
+		case 'n':
+			if (!parse_list(optarg, points))
+				return usage(argv[0]), EXIT_FAILURE;
+			break;
+		case 'a':
+			if (!parse_list(optarg, segments))
+				return usage(argv[0]), EXIT_FAILURE;
+			break;
+		case 'g':
+			if (!parse_list(optarg, gauges))
+				return usage(argv[0]), EXIT_FAILURE;
+			break;
+		case 's':
+			if (!parse_sizes(optarg, sizes))
+				return usage(argv[0]), EXIT_FAILURE;
+			break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	for (auto &i : points)
+		if (i > NUM_POINTS)
+			fprintf(stderr, "%u points: capped to NUM_POINTS "
+				"(%d)\n", i, NUM_POINTS), i = NUM_POINTS;
+
+	/* draw: a call of draw(); composite: painting the cached background;
+	 * stroke: the data path, i.e. draw() without axis labels minus
+	 * composite; text: the axis labels; background: rebuilding the
+	 * cached background (scale, title), done on the first draw() and
+	 * after a resize
+	 */
+	printf("CairoTSPlotRenderer, us per draw\n"
+	       "     size points alerts      draw composite    stroke"
+	       "      text  background\n");
+	for (auto &s : sizes)
+		for (auto n : points)
+			for (auto a : segments) {
+				plot_result r = bench_plot(s.first, s.second,
+							   n, a, labels, iter);
+				printf("%4dx%-4d %6u %6u %9.1f %9.1f %9.1f "
+				       "%9.1f %11.1f\n", s.first, s.second, n,
+				       a, r.draw, r.composite, r.stroke,
+				       r.text, r.background);
+			}
+
+	printf("\nCairoGaugeRenderer, us per draw\n"
+	       "     size      draw composite      hand  background\n");
+	for (auto g : gauges) {
+		gauge_result r = bench_gauge(g, iter);
+		printf("%4ux%-4u %9.1f %9.1f %9.1f %11.1f\n", g, g, r.draw,
+		       r.composite, r.hand, r.background);
+	}
+
+	bench_pages(gauges.back(), sizes.back().first, sizes.back().second,
+		    iter);
+	return EXIT_SUCCESS;
+}
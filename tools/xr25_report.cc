@@ -0,0 +1,280 @@
+/* xr25_report.cc - Render session reports to PNG, SVG or PDF
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <cairomm/context.h>
+#include <cairomm/surface.h>
+#include "libxr25.hh"
+#include "XR25charts.hh"
+#include "XR25pool.hh"
+#include "CairoGaugeRenderer.hh"
+#include "CairoTSPlotRenderer.hh"
+
+/* Page layout, in user units (pixels of a PNG); PDF and SVG pages are
+ * scaled by PAGE_PT_SCALE to about A4
+ */
+#define PAGE_WIDTH     1000
+#define PAGE_HEIGHT    1400
+#define PAGE_PT_SCALE  0.595
+#define TITLE_HEIGHT   60
+#define GAUGE_COLUMNS  4
+#define GAUGE_SIZE     (PAGE_WIDTH / GAUGE_COLUMNS)
+#define PLOT_COLUMNS   2
+#define PLOT_LABELS    8    // at most, along the horizontal axis
+
+/* Samples of the XR25plots of a whole session, column-wise, and the
+ * maximum of the XR25gauges
+ */
+struct session_t {
+	std::vector<float>    v[XR25HISTORY_MAX_COLUMNS];
+	std::vector<uint32_t> alert;   // bit i: XR25plots[i] alert
+	std::vector<double>   max;
+	unsigned long         frames, dropped;
+	double                seconds;
+};
+
+/** Decode a capture; timestamps are derived from the line rate, see
+ * XR25capture_decode().
+ * @return false if the file could not be read
+ */
+static bool load_session(const std::string &path, const std::string &parser_t,
+			 XR25ruleset rules, session_t &s) {
+	XR25channelengine engine;
+	int alert_rule[A_COUNT];
+
+	XR25alert_rules(rules, alert_rule);
+	s.max.assign(XR25gauge_count, 0);
+	auto add = [&](double t, XR25frame &fra) {
+		auto tp = XR25channelengine::at(t);
+		auto &ch = engine.update(fra, tp);
+		rules.evaluate(ch, tp);
+
+		uint32_t alert = 0;
+		for (size_t i = 0; i < XR25plot_count; ++i) {
+			const int a = XR25plots[i].alert;
+			s.v[i].push_back(ch.v[XR25plots[i].ch]);
+			if (a >= 0 && alert_rule[a] >= 0
+			    && rules.get_state(alert_rule[a]))
+				alert |= 1u << i;
+		}
+		s.alert.push_back(alert);
+		for (size_t i = 0; i < XR25gauge_count; ++i)
+			s.max[i] = std::max(s.max[i], ch.v[XR25gauges[i].ch]);
+	};
+	XR25capturestats stats;
+	if (!XR25capture_decode(path, parser_t, add, stats))
+		return perror(path.c_str()), false;
+	s.frames = stats.frames;
+	s.dropped = stats.dropped;
+	s.seconds = stats.seconds;
+	return true;
+}
+
+/** @return A horizontal axis label interval giving at most PLOT_LABELS
+ *     labels over @a seconds
+ */
+static unsigned label_secs(double seconds) {
+	static const unsigned step[] = { 5, 10, 15, 30, 60, 120, 300, 600,
+					 900, 1800, 3600 };
+	for (auto i : step)
+		if (seconds / i <= PLOT_LABELS)
+			return i;
+	return step[ARRAY_SIZE(step) - 1] * static_cast<unsigned>
+		(seconds / (PLOT_LABELS * step[ARRAY_SIZE(step) - 1]) + 1);
+}
+
+/** Draw the report of a session on @a cc, whose target is a
+ * PAGE_WIDTH x PAGE_HEIGHT page.
+ */
+static void draw_report(const Cairo::RefPtr<Cairo::Context> &cc,
+			const std::string &name, const session_t &s) {
+	typedef CairoTSPlotRenderer::time_point time_point;
+	char title[256];
+
+	cc->set_source_rgba(1, 1, 1, 1);
+	cc->paint();
+	cc->set_source_rgba(0, 0, 0, 1);
+	cc->set_font_size(CAIROTSPLOT_FONT_SIZE + 4);
+	const long secs = static_cast<long>(s.seconds);
+	snprintf(title, sizeof(title), "%s: %lu frames (%lu dropped), "
+		 "%ld min %02ld s", name.c_str(), s.frames, s.dropped,
+		 secs / 60, secs % 60);
+	cc->move_to(MARGIN_LEFT + 8, TITLE_HEIGHT / 2);
+	cc->show_text(title);
+	cc->set_font_size(CAIROTSPLOT_FONT_SIZE);
+	cc->move_to(MARGIN_LEFT + 8, TITLE_HEIGHT - 8);
+	cc->show_text("Gauges show the maximum of the session");
+
+	for (size_t i = 0; i < XR25gauge_count; ++i) {
+		const XR25gaugedef &d = XR25gauges[i];
+		CairoGaugeRenderer gauge(d.text, d.max, d.step, d.label_step);
+		cc->save();
+		cc->translate(i % GAUGE_COLUMNS * GAUGE_SIZE, TITLE_HEIGHT
+			      + i / GAUGE_COLUMNS * GAUGE_SIZE);
+		gauge.draw(cc, GAUGE_SIZE, GAUGE_SIZE, s.max[i]);
+		cc->restore();
+	}
+
+	/* the session is drawn as NUM_POINTS buckets, newest first as for
+	 * CairoTSPlotRenderer::draw(): the mean of each bucket, in the alert
+	 * color if any frame of it was; labels show the time since the start
+	 */
+	const size_t frames = s.alert.size();
+	const unsigned n = std::min<size_t>(frames, NUM_POINTS);
+	std::vector<float> v(n);
+	std::unique_ptr<bool[]> alert(new bool[n]);
+	std::vector<time_point> t(n);
+	for (unsigned k = 0; k < n; ++k) {
+		const size_t b = n - 1 - k;
+		t[k] = time_point(std::chrono::duration_cast<time_point
+				  ::duration>(std::chrono::duration<double>
+					      (s.seconds * (b + 1) / n)));
+	}
+
+	const int rows = (XR25gauge_count + GAUGE_COLUMNS - 1)
+		/ GAUGE_COLUMNS;
+	const int top = TITLE_HEIGHT + rows * GAUGE_SIZE,
+		plot_rows = (XR25plot_count + PLOT_COLUMNS - 1) / PLOT_COLUMNS,
+		plot_w = PAGE_WIDTH / PLOT_COLUMNS,
+		plot_h = (PAGE_HEIGHT - top) / std::max(plot_rows, 1);
+	for (size_t i = 0; i < XR25plot_count; ++i) {
+		const XR25plotdef &d = XR25plots[i];
+		for (unsigned k = 0; k < n; ++k) {
+			const size_t b = n - 1 - k, begin = b * frames / n,
+				end = (b + 1) * frames / n;
+			double sum = 0;
+			bool a = false;
+			for (size_t j = begin; j < end; ++j)
+				sum += s.v[i][j], a |= s.alert[j] & 1u << i;
+			v[k] = sum / (end - begin), alert[k] = a;
+		}
+
+		CairoTSPlotRenderer plot(d.text, d.min, d.max, d.step);
+		plot.set_label_secs(label_secs(s.seconds));
+		cc->save();
+		cc->translate(i % PLOT_COLUMNS * plot_w,
+			      top + i / PLOT_COLUMNS * plot_h);
+		plot.draw(cc, plot_w, plot_h, v.data(), alert.get(), t.data(),
+			  n, time_point());
+		cc->restore();
+	}
+}
+
+/** Render the report of @a path to @a out.
+ * @param format "png", "svg" or "pdf"
+ * @return false on error
+ */
+static bool report(const std::string &path, const std::string &out,
+		   const std::string &format, const std::string &parser_t,
+		   const XR25ruleset &rules) {
+	session_t s;
+	if (!load_session(path, parser_t, rules, s))
+		return false;
+	const std::string name = path.substr(path.find_last_of('/') + 1);
+
+	try {
+		Cairo::RefPtr<Cairo::Surface> surface;
+		if (format == "png")
+			surface = Cairo::ImageSurface::create
+				(Cairo::FORMAT_ARGB32, PAGE_WIDTH, PAGE_HEIGHT);
+		else if (format == "svg")
+			surface = Cairo::SvgSurface::create
+				(out, PAGE_WIDTH * PAGE_PT_SCALE,
+				 PAGE_HEIGHT * PAGE_PT_SCALE);
+		else
+			surface = Cairo::PdfSurface::create
+				(out, PAGE_WIDTH * PAGE_PT_SCALE,
+				 PAGE_HEIGHT * PAGE_PT_SCALE);
+		auto cc = Cairo::Context::create(surface);
+		if (format != "png")
+			cc->scale(PAGE_PT_SCALE, PAGE_PT_SCALE);
+		draw_report(cc, name, s);
+		if (format == "png")
+			surface->write_to_png(out);
+		else
+			cc->show_page(), surface->finish();
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s: %s\n", out.c_str(), e.what());
+		return false;
+	}
+	return true;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-p parser] [-j threads] [-f format] "
+		"[-o directory] [-r rules] capture...\n"
+		"Render a report (gauges and plots) of every capture to "
+		"<directory>/<capture>.<format>.\n  -p parser  one of:", argv0);
+	for (auto &i : ParserFactory::get_registered_types())
+		fprintf(stderr, " %s", i.first.c_str());
+	fprintf(stderr, " (default: Fenix3parser)\n"
+		"  -j threads (default: one per CPU)\n"
+		"  -f format  png, svg or pdf (default: pdf)\n"
+		"  -o directory (default: .)\n"
+		"  -r rules   alert rules file (default: xr25_diag.rules, "
+		"if present)\n");
+}
+
+int main(int argc, char *argv[]) {
+	std::string parser_t = "Fenix3parser", format = "pdf", dir = ".",
+		rules_path;
+	unsigned threads = 0;
+	XR25ruleset rules;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:j:f:o:r:h")) != -1)
+		switch (opt) {
+		case 'p': parser_t = optarg; break;
+		case 'j': threads = std::atoi(optarg); break;
+		case 'f': format = optarg; break;
+		case 'o': dir = optarg; break;
+		case 'r': rules_path = optarg; break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	if (!ParserFactory::get_registered_types().count(parser_t)
+	    || (format != "png" && format != "svg" && format != "pdf")
+	    || optind == argc)
+		return usage(argv[0]), EXIT_FAILURE;
+	try {
+		if (rules_path.empty())
+			rules.load_file("xr25_diag.rules");
+		else if (!rules.load_file(rules_path))
+			return perror(rules_path.c_str()), EXIT_FAILURE;
+	} catch (const XR25rule_error &err) {
+		fprintf(stderr, "%s\n", err.what());
+		return EXIT_FAILURE;
+	}
+
+	std::vector<std::string> cap(argv + optind, argv + argc);
+	std::vector<char> ok(cap.size());
+	// one session per task; each has its own renderers and surface
+	XR25workpool pool(threads);
+	pool.run(cap.size(), [&](unsigned, size_t i) {
+			std::string name = cap[i].substr(cap[i]
+						.find_last_of('/') + 1);
+			ok[i] = report(cap[i], dir + "/" + name + "." + format,
+				       format, parser_t, rules); });
+
+	size_t failed = std::count(ok.begin(), ok.end(), 0);
+	fprintf(stderr, "%zu report(s), %zu failed, %u thread(s)\n",
+		cap.size() - failed, failed, pool.size());
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,414 @@
+/* xr25_term.cc - xr25_diag diagnostic page on an ANSI terminal
+ *
+ * Copyright (C) Javier L. Gómez, 2016
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "libxr25.hh"
+
+#define TERM_HZ      8       // default page refresh rate
+#define TERM_HZ_MAX  30
+#define TERM_IDLE_SECS 5     // frame count shown as idle after this
+#define TERM_COL2    42      // first column of the flags
+#define TERM_CELL_MAX 32     // longest text of a cell, attributes included
+
+/* A cell of the screen; rewritten only when its text changes, see
+ * set_cell()
+ */
+struct cell_t {
+	int  row, col, width;
+	char last[TERM_CELL_MAX];
+};
+
+/* Values and flags of the diagnostic page, as in the main window of
+ * xr25_diag; see update_page_diagnostic() in UI.cc
+ */
+struct value_t {
+	const char *label;
+	int        row, col, decimals;
+	double     (*get)(const XR25frame &);
+};
+#define VALUE(_l, _r, _c, _f, _d) { _l, _r, _c, _d,			\
+			[](const XR25frame &f) -> double { return f._f; } }
+static const value_t values[] = {
+	VALUE("MAP (mbar):",               3, 1, map,               0),
+	VALUE("RPM:",                      4, 1, rpm,               0),
+	VALUE("TPS position (%):",         5, 1, throttle,          0),
+	VALUE("Injection (us):",           6, 1, injection_us,      0),
+	VALUE("Advance (deg):",            7, 1, advance,           0),
+	VALUE("Coolant temperature (C):",  8, 1, temp_water,        1),
+	VALUE("Air temperature (C):",      9, 1, temp_air,          1),
+	VALUE("Lambda (mV):",             10, 1, lambda_v,          0),
+	VALUE("Pinging:",                 11, 1, eng_pinging,       0),
+	VALUE("Pinging delay (deg):",     12, 1, eng_pinging_delay, 0),
+	VALUE("Idle regulation (%):",     13, 1, idle_regulation,   0),
+	VALUE("Idle period:",             14, 1, idle_period,       0),
+	VALUE("AFR correction:",          15, 1, afr_correction,    0),
+	VALUE("Speed (km/h):",            16, 1, spd_km_h,          0),
+	VALUE("Program version:",         19, 1, program_vrsn,      0),
+	VALUE("Calibration version:",     20, 1, calib_vrsn,        0),
+	VALUE("Battery (V):",             23, 1, batt_v,            2),
+	VALUE("Atmospheric pressure (mbar):", 24, 1, atmos_pressure, 0),
+};
+
+struct flag_t {
+	const char *label;
+	int        row, col;
+	size_t     offset;       // of an unsigned char member of XR25frame
+	unsigned   bit;
+	bool       fault;
+};
+#define FLAG(_l, _r, _c, _f, _b, _fault) { _l, _r, _c,			\
+			offsetof(XR25frame, _f), _b, _fault }
+#define C1 TERM_COL2
+#define C2 (TERM_COL2 + 19)
+static const flag_t flags[] = {
+	FLAG("A/C request",        3, C1, in_flags,  IN_AC_REQUEST, false),
+	FLAG("A/C compressor",     4, C1, in_flags,  IN_AC_COMPRES, false),
+	FLAG("Throttle released",  5, C1, in_flags,  IN_THROTTLE_0, false),
+	FLAG("Parked",             6, C1, in_flags,  IN_PARKED, false),
+	FLAG("Throttle full",      7, C1, in_flags,  IN_THROTTLE_1, false),
+	FLAG("Pump enable",        3, C2, out_flags, OUT_PUMP_ENABLE, false),
+	FLAG("Idle regulation",    4, C2, out_flags, OUT_IDLE_REGULATION,
+	     false),
+	FLAG("Wastegate reg.",     5, C2, out_flags, OUT_WASTEGATE_REG, false),
+	FLAG("EGR enable",         6, C2, out_flags, OUT_EGR_ENABLE, false),
+	FLAG("Check engine",       7, C2, out_flags, OUT_CHECK_ENGINE, true),
+	FLAG("Lambda closed loop", 8, C2, out_flags, OUT_LAMBDA_LOOP, false),
+
+	FLAG("MAP",               11, C1, fault_flags_1, FAULT_MAP, true),
+	FLAG("Speed sensor",      12, C1, fault_flags_1, FAULT_SPD_SENSOR,
+	     true),
+	FLAG("Lambda (temporary)", 13, C1, fault_flags_1, FAULT_LAMBDA_TMP,
+	     true),
+	FLAG("Lambda",            14, C1, fault_flags_1, FAULT_LAMBDA, true),
+	FLAG("Coolant open c.",   15, C1, fault_flags_0, FAULT_WATER_OPEN_C,
+	     true),
+	FLAG("Coolant short c.",  16, C1, fault_flags_0, FAULT_WATER_SHORT_C,
+	     true),
+	FLAG("Air temp open c.",  17, C1, fault_flags_0, FAULT_AIR_OPEN_C,
+	     true),
+	FLAG("Air temp short c.", 18, C1, fault_flags_0, FAULT_AIR_SHORT_C,
+	     true),
+	FLAG("TPS low",           19, C1, fault_flags_0, FAULT_TPS_LOW, true),
+	FLAG("TPS high",          11, C2, fault_flags_0, FAULT_TPS_HIGH, true),
+	FLAG("EEPROM checksum",   12, C2, fault_flags_2,
+	     FAULT_EEPROM_CHECKSUM, true),
+	FLAG("Program checksum",  13, C2, fault_flags_2, FAULT_PROG_CHECKSUM,
+	     true),
+	FLAG("Pump",              14, C2, fault_flags_4, FAULT_PUMP, true),
+	FLAG("Wastegate",         15, C2, fault_flags_4, FAULT_WASTEGATE, true),
+	FLAG("EGR",               16, C2, fault_flags_4, FAULT_EGR, true),
+	FLAG("Idle regulation",   17, C2, fault_flags_4, FAULT_IDLE_REG, true),
+	FLAG("Injectors",         18, C2, fault_flags_3, FAULT_INJECTORS, true),
+
+	FLAG("Coolant open c.",   22, C1, fault_fugitive, FAULT_WATER_OPEN_C,
+	     true),
+	FLAG("Coolant short c.",  23, C1, fault_fugitive, FAULT_WATER_SHORT_C,
+	     true),
+	FLAG("Air temp open c.",  24, C1, fault_fugitive, FAULT_AIR_OPEN_C,
+	     true),
+	FLAG("Air temp short c.", 22, C2, fault_fugitive, FAULT_AIR_SHORT_C,
+	     true),
+	FLAG("TPS low",           23, C2, fault_fugitive, FAULT_TPS_LOW, true),
+	FLAG("TPS high",          24, C2, fault_fugitive, FAULT_TPS_HIGH, true),
+};
+
+static const struct { const char *text; int row, col; } titles[] = {
+	{ "Engine", 2, 1 }, { "ECU", 18, 1 }, { "Environment", 22, 1 },
+	{ "Inputs/Outputs", 2, C1 }, { "Failures", 10, C1 },
+	{ "Fugitive failures", 21, C1 },
+};
+
+#define VALUE_COL 30
+#define VALUE_WIDTH 10
+
+enum { S_SYNC = 0, S_SYNC_ERR, S_FRA_S, S_FRA_COUNT, _S_COUNT };
+
+/* Output is collected here and written once per refresh.
+ */
+class term_screen {
+private:
+	char   __buf[16384];
+	size_t __n;
+	cell_t __value[ARRAY_SIZE(values)], __flag[ARRAY_SIZE(flags)],
+		__status[_S_COUNT];
+
+	void put(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+public:
+	term_screen();
+
+	/** Clear the screen and draw the labels; every cell is redrawn on
+	 * the next update.
+	 */
+	void redraw();
+
+	/** Queue @a text at @a c with the SGR attributes @a attr, unless
+	 * that is what @a c shows already.
+	 */
+	void set_cell(cell_t &c, const char *attr, const char *text);
+
+	void update_page(const XR25frame &fra);
+	void update_status(XR25streamreader &reader, bool idle);
+
+	/** Write the queued output.
+	 */
+	void flush();
+};
+
+term_screen::term_screen() : __n(0) {
+	for (size_t i = 0; i < ARRAY_SIZE(values); ++i)
+		__value[i] = { values[i].row, VALUE_COL, VALUE_WIDTH, { } };
+	for (size_t i = 0; i < ARRAY_SIZE(flags); ++i)
+		__flag[i] = { flags[i].row, flags[i].col, 18, { } };
+	__status[S_SYNC]      = { 1, 18, 3, { } };
+	__status[S_SYNC_ERR]  = { 1, 32, 7, { } };
+	__status[S_FRA_S]     = { 1, 51, 4, { } };
+	__status[S_FRA_COUNT] = { 1, 65, 16, { } };
+}
+
+void term_screen::put(const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(__buf + __n, sizeof(__buf) - __n, fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		__n = std::min(__n + n, sizeof(__buf) - 1);
+}
+
+void term_screen::redraw() {
+	put("\x1b[0m\x1b[2J\x1b[1;1H\x1b[1mxr25_term\x1b[0m"
+	    "\x1b[1;12Hsync:\x1b[1;23Hdropped:\x1b[1;41Hframes/s:"
+	    "\x1b[1;57Hframes:");
+	for (auto &i : titles)
+		put("\x1b[%d;%dH\x1b[1m%s\x1b[0m", i.row, i.col, i.text);
+	for (auto &i : values)
+		put("\x1b[%d;%dH%s", i.row, i.col + 1, i.label);
+	for (auto &i : __value)
+		i.last[0] = '\0';
+	for (auto &i : __flag)
+		i.last[0] = '\0';
+	for (auto &i : __status)
+		i.last[0] = '\0';
+}
+
+void term_screen::set_cell(cell_t &c, const char *attr, const char *text) {
+	char key[TERM_CELL_MAX];
+	snprintf(key, sizeof(key), "%s%s", attr, text);
+	if (c.last[0] && std::strcmp(key, c.last) == 0)
+		return;
+	std::strcpy(c.last, key);
+	put("\x1b[%d;%dH%s%-*.*s\x1b[0m", c.row, c.col, attr, c.width,
+	    c.width, text);
+}
+
+void term_screen::update_page(const XR25frame &fra) {
+	char b[TERM_CELL_MAX];
+	for (size_t i = 0; i < ARRAY_SIZE(values); ++i) {
+		snprintf(b, sizeof(b), "%*.*f", VALUE_WIDTH, values[i].decimals,
+			 values[i].get(fra));
+		set_cell(__value[i], "", b);
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(flags); ++i) {
+		const flag_t &f = flags[i];
+		const bool on = reinterpret_cast<const unsigned char *>
+			(&fra)[f.offset] & f.bit;
+		set_cell(__flag[i], !on ? "\x1b[2m" : f.fault ? "\x1b[1;41m"
+			 : "\x1b[7m", f.label);
+	}
+}
+
+void term_screen::update_status(XR25streamreader &reader, bool idle) {
+	char b[TERM_CELL_MAX];
+	const bool sync = reader.is_synchronized();
+	set_cell(__status[S_SYNC], sync ? "\x1b[32m" : "\x1b[1;31m",
+		 sync ? "yes" : "no");
+	snprintf(b, sizeof(b), "%d", reader.get_sync_err_count());
+	set_cell(__status[S_SYNC_ERR], "", b);
+	snprintf(b, sizeof(b), "%d", reader.get_fra_per_sec());
+	set_cell(__status[S_FRA_S], "", b);
+	snprintf(b, sizeof(b), "%d%s", reader.get_fra_count(),
+		 idle ? " idle" : "");
+	set_cell(__status[S_FRA_COUNT], "", b);
+}
+
+void term_screen::flush() {
+	for (size_t off = 0; off < __n; ) {
+		ssize_t ret = write(STDOUT_FILENO, __buf + off, __n - off);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1)
+			break;
+		off += ret;
+	}
+	__n = 0;
+}
+
+static volatile sig_atomic_t quit, resized;
+
+static void on_signal(int sig) {
+	if (sig == SIGWINCH)
+		resized = 1;
+	else
+		quit = 1;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-p parser] [-s conf] [-r hz] [device]\n"
+		"Show the diagnostic page of xr25_diag on an ANSI terminal; "
+		"frames are read\nfrom a serial port or from stdin (e.g. "
+		"pv -L 6250 capture.bin | xr25_term).\n"
+		"  -s conf    serial configuration, e.g. 62500,8N1 (default), "
+		"or auto\n"
+		"  -r hz      refresh rate, at most %d (default: %d)\n"
+		"  -p parser  one of:", argv0, TERM_HZ_MAX, TERM_HZ);
+	for (auto &i : ParserFactory::get_registered_types())
+		fprintf(stderr, " %s", i.first.c_str());
+	fprintf(stderr, " (default: Fenix3parser)\n");
+}
+
+int main(int argc, char *argv[]) {
+	typedef std::chrono::steady_clock clock;
+	std::string parser_t = "Fenix3parser", conf = "62500,8N1";
+	int hz = TERM_HZ, fd = STDIN_FILENO, opt;
+
+	while ((opt = getopt(argc, argv, "p:s:r:h")) != -1)
+		switch (opt) {
+		case 'p': parser_t = optarg; break;
+		case 's': conf = optarg; break;
+		case 'r': hz = std::atoi(optarg); break;
+		default:  usage(argv[0]); return EXIT_FAILURE;
+		}
+	XR25ttyconf tty;
+	const bool detect = conf == "auto";
+	if (!ParserFactory::get_registered_types().count(parser_t)
+	    || hz < 1 || hz > TERM_HZ_MAX
+	    || (!detect && !XR25ttyconf::parse(conf, tty)))
+		return usage(argv[0]), EXIT_FAILURE;
+	if (optind < argc) {
+		fd = open(argv[optind], O_RDONLY | O_NOCTTY | O_NDELAY);
+		if (fd == -1)
+			return perror(argv[optind]), EXIT_FAILURE;
+		int err = detect ? XR25ttyconf::detect(fd, tty)
+			: tty.apply(fd);
+		if (err && err != ENOTTY && err != EAGAIN) {
+			fprintf(stderr, "%s: %s\n", argv[optind],
+				strerror(err));
+			return EXIT_FAILURE;
+		}
+	}
+
+	struct sigaction sa;
+	std::memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;   // no SA_RESTART: poll() returns
+	for (int sig : { SIGINT, SIGTERM, SIGHUP, SIGWINCH })
+		sigaction(sig, &sa, nullptr);
+	/* up to 4 reads follow a poll(), see below: none may block, stdin
+	 * included; its flags are restored at exit
+	 */
+	const int fd_flags = fcntl(fd, F_GETFL);
+	fcntl(fd, F_SETFL, fd_flags | O_NONBLOCK);
+
+	auto parser = ParserFactory::create(parser_t);
+	XR25streamreader reader;
+	XR25frame fra = { };
+	bool dirty = false, seen = false;
+	auto sink = [&](const unsigned char c[], int length, XR25frame &f) {
+		fra = f, dirty = seen = true; };
+
+	term_screen screen;
+	printf("\x1b[?1049h\x1b[?25l");   // alternate screen, no cursor
+	fflush(stdout);
+	screen.redraw();
+	screen.update_status(reader, false), screen.flush();
+
+	/* the port is not polled while a frame waits for the next refresh:
+	 * the kernel buffers what arrives meanwhile, so the process wakes up
+	 * about 'hz' times per second however fast frames arrive
+	 */
+	const auto period = std::chrono::microseconds(1000000 / hz);
+	auto next_page = clock::now(), next_status = next_page;
+	int idle_count = -1, idle_secs = 0;
+	unsigned char buf[XR25_READ_CHUNK];
+	bool eof = false;
+	while (!quit && !eof) {
+		auto now = clock::now();
+		auto until = dirty ? std::min(next_page, next_status)
+			: next_status;
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int ms = until > now ? std::chrono::duration_cast
+			<std::chrono::milliseconds>(until - now).count() + 1
+			: 0;
+		int ret = poll(&pfd, !dirty, ms);
+		if (ret == -1 && errno != EINTR)
+			break;
+		if (ret == 0 && dirty && clock::now() >= next_page)
+			pfd.revents = POLLIN;   // catch up after the refresh
+		for (int k = 0; k < 4 && (pfd.revents & (POLLIN | POLLHUP));
+		     ++k) {
+			ssize_t n = read(fd, buf, sizeof(buf));
+			if (n == -1 && errno == EAGAIN)
+				break;
+			if (n <= 0) {
+				eof = n == 0 || errno != EINTR;
+				break;
+			}
+			reader.feed(*parser, buf, n, sink);
+			if (static_cast<size_t>(n) < sizeof(buf))
+				break;
+		}
+
+		now = clock::now();
+		if (resized) {
+			resized = 0;
+			screen.redraw();
+			if (seen)
+				screen.update_page(fra);
+			screen.update_status(reader, idle_secs
+					     >= TERM_IDLE_SECS);
+		}
+		if (dirty && now >= next_page) {
+			screen.update_page(fra), dirty = false;
+			next_page = now + period;
+		}
+		if (now >= next_status) {
+			const int count = reader.get_fra_count();
+			idle_secs = count == idle_count ? idle_secs + 1 : 0;
+			idle_count = count;
+			screen.update_status(reader, idle_secs
+					     >= TERM_IDLE_SECS);
+			next_status = now + std::chrono::seconds(1);
+		}
+		screen.flush();
+	}
+	if (dirty)
+		screen.update_page(fra), screen.flush();
+
+	fcntl(fd, F_SETFL, fd_flags);
+	printf("\x1b[?25h\x1b[?1049l");
+	fflush(stdout);
+	fprintf(stderr, "%d frames, %d dropped\n", reader.get_fra_count(),
+		reader.get_sync_err_count());
+	return EXIT_SUCCESS;
+}